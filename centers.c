@@ -0,0 +1,118 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         centers.c                                                 */
+/*   Description:  Cluster center update shared by the bound-based engines   */
+/*                 (Elkan, Hamerly, ...). The engines keep a running sum and */
+/*                 count per cluster; each loop only the objects that        */
+/*                 changed cluster are moved from one sum to the other, so   */
+/*                 the update costs O(changed x numCoords) instead of        */
+/*                 O(numObjs x numCoords). The distance each center moved is */
+/*                 returned so the engines can relax their bounds.           */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+
+/*----< update_centers() >---------------------------------------------------*/
+/* move the objects whose cluster changed (membership[i] != assign[i]) from  */
+/* the running sum of their old cluster to the one of their new cluster,     */
+/* copy assign[] to membership[] and replace clusters[] by the means. A      */
+/* membership of -1 means the object is not counted yet, so the first call   */
+/* with all -1 sums everything. Empty clusters keep their position. Each     */
+/* thread moves a contiguous range of objects and the changes are added in   */
+/* thread order; with one thread the sums are updated in object order, as    */
+/* in the update loop of seq_kmeans(), so the result is bit-identical.       */
+/* Return the no. objects that changed cluster                               */
+int update_centers(int     nthreads,    /* no. threads */
+                   float **objects,     /* [numObjs][numCoords] */
+                   int     numCoords,   /* no. coordinates */
+                   int     numObjs,     /* no. objects */
+                   int     numClusters, /* no. clusters */
+                   int    *assign,      /* [numObjs] new cluster of objects */
+                   int    *membership,  /* in/out: [numObjs] counted cluster */
+                   int    *size,        /* in/out: [numClusters] counts */
+                   double *sum,         /* in/out: [numClusters][numCoords] */
+                   float **clusters,    /* in/out: [numClusters][numCoords] */
+                   float  *shift)       /* out: [numClusters] distance moved,
+                                           may be NULL */
+{
+    int     i, j, t, changed = 0;
+    int    *partSize = NULL;   /* [nthreads][numClusters] changes */
+    double *partSum  = NULL;   /* [nthreads][numClusters][numCoords] changes */
+
+    if (nthreads > 1) {
+        partSize = (int*)    calloc((size_t)nthreads * numClusters,
+                                    sizeof(int));
+        assert(partSize != NULL);
+        partSum  = (double*) calloc((size_t)nthreads * numClusters * numCoords,
+                                    sizeof(double));
+        assert(partSum != NULL);
+    }
+
+    #pragma omp parallel num_threads(nthreads) private(i,j,t)
+    {
+        int     tid = omp_get_thread_num();
+        int    *mySize = (nthreads > 1) ? partSize + (size_t)tid * numClusters
+                                        : size;
+        double *mySum  = (nthreads > 1) ? partSum + (size_t)tid * numClusters
+                                                  * numCoords
+                                        : sum;
+
+        #pragma omp for schedule(static) reduction(+:changed)
+        for (i=0; i<numObjs; i++) {
+            int     old = membership[i];
+            int     index = assign[i];
+            double *s;
+            if (old == index) continue;
+
+            if (old >= 0) {
+                s = mySum + (size_t)old * numCoords;
+                mySize[old]--;
+                for (j=0; j<numCoords; j++)
+                    s[j] -= objects[i][j];
+            }
+            s = mySum + (size_t)index * numCoords;
+            mySize[index]++;
+            for (j=0; j<numCoords; j++)
+                s[j] += objects[i][j];
+            membership[i] = index;
+            changed++;
+        }
+
+        #pragma omp for schedule(static)
+        for (i=0; i<numClusters; i++) {
+            double *s = sum + (size_t)i * numCoords;
+            float   moved = 0.0;
+            if (nthreads > 1)
+                for (t=0; t<nthreads; t++) {
+                    double *p = partSum + ((size_t)t * numClusters + i)
+                                          * numCoords;
+                    size[i] += partSize[(size_t)t * numClusters + i];
+                    for (j=0; j<numCoords; j++)
+                        s[j] += p[j];
+                }
+            if (size[i] == 0) {
+                /* drop the rounding residue of the objects that left */
+                for (j=0; j<numCoords; j++) s[j] = 0.0;
+            }
+            else {
+                for (j=0; j<numCoords; j++) {
+                    float c = s[j] / size[i];
+                    moved += (c - clusters[i][j]) * (c - clusters[i][j]);
+                    clusters[i][j] = c;
+                }
+            }
+            if (shift != NULL) shift[i] = sqrtf(moved);
+        }
+    }
+
+    free(partSize);
+    free(partSum);
+
+    return changed;
+}
@@ -0,0 +1,477 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         chunk_io.c                                                */
+/*   Description:  Chunked dataset files. A chunk_header (magic, version,    */
+/*                 no. objects, no. coordinates, objects per chunk, layout,  */
+/*                 type, codec) is followed by the byte offset of each chunk */
+/*                 and of the end of the last one (long long [numChunks+1]), */
+/*                 the statistics of each chunk (float min, float max,       */
+/*                 double sum, [numChunks][numCoords] each) and the chunks:  */
+/*                 chunkObjs objects, the last one less, stored as rows      */
+/*                 ([n][numCoords]) or by coordinate ([numCoords][n]). Any   */
+/*                 object can be reached through the offset table and the    */
+/*                 statistics are read without the data. With CHUNK_LZ a     */
+/*                 chunk is byte-shuffled and compressed (codec.c), unless   */
+/*                 that does not make it smaller; compressed chunks are      */
+/*                 decoded by all the threads, one chunk each. Version 1     */
+/*                 files (no codec, numChunks offsets) are still read.       */
+/*                 file_io.c and mpi_io.c read these files in place of the   */
+/*                 raw binary format; convert_main.c writes them.            */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _DEFAULT_SOURCE   /* pread(), pwrite() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>  /* open() */
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>     /* pread(), close() */
+
+#include <omp.h>
+#include "kmeans.h"
+
+#define CHUNK_HEAD_V1  (8 * sizeof(int))   /* header of version 1 files */
+
+/* an open chunked file and its tables */
+typedef struct {
+    int             fd;
+    chunk_header    head;
+    size_t          headLen;  /* bytes of the header in the file */
+    long long      *off;      /* [numChunks + 1] byte offset of each chunk */
+    float          *min;      /* [numChunks][numCoords] */
+    float          *max;      /* [numChunks][numCoords] */
+    double         *sum;      /* [numChunks][numCoords] */
+    float          *buf;      /* [chunkObjs * numCoords] one chunk */
+    unsigned char  *scratch;  /* [chunk_scratch()] compressed chunk */
+    int             bufChunk; /* chunk decoded in buf, -1: none */
+    int             next;     /* object read or written next */
+} chunk_file;
+
+static chunk_file in  = { .fd = -1 };   /* read, chunk_open() */
+static chunk_file out = { .fd = -1 };   /* written, chunk_create() */
+
+
+/*---< chunk_scratch() >-----------------------------------------------------*/
+/* bytes to compress or decode a chunk: the compressed bytes, then the       */
+/* shuffled ones                                                             */
+static
+size_t chunk_scratch(chunk_file *f)
+{
+    size_t raw = (size_t)f->head.chunkObjs * f->head.numCoords * sizeof(float);
+    return lz_bound(raw) + raw;
+}
+
+/*---< chunk_alloc() >-------------------------------------------------------*/
+static
+void chunk_alloc(chunk_file *f)
+{
+    size_t n = (size_t)f->head.numChunks * f->head.numCoords;
+
+    f->off = (long long*) malloc((f->head.numChunks + 1) * sizeof(long long));
+    assert(f->off != NULL);
+    f->min = (float*)  malloc((n + 1) * sizeof(float));
+    assert(f->min != NULL);
+    f->max = (float*)  malloc((n + 1) * sizeof(float));
+    assert(f->max != NULL);
+    f->sum = (double*) malloc((n + 1) * sizeof(double));
+    assert(f->sum != NULL);
+    f->buf = (float*)  malloc(((size_t)f->head.chunkObjs * f->head.numCoords
+                               + 1) * sizeof(float));
+    assert(f->buf != NULL);
+    f->scratch  = NULL;
+    if (f->head.codec != CHUNK_NONE) {
+        f->scratch = (unsigned char*) malloc(chunk_scratch(f));
+        assert(f->scratch != NULL);
+    }
+    f->bufChunk = -1;
+}
+
+/*---< chunk_free() >--------------------------------------------------------*/
+static
+void chunk_free(chunk_file *f)
+{
+    if (f->fd != -1) close(f->fd);
+    free(f->off);
+    free(f->min);
+    free(f->max);
+    free(f->sum);
+    free(f->buf);
+    free(f->scratch);
+    f->fd      = -1;
+    f->off     = NULL;
+    f->min     = NULL;
+    f->max     = NULL;
+    f->sum     = NULL;
+    f->buf     = NULL;
+    f->scratch = NULL;
+}
+
+/*---< chunk_len() >---------------------------------------------------------*/
+/* no. objects of chunk c */
+static
+int chunk_len(chunk_file *f, int c)
+{
+    int first = c * f->head.chunkObjs;
+    return (f->head.numObjs - first < f->head.chunkObjs)
+           ? f->head.numObjs - first : f->head.chunkObjs;
+}
+
+/*---< io_all() >------------------------------------------------------------*/
+/* pread() (write 0) or pwrite() (1) len bytes at pos; return 1 on success   */
+static
+int io_all(chunk_file *f, int write, void *buf, size_t len, long long pos)
+{
+    ssize_t n;
+    size_t  done = 0;
+
+    while (done < len) {
+        n = write ? pwrite(f->fd, (char*)buf + done, len - done, pos + done)
+                  : pread(f->fd, (char*)buf + done, len - done, pos + done);
+        if (n <= 0) return 0;
+        done += n;
+    }
+    return 1;
+}
+
+/*---< tables_io() >---------------------------------------------------------*/
+/* read (write 0) or write (1) the offsets and statistics that follow the    */
+/* header; return 1 on success                                               */
+static
+int tables_io(chunk_file *f, int write)
+{
+    size_t    n    = (size_t)f->head.numChunks * f->head.numCoords;
+    int       nOff = f->head.numChunks + (f->head.version > 1);
+    long long pos  = f->headLen;
+
+    if (!io_all(f, write, f->off, nOff * sizeof(long long), pos))
+        return 0;
+    pos += nOff * sizeof(long long);
+    if (!io_all(f, write, f->min, n * sizeof(float), pos)) return 0;
+    pos += n * sizeof(float);
+    if (!io_all(f, write, f->max, n * sizeof(float), pos)) return 0;
+    pos += n * sizeof(float);
+    return io_all(f, write, f->sum, n * sizeof(double), pos);
+}
+
+/*---< chunk_load() >--------------------------------------------------------*/
+/* chunk c decoded into buf, in the layout of the file; scratch is           */
+/* chunk_scratch() bytes. A chunk stored at its raw size is not compressed.  */
+/* Return 1 on success                                                       */
+static
+int chunk_load(chunk_file    *f,
+               int            c,
+               float         *buf,
+               unsigned char *scratch)
+{
+    size_t raw      = (size_t)chunk_len(f, c) * f->head.numCoords *
+                      sizeof(float);
+    size_t len      = f->off[c + 1] - f->off[c];
+    size_t numElems = raw / sizeof(float);
+
+    if (len == raw) return io_all(f, 0, buf, raw, f->off[c]);
+    if (len > raw || !io_all(f, 0, scratch, len, f->off[c]) ||
+        !lz_decompress(scratch, len, scratch + lz_bound(raw), raw)) {
+        fprintf(stderr, "[chunk io] error: chunk %d is truncated or corrupt\n",
+                c);
+        return 0;
+    }
+    unshuffle_bytes(scratch + lz_bound(raw), numElems, sizeof(float), buf);
+    return 1;
+}
+
+/*---< chunk_copy() >--------------------------------------------------------*/
+/* objects at to at+m-1 of the decoded chunk c into rows[0..m-1]             */
+static
+void chunk_copy(chunk_file *f, int c, const float *buf, int at, int m,
+                float **rows)
+{
+    int i, j, n = chunk_len(f, c), numCoords = f->head.numCoords;
+
+    if (f->head.layout == CHUNK_ROWS)
+        for (i=0; i<m; i++)
+            memcpy(rows[i], buf + (size_t)(at + i) * numCoords,
+                   numCoords * sizeof(float));
+    else
+        for (i=0; i<m; i++)
+            for (j=0; j<numCoords; j++)
+                rows[i][j] = buf[(size_t)j * n + at + i];
+}
+
+/*---< chunk_open() >--------------------------------------------------------*/
+/* open filename if it is a chunked file and read its tables. Return 0, with */
+/* nothing open, if it is not one (a raw binary file)                        */
+int chunk_open(char *filename,
+               int  *numObjs,     /* out: no. objects */
+               int  *numCoords)   /* out: no. coordinates */
+{
+    chunk_file   *f = &in;
+    chunk_header *h = &f->head;
+
+    if ((f->fd = open(filename, O_RDONLY)) == -1) return 0;
+    memset(h, 0, sizeof(chunk_header));
+    f->headLen = (io_all(f, 0, h, CHUNK_HEAD_V1, 0) && h->version == 1)
+                 ? CHUNK_HEAD_V1 : sizeof(chunk_header);
+    if (!io_all(f, 0, h, f->headLen, 0) ||
+        h->magic != CHUNK_MAGIC || h->version < 1 ||
+        h->version > CHUNK_VERSION || h->numObjs < 0 || h->numCoords <= 0 ||
+        h->chunkObjs <= 0 || h->dtype != CHUNK_FLOAT32 ||
+        (h->codec != CHUNK_NONE && h->codec != CHUNK_LZ) ||
+        h->numChunks != (h->numObjs + h->chunkObjs - 1) / h->chunkObjs) {
+        close(f->fd);
+        f->fd = -1;
+        return 0;
+    }
+
+    chunk_alloc(f);
+    if (!tables_io(f, 0)) {
+        fprintf(stderr, "[chunk io] error: truncated file (%s)\n", filename);
+        chunk_free(f);
+        return 0;
+    }
+    if (h->version == 1 && h->numChunks > 0)   /* chunks of the raw size */
+        f->off[h->numChunks] = f->off[h->numChunks - 1] + (long long)
+                chunk_len(f, h->numChunks - 1) * h->numCoords * sizeof(float);
+    f->next    = 0;
+    *numObjs   = h->numObjs;
+    *numCoords = h->numCoords;
+    if (_debug)
+        printf("[chunk io] file %s: %d chunks of %d objects, %s layout%s\n",
+               filename, h->numChunks, h->chunkObjs,
+               (h->layout == CHUNK_COLUMNS) ? "coordinate" : "row",
+               (h->codec == CHUNK_LZ) ? ", compressed" : "");
+    return 1;
+}
+
+/*---< chunk_read_rows() >---------------------------------------------------*/
+/* as file_read_rows(): the next numObjs objects of the file opened by       */
+/* chunk_open() into rows first, first+1, ... of ds; return the no. objects  */
+/* read. Uncompressed files are read in place; compressed chunks are decoded */
+/* whole, a single one is kept for the next call                             */
+int chunk_read_rows(dataset *ds,
+                    int      first,     /* first row to fill */
+                    int      numObjs)   /* no. objects to read */
+{
+    chunk_file *f = &in;
+    int         i, j, m, c, c0, c1, at, n, got = 0, bad = 0;
+    int         numCoords = f->head.numCoords;
+    size_t      rowLen    = (size_t)numCoords * sizeof(float);
+
+    if (numObjs > f->head.numObjs - f->next)
+        numObjs = f->head.numObjs - f->next;
+    if (numObjs <= 0) return 0;
+
+    if (f->head.codec == CHUNK_NONE) {
+        while (got < numObjs) {
+            c  = f->next / f->head.chunkObjs;
+            at = f->next % f->head.chunkObjs;
+            n  = chunk_len(f, c);
+            m  = (numObjs - got < n - at) ? numObjs - got : n - at;
+
+            if (f->head.layout == CHUNK_ROWS) {
+                /* packed rows, as in ds */
+                if (!io_all(f, 0, ds->rows[first + got], m * rowLen,
+                            f->off[c] + at * rowLen))
+                    break;
+            }
+            else {
+                /* one run of m values per coordinate */
+                for (j=0; j<numCoords; j++)
+                    if (!io_all(f, 0, f->buf + (size_t)j * m,
+                                m * sizeof(float), f->off[c] +
+                                ((long long)j * n + at) * sizeof(float)))
+                        return got;
+                for (i=0; i<m; i++)
+                    for (j=0; j<numCoords; j++)
+                        ds->rows[first + got + i][j] = f->buf[(size_t)j * m + i];
+            }
+            got     += m;
+            f->next += m;
+        }
+        return got;
+    }
+
+    c0 = f->next / f->head.chunkObjs;
+    c1 = (f->next + numObjs - 1) / f->head.chunkObjs;
+    if (c0 == c1) {
+        /* within one chunk: decode it once for the calls that follow */
+        if (f->bufChunk != c0) {
+            f->bufChunk = chunk_load(f, c0, f->buf, f->scratch) ? c0 : -1;
+            if (f->bufChunk < 0) return 0;
+        }
+        chunk_copy(f, c0, f->buf, f->next % f->head.chunkObjs, numObjs,
+                   ds->rows + first);
+    }
+    else {
+        /* one chunk per thread at a time */
+        #pragma omp parallel private(c) reduction(+:bad)
+        {
+            float         *buf     = (float*) malloc(
+                                     ((size_t)f->head.chunkObjs * numCoords + 1)
+                                     * sizeof(float));
+            unsigned char *scratch = (unsigned char*) malloc(chunk_scratch(f));
+            assert(buf != NULL && scratch != NULL);
+
+            #pragma omp for schedule(dynamic, 1)
+            for (c=c0; c<=c1; c++) {
+                int lo = c * f->head.chunkObjs;
+                int a  = (f->next > lo) ? f->next - lo : 0;
+                int b  = chunk_len(f, c);
+                if (lo + b > f->next + numObjs) b = f->next + numObjs - lo;
+                if (!chunk_load(f, c, buf, scratch))
+                    bad++;
+                else
+                    chunk_copy(f, c, buf, a, b - a,
+                               ds->rows + first + (lo + a - f->next));
+            }
+            free(buf);
+            free(scratch);
+        }
+        if (bad > 0) return 0;
+    }
+    f->next += numObjs;
+    return numObjs;
+}
+
+/*---< chunk_seek() >--------------------------------------------------------*/
+/* move the file opened by chunk_open() to object index                      */
+int chunk_seek(int index)
+{
+    if (index < 0 || index > in.head.numObjs) return 0;
+    in.next = index;
+    return 1;
+}
+
+/*---< chunk_stats() >-------------------------------------------------------*/
+/* the chunking and statistics of the file opened by chunk_open(); the       */
+/* arrays [numChunks][numCoords] stay valid until chunk_close(). bytes gets  */
+/* the stored size of the chunks                                             */
+int chunk_stats(int        *numChunks,
+                int        *chunkObjs,
+                int        *layout,
+                long long  *bytes,
+                float     **min,
+                float     **max,
+                double    **sum)
+{
+    *numChunks = in.head.numChunks;
+    *chunkObjs = in.head.chunkObjs;
+    *layout    = in.head.layout;
+    *bytes     = (in.head.numChunks > 0) ? in.off[in.head.numChunks] - in.off[0]
+                                         : 0;
+    *min       = in.min;
+    *max       = in.max;
+    *sum       = in.sum;
+    return 1;
+}
+
+/*---< chunk_close() >-------------------------------------------------------*/
+int chunk_close(void)
+{
+    chunk_free(&in);
+    return 1;
+}
+
+/*---< chunk_create() >------------------------------------------------------*/
+/* create filename for numObjs objects, to be given in order to              */
+/* chunk_write() by chunks of chunkObjs (the last one less), then finished   */
+/* by chunk_finish(). Return 0 if the file cannot be created                 */
+int chunk_create(char *filename,
+                 int   numObjs,
+                 int   numCoords,
+                 int   chunkObjs,
+                 int   layout,      /* CHUNK_ROWS or CHUNK_COLUMNS */
+                 int   codec)       /* CHUNK_NONE or CHUNK_LZ */
+{
+    chunk_file *f = &out;
+
+    if ((f->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+        return 0;
+
+    memset(&f->head, 0, sizeof(chunk_header));
+    f->head.magic     = CHUNK_MAGIC;
+    f->head.version   = CHUNK_VERSION;
+    f->head.numObjs   = numObjs;
+    f->head.numCoords = numCoords;
+    f->head.chunkObjs = chunkObjs;
+    f->head.numChunks = (numObjs + chunkObjs - 1) / chunkObjs;
+    f->head.layout    = layout;
+    f->head.dtype     = CHUNK_FLOAT32;
+    f->head.codec     = codec;
+    f->headLen        = sizeof(chunk_header);
+    chunk_alloc(f);
+    f->next   = 0;
+    f->off[0] = f->headLen + (f->head.numChunks + 1) * sizeof(long long) +
+                (size_t)f->head.numChunks * numCoords *
+                (2 * sizeof(float) + sizeof(double));
+    return 1;
+}
+
+/*---< chunk_write() >-------------------------------------------------------*/
+/* append the next chunk, rows[numObjs][numCoords], to the file of           */
+/* chunk_create(); return 1 on success                                       */
+int chunk_write(float **rows,
+                int     numObjs)
+{
+    chunk_file    *f = &out;
+    int            i, j;
+    int            c         = f->next / f->head.chunkObjs;
+    int            numCoords = f->head.numCoords;
+    size_t         len       = (size_t)numObjs * numCoords * sizeof(float);
+    float         *min       = f->min + (size_t)c * numCoords;
+    float         *max       = f->max + (size_t)c * numCoords;
+    double        *sum       = f->sum + (size_t)c * numCoords;
+    unsigned char *data      = (unsigned char*) f->buf;
+
+    if (c >= f->head.numChunks || numObjs != chunk_len(f, c)) return 0;
+
+    for (j=0; j<numCoords; j++) {
+        min[j] = max[j] = rows[0][j];
+        sum[j] = 0.0;
+    }
+    for (i=0; i<numObjs; i++)
+        for (j=0; j<numCoords; j++) {
+            float v = rows[i][j];
+            if (v < min[j]) min[j] = v;
+            if (v > max[j]) max[j] = v;
+            sum[j] += v;
+            if (f->head.layout == CHUNK_ROWS)
+                f->buf[(size_t)i * numCoords + j] = v;
+            else
+                f->buf[(size_t)j * numObjs + i] = v;
+        }
+
+    /* compressed only if that makes it smaller */
+    if (f->head.codec == CHUNK_LZ) {
+        size_t         numElems = len / sizeof(float);
+        unsigned char *shuf     = f->scratch + lz_bound(len);
+        size_t         clen;
+        shuffle_bytes(f->buf, numElems, sizeof(float), shuf);
+        clen = lz_compress(shuf, len, f->scratch);
+        if (clen < len) {
+            data = f->scratch;
+            len  = clen;
+        }
+    }
+
+    if (!io_all(f, 1, data, len, f->off[c])) return 0;
+    f->off[c + 1] = f->off[c] + len;
+    f->next      += numObjs;
+    return 1;
+}
+
+/*---< chunk_finish() >------------------------------------------------------*/
+/* write the header and the tables of the file of chunk_create(), and close  */
+/* it. Return 1 on success                                                   */
+int chunk_finish(void)
+{
+    chunk_file *f = &out;
+    int         ok;
+
+    ok = f->next == f->head.numObjs &&
+         io_all(f, 1, &f->head, sizeof(chunk_header), 0) &&
+         tables_io(f, 1);
+    chunk_free(f);
+    return ok;
+}
@@ -0,0 +1,190 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         codec.c                                                   */
+/*   Description:  Compression of the chunks of chunked files (chunk_io.c).  */
+/*                 shuffle_bytes() groups byte b of every element together,  */
+/*                 so that the sign and exponent bytes of floats, which vary */
+/*                 little, form long repetitive runs; lz_compress() is then  */
+/*                 a byte-oriented LZ77 in the manner of LZ4: sequences of a */
+/*                 token (literal length and match length, 4 bits each,      */
+/*                 extended by bytes of 255), the literals, and a 16-bit     */
+/*                 match offset; the last sequence has literals only. Both   */
+/*                 are single-pass and meant to decode faster than the file  */
+/*                 is read.                                                  */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "kmeans.h"
+
+#define LZ_HASH_LOG   14        /* entries of the match finder, log2 */
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 65535
+
+
+/*----< shuffle_bytes() >----------------------------------------------------*/
+/* out[b * numElems + i] = byte b of element i                               */
+void shuffle_bytes(const void *in,
+                   size_t      numElems,
+                   int         elemSize,
+                   void       *out)
+{
+    size_t               i;
+    int                  b;
+    const unsigned char *src = (const unsigned char*) in;
+    unsigned char       *dst = (unsigned char*) out;
+
+    for (i=0; i<numElems; i++)
+        for (b=0; b<elemSize; b++)
+            dst[b * numElems + i] = src[i * elemSize + b];
+}
+
+/*----< unshuffle_bytes() >--------------------------------------------------*/
+/* the inverse of shuffle_bytes()                                            */
+void unshuffle_bytes(const void *in,
+                     size_t      numElems,
+                     int         elemSize,
+                     void       *out)
+{
+    size_t               i;
+    int                  b;
+    const unsigned char *src = (const unsigned char*) in;
+    unsigned char       *dst = (unsigned char*) out;
+
+    for (b=0; b<elemSize; b++)
+        for (i=0; i<numElems; i++)
+            dst[i * elemSize + b] = src[b * numElems + i];
+}
+
+/*----< lz_bound() >---------------------------------------------------------*/
+/* largest output of lz_compress() for len bytes                             */
+size_t lz_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+/*----< put_length() >-------------------------------------------------------*/
+/* the bytes of 255 extending a length of 15 or more in a token              */
+static inline
+unsigned char* put_length(unsigned char *op, size_t len)
+{
+    for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (unsigned char) len;
+    return op;
+}
+
+/*----< put_sequence() >-----------------------------------------------------*/
+/* numLit literals then, if matchLen > 0, a match at offset back            */
+static inline
+unsigned char* put_sequence(unsigned char       *op,
+                            const unsigned char *lit,
+                            size_t               numLit,
+                            size_t               offset,
+                            size_t               matchLen)
+{
+    unsigned char *token = op++;
+    size_t         m     = (matchLen > 0) ? matchLen - LZ_MIN_MATCH : 0;
+
+    *token = (unsigned char) (((numLit < 15) ? numLit : 15) << 4 |
+                              ((m < 15) ? m : 15));
+    if (numLit >= 15) op = put_length(op, numLit);
+    memcpy(op, lit, numLit);
+    op += numLit;
+    if (matchLen > 0) {
+        *op++ = (unsigned char) (offset & 255);
+        *op++ = (unsigned char) (offset >> 8);
+        if (m >= 15) op = put_length(op, m);
+    }
+    return op;
+}
+
+/*----< lz_compress() >------------------------------------------------------*/
+/* compress in[len] into out[lz_bound(len)]; return the compressed length.   */
+/* A hash of the next 4 bytes finds the last position that started with the */
+/* same hash; the search steps faster through data that does not match      */
+size_t lz_compress(const unsigned char *in,
+                   size_t               len,
+                   unsigned char       *out)
+{
+    uint32_t       table[1 << LZ_HASH_LOG];   /* position + 1, 0: none */
+    size_t         i = 0, anchor = 0;
+    unsigned char *op = out;
+
+    memset(table, 0, sizeof(table));
+    while (i + LZ_MIN_MATCH <= len) {
+        uint32_t seq, h, ref;
+        memcpy(&seq, in + i, 4);
+        h   = (seq * 2654435761U) >> (32 - LZ_HASH_LOG);
+        ref = table[h];
+        table[h] = (uint32_t)(i + 1);
+        if (ref > 0 && i - (ref - 1) <= LZ_MAX_OFFSET &&
+            memcmp(in + ref - 1, in + i, LZ_MIN_MATCH) == 0) {
+            size_t r = ref - 1, n = LZ_MIN_MATCH;
+            while (i + n < len && in[r + n] == in[i + n]) n++;
+            op     = put_sequence(op, in + anchor, i - anchor, i - r, n);
+            i     += n;
+            anchor = i;
+        }
+        else
+            i += 1 + ((i - anchor) >> 6);
+    }
+    op = put_sequence(op, in + anchor, len - anchor, 0, 0);
+    return op - out;
+}
+
+/*----< lz_decompress() >----------------------------------------------------*/
+/* decompress in[len] into exactly out[outLen] bytes; return 0 if the input  */
+/* is corrupt (every length and offset is checked)                           */
+int lz_decompress(const unsigned char *in,
+                  size_t               len,
+                  unsigned char       *out,
+                  size_t               outLen)
+{
+    size_t ip = 0, op = 0;
+
+    while (ip < len) {
+        unsigned token = in[ip++];
+        size_t   n     = token >> 4;
+        size_t   offset;
+
+        if (n == 15) {
+            unsigned b;
+            do {
+                if (ip >= len) return 0;
+                b  = in[ip++];
+                n += b;
+            } while (b == 255);
+        }
+        if (n > len - ip || n > outLen - op) return 0;
+        memcpy(out + op, in + ip, n);
+        ip += n;
+        op += n;
+        if (ip == len) break;   /* the last sequence */
+
+        if (len - ip < 2) return 0;
+        offset = in[ip] | (size_t)in[ip + 1] << 8;
+        ip    += 2;
+        n      = token & 15;
+        if (n == 15) {
+            unsigned b;
+            do {
+                if (ip >= len) return 0;
+                b  = in[ip++];
+                n += b;
+            } while (b == 255);
+        }
+        n += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || n > outLen - op) return 0;
+        if (offset >= n)
+            memcpy(out + op, out + op - offset, n);
+        else {   /* overlapping: a repeated pattern */
+            size_t k;
+            for (k=0; k<n; k++) out[op + k] = out[op - offset + k];
+        }
+        op += n;
+    }
+    return op == outLen;
+}
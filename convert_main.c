@@ -0,0 +1,145 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         convert_main.c                                            */
+/*   Description:  Converts an ASCII or raw binary input file into a chunked */
+/*                 file (see chunk_io.c), one chunk in memory at a time,     */
+/*                 compressed or not, and lists the chunks and statistics of */
+/*                 a chunked file.                                           */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+int      _debug;
+#include "kmeans.h"
+
+/*---< usage() >------------------------------------------------------------*/
+static void usage(char *argv0) {
+    char *help =
+        "Usage: %s [switches] -i filename\n"
+        "       -i filename    : file to convert\n"
+        "       -b             : input file is in binary format (default no)\n"
+        "       -w outname     : output file (default filename.kmc)\n"
+        "       -c chunkObjs   : objects per chunk (default %d)\n"
+        "       -C             : store the chunks by coordinate (default no)\n"
+        "       -z             : compress the chunks (default no)\n"
+        "       -l             : list the chunks of a chunked file instead\n"
+        "       -d             : enable debug mode\n";
+    fprintf(stderr, help, argv0, CHUNK_OBJS);
+    exit(-1);
+}
+
+/*---< list_chunks() >------------------------------------------------------*/
+/* the header and, for each chunk, the min, max and mean of each coordinate */
+static int list_chunks(char *filename) {
+    int        c, j, n, numObjs, numCoords, numChunks, chunkObjs, layout;
+    long long  bytes;
+    float     *min, *max;
+    double    *sum;
+
+    if (!chunk_open(filename, &numObjs, &numCoords)) {
+        fprintf(stderr, "[convert] error: %s is not a chunked file\n", filename);
+        return 0;
+    }
+    chunk_stats(&numChunks, &chunkObjs, &layout, &bytes, &min, &max, &sum);
+    printf("%s: %d objects, %d coordinates, %d chunks of %d objects, %s\n",
+           filename, numObjs, numCoords, numChunks, chunkObjs,
+           (layout == CHUNK_COLUMNS) ? "by coordinate" : "by row");
+    printf("chunks: %lld bytes stored, %lld raw\n", bytes,
+           (long long)numObjs * numCoords * sizeof(float));
+    for (c=0; c<numChunks; c++) {
+        n = (numObjs - c * chunkObjs < chunkObjs) ? numObjs - c * chunkObjs
+                                                  : chunkObjs;
+        printf("chunk %d: objects %d to %d\n", c, c * chunkObjs,
+               c * chunkObjs + n - 1);
+        for (j=0; j<numCoords; j++)
+            printf("  %3d  min %f  max %f  mean %f\n", j,
+                   min[c * numCoords + j], max[c * numCoords + j],
+                   sum[c * numCoords + j] / n);
+    }
+    chunk_close();
+    return 1;
+}
+
+/*---< main() >-------------------------------------------------------------*/
+int main(int argc, char **argv) {
+           int     opt;
+    extern char   *optarg;
+           int     i, n, isBinaryFile, chunkObjs, layout, codec, list;
+           int     numObjs, numCoords;
+           char   *filename, *outname, defname[1024];
+           dataset *chunk;
+
+    _debug       = 0;
+    isBinaryFile = 0;
+    chunkObjs    = CHUNK_OBJS;
+    layout       = CHUNK_ROWS;
+    codec        = CHUNK_NONE;
+    list         = 0;
+    filename     = NULL;
+    outname      = NULL;
+
+    while ( (opt=getopt(argc,argv,"i:w:c:bCzldh"))!= EOF) {
+        switch (opt) {
+            case 'i': filename = optarg;
+                      break;
+            case 'w': outname = optarg;
+                      break;
+            case 'b': isBinaryFile = 1;
+                      break;
+			case 'c': chunkObjs = atoi(optarg);
+					  break;
+			case 'C': layout = CHUNK_COLUMNS;
+					  break;
+			case 'z': codec = CHUNK_LZ;
+					  break;
+			case 'l': list = 1;
+					  break;
+            case 'd': _debug = 1;
+                      break;
+            default: usage(argv[0]);
+                      break;
+        }
+    }
+    if (filename == NULL || chunkObjs < 1) usage(argv[0]);
+
+    if (list) return list_chunks(filename) ? 0 : 1;
+
+    if (outname == NULL) {
+        snprintf(defname, sizeof(defname), "%s.kmc", filename);
+        outname = defname;
+    }
+
+    /* a chunked input is read through chunk_open() too, the output has its
+       own state in chunk_io.c */
+    if (!file_read_head(isBinaryFile, filename, &numObjs, &numCoords))
+        return 1;
+    if (!chunk_create(outname, numObjs, numCoords, chunkObjs, layout,
+                      codec)) {
+        fprintf(stderr, "[convert] error: cannot create %s\n", outname);
+        return 1;
+    }
+    printf("[convert] %s: %d objects of %d coordinates to %s\n", filename,
+           numObjs, numCoords, outname);
+
+    chunk = dataset_alloc(chunkObjs, numCoords);
+    for (i=0; i<numObjs; i+=n) {
+        n = (numObjs - i < chunkObjs) ? numObjs - i : chunkObjs;
+        if (file_read_rows(isBinaryFile, chunk, 0, n) != n ||
+            !chunk_write(chunk->rows, n)) {
+            fprintf(stderr, "[convert] error: chunk %d of %s\n", i / chunkObjs,
+                    outname);
+            return 1;
+        }
+    }
+    dataset_free(chunk);
+    file_read_close(isBinaryFile);
+
+    if (!chunk_finish()) {
+        fprintf(stderr, "[convert] error: writing %s\n", outname);
+        return 1;
+    }
+    return 0;
+}
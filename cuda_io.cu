@@ -110,61 +110,84 @@ int file_read_head(int   isBinaryFile,  /* flag: 0 or 1 */
 	return 1;
 }
 
-/*---< file_read_head() >---------------------------------------------------------*/
-float** file_read_block(int   isBinaryFile,  /* flag: 0 or 1 */
-                  char *filename,      /* input file name */
-                  int  numObjs,       /* no. data objects (local) */
-                  int  numCoords)     /* no. coordinates */
+/*---< file_read_rows() >---------------------------------------------------------*/
+/* read the next numObjs objects of the open file into rows first, first+1, */
+/* ... of ds; return the no. objects read, less than numObjs at the end of  */
+/* the file                                                                  */
+int file_read_rows(int      isBinaryFile,  /* flag: 0 or 1 */
+                   dataset *ds,            /* out: rows [first][numCoords] on */
+                   int      first,         /* first row to fill */
+                   int      numObjs)       /* no. data objects to read */
 {
 	int     i, j;
+	int     numCoords = ds->numCoords;
 	ssize_t numBytesRead;
-	float **objects;
-    
-	int len = numObjs * numCoords;
-	
-	if (_debug)
-		printf("[file io] read a block of %ix%i objects\n", numObjs, numCoords);
-	if (isBinaryFile) {  /* input file is in raw binary format -------------*/
-		
-		objects    = (float**)malloc(numObjs * sizeof(float*));
-		assert(objects != NULL);
-		objects[0] = (float*) malloc(len * sizeof(float));
-        assert(objects[0] != NULL);
-        for (i=1; i<numObjs; i++)
-            objects[i] = objects[i-1] + numCoords;
 
-		numBytesRead = read(infile_b, objects[0], len*sizeof(float));
-		assert(numBytesRead == len*sizeof(float));
+	if (isBinaryFile) {  /* input file is in raw binary format -------------*/
+		size_t rowLen = (size_t)numCoords * sizeof(float);
+		size_t len    = (size_t)numObjs * rowLen;
+		size_t got    = 0;
+
+		/* the file rows are packed as in ds */
+		while (got < len) {
+			numBytesRead = read(infile_b, (char*)ds->rows[first] + got,
+			                    len - got);
+			if (numBytesRead <= 0) break;
+			got += numBytesRead;
+		}
+		return got / rowLen;
 
 	} else {  /* input file is in ASCII format -------------------------------*/
 
 		char *line = (char*) malloc(lineLen);
-		int llen;
-        objects    = (float**)malloc(numObjs * sizeof(float*));
-        assert(objects != NULL);
-        objects[0] = (float*) malloc(len * sizeof(float));
-        assert(objects[0] != NULL);
-        for (i=1; i<numObjs; i++)
-            objects[i] = objects[i-1] + numCoords;
+		assert(line != NULL);
 
         i = 0;
-        /* read all objects */
-        while (fgets(line, lineLen, infile_t) != NULL && i < numObjs) {
-			if (i == 0)
-				llen = strlen(line);
+        /* read the objects, skipping empty lines */
+        while (i < numObjs && fgets(line, lineLen, infile_t) != NULL) {
             if (strtok(line, " \t\n") == NULL)
 				continue;
             for (j=0; j<numCoords; j++)
-                objects[i][j] = atof(strtok(NULL, " ,\t\n"));
+                ds->rows[first + i][j] = atof(strtok(NULL, " ,\t\n"));
             i++;
         }
-		fseek(infile_t, -llen, SEEK_CUR);
         free(line);
+		return i;
     }
-    //if(_debug)
-		//printf("[file io] first data values: %.4f %.4f %.4f %.4f\n", objects[0][0], objects[0][1], objects[1][0], objects[1][1]);
+}
+
+/*---< file_read_seek() >---------------------------------------------------------*/
+/* move the open file to object index; ASCII files can only go back to the   */
+/* first object (index 0). Return 1 on success                               */
+int file_read_seek(int isBinaryFile,  /* flag: 0 or 1 */
+                   int index,         /* object to read next */
+                   int numCoords)     /* no. coordinates */
+{
+	if (isBinaryFile) {
+		off_t pos = 2 * sizeof(int) + (off_t)index * numCoords * sizeof(float);
+		return lseek(infile_b, pos, SEEK_SET) == pos;
+	}
+	if (index != 0) return 0;
+	rewind(infile_t);
+	return 1;
+}
+
+/*---< file_read_block() >--------------------------------------------------------*/
+dataset* file_read_block(int   isBinaryFile,  /* flag: 0 or 1 */
+                  char *filename,      /* input file name */
+                  int  numObjs,       /* no. data objects (local) */
+                  int  numCoords)     /* no. coordinates */
+{
+	dataset *ds;
+	int      numRead;
 	
-    return objects;
+	if (_debug)
+		printf("[file io] read a block of %ix%i objects\n", numObjs, numCoords);
+	ds      = dataset_alloc(numObjs, numCoords);
+	numRead = file_read_rows(isBinaryFile, ds, 0, numObjs);
+	assert(!isBinaryFile || numRead == numObjs);
+	
+    return ds;
 }
 
        
@@ -179,7 +202,9 @@ int file_read_close(int isBinaryFile)
 }
 
 /*---< file_write() >---------------------------------------------------------*/
-int file_write(char      *filename,     /* input file name */
+/* the binary format is the one of file_write() in file_io.c                */
+int file_write(int        isOutFileBinary, /* flag: 0 or 1 */
+               char      *filename,     /* input file name */
                int        numClusters,  /* no. clusters */
                int        numObjs,      /* no. data objects */
                int        numCoords,    /* no. coordinates (local) */
@@ -194,22 +219,34 @@ int file_write(char      *filename,     /* input file name */
     sprintf(outFileName, "%s.cluster_centres", filename);
     printf("\n[file io] writing coordinates of K=%d cluster centers to file \"%s\"\n",
            numClusters, outFileName);
-    fptr = fopen(outFileName, "w");
-    for (i=0; i<numClusters; i++) {
-        fprintf(fptr, "%d ", i);
-        for (j=0; j<numCoords; j++)
-            fprintf(fptr, "%f ", clusters[i][j]);
-        fprintf(fptr, "\n");
+    fptr = fopen(outFileName, isOutFileBinary ? "wb" : "w");
+    if (isOutFileBinary) {
+        fwrite(&numClusters, sizeof(int), 1, fptr);
+        fwrite(&numCoords,   sizeof(int), 1, fptr);
+        for (i=0; i<numClusters; i++)
+            fwrite(clusters[i], sizeof(float), numCoords, fptr);
     }
+    else
+        for (i=0; i<numClusters; i++) {
+            fprintf(fptr, "%d ", i);
+            for (j=0; j<numCoords; j++)
+                fprintf(fptr, "%f ", clusters[i][j]);
+            fprintf(fptr, "\n");
+        }
     fclose(fptr);
 
     /* output: the closest cluster centre to each of the data points --------*/
     sprintf(outFileName, "%s.membership", filename);
     printf("[file io] writing membership of N=%d data objects to file \"%s\"\n",
            numObjs, outFileName);
-    fptr = fopen(outFileName, "w");
-    for (i=0; i<numObjs; i++)
-        fprintf(fptr, "%d %d\n", i, membership[i]);
+    fptr = fopen(outFileName, isOutFileBinary ? "wb" : "w");
+    if (isOutFileBinary) {
+        fwrite(&numObjs, sizeof(int), 1, fptr);
+        fwrite(membership, sizeof(int), numObjs, fptr);
+    }
+    else
+        for (i=0; i<numObjs; i++)
+            fprintf(fptr, "%d %d\n", i, membership[i]);
     fclose(fptr);
 
     return 1;
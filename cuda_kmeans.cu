@@ -370,32 +370,6 @@ float euclid_dist_2_seq(int    numdims,  /* no. dimensions */
     return(ans);
 }
 
-__inline static
-int find_nearest_cluster_seq(int     numClusters, /* no. clusters */
-                         int     numCoords,   /* no. coordinates */
-						 float  *distance,    /* to save distance for stats */
-                         float  *object,      /* [numCoords] */
-                         float **clusters)    /* [numClusters][numCoords] */
-{
-    int   index, i;
-    float dist, min_dist;
-
-    /* find the cluster id that has min distance to object */
-    index    = 0;
-    min_dist = euclid_dist_2_seq(numCoords, object, clusters[0]);
-
-    for (i=1; i<numClusters; i++) {
-        dist = euclid_dist_2_seq(numCoords, object, clusters[i]);
-        /* no need square root */
-        if (dist < min_dist) { /* find the min and its array index */
-            min_dist = dist;
-            index    = i;
-        }
-    }
-    *distance = min_dist;
-    return(index);
-}
-
 void cuda_kpp_init(float** objects, 
 			  float** clustersInit, 
 			  int* membership, 
@@ -404,27 +378,34 @@ void cuda_kpp_init(float** objects,
 			  int numClusters)
 {
 	int i, j, k;
-	float sum;
+	double sum;
 	float *d = (float*)malloc(sizeof(float) * numObjs);
+	assert(d != NULL);
  
 	if (_debug) printf("[cuda kmean] Kpp initialization method\n");
-	for (i=0; i<numClusters; i++)
-        for (j=0; j<numCoords; j++)
-            clustersInit[i][j] = objects[rand()%numObjs][j];
+
+	/* first center at random; d[] keeps the distance of each object to the
+	   nearest center chosen so far and is only compared with the newest
+	   one, O(numObjs x numClusters) in all */
+	j = rand() % numObjs;
+	for (k=0; k<numCoords; k++)
+		clustersInit[0][k] = objects[j][k];
+	for (j=0; j<numObjs; j++)
+		d[j] = euclid_dist_2_seq(numCoords, objects[j], clustersInit[0]);
 
 	for (i=1; i<numClusters; i++) {
 		sum = 0;
-		for (j= 0; j<numObjs; j++) {
-			find_nearest_cluster_seq(numClusters, numCoords, d+j,
-				objects[j], clustersInit);
+		for (j=0; j<numObjs; j++)
 			sum += d[j];
-		}
 		sum = randf(sum);
+		for (j=0; j<numObjs-1; j++)
+			if ((sum -= d[j]) <= 0) break;
+		for (k=0; k<numCoords; k++)
+			clustersInit[i][k] = objects[j][k];
 		for (j=0; j<numObjs; j++) {
-			if ((sum -= d[j]) > 0) continue;
-			for (k=0; k<numCoords; k++)
-				clustersInit[i][k] = objects[j][k];
-			break;
+			float dist = euclid_dist_2_seq(numCoords, objects[j],
+										   clustersInit[i]);
+			if (dist < d[j]) d[j] = dist;
 		}
 		if (_debug) printf("Fill cluster %i\n", i+1);
 	}
@@ -84,7 +84,8 @@ int main(int argc, char **argv) {
            int     numClusters, numCoords, numObjs;
            int    *membership;    /* [numObjs] */
            char   *filename;
-           float **objects; 
+           dataset *data;         /* current block of objects */
+           float **objects;       /* data->rows */
            float **clusters;      /* [numClusters][numCoords] cluster center */
            float   threshold;
            double  timing, io_timing, clustering_timing;
@@ -155,8 +156,6 @@ int main(int argc, char **argv) {
 	
 	/* initialize some other algorithm variables */
 	int numObjsIteration = numObjs / splitNumber;
-	malloc2D(objects, numObjsIteration, numCoords, float);
-    assert(objects != NULL);
 	malloc2D(clustersInit, numClusters, numCoords, float);
     assert(clustersInit != NULL);
 	membershipIteration = (int*) malloc(numObjsIteration * sizeof(int));
@@ -170,7 +169,8 @@ int main(int argc, char **argv) {
     }
 		
 	/* initialize the cluster vector with k++ */
-	objects = file_read_block(isBinaryFile, filename, numObjsIteration, numCoords);
+	data    = file_read_block(isBinaryFile, filename, numObjsIteration, numCoords);
+	objects = data->rows;
 	if (iskppInit) {
 		cuda_kpp_init(objects, clustersInit, membership, numObjsIteration, numCoords, numClusters);
 	} else {
@@ -186,10 +186,11 @@ int main(int argc, char **argv) {
 				iteration + 1, numObjsIteration);
 		
 		// read data to clusterize
-		if (iteration != 0)
-			objects = file_read_block(isBinaryFile, filename, numObjsIteration, numCoords);
-		if (objects == NULL)
-			exit(1);
+		if (iteration != 0) {
+			dataset_free(data);
+			data    = file_read_block(isBinaryFile, filename, numObjsIteration, numCoords);
+			objects = data->rows;
+		}
 		
 		// do clusterisation
 		clusters = cuda_kmeans(objects, numCoords, numObjsIteration, numClusters,
@@ -204,7 +205,7 @@ int main(int argc, char **argv) {
 		if (save) {
 			char  tmpFilename[512];
 			sprintf(tmpFilename, "%s.tmp-%i", filename, iteration+1);
-			file_write(tmpFilename, numClusters, numObjs, numCoords, clusters,
+			file_write(0, tmpFilename, numClusters, numObjs, numCoords, clusters,
 				membership);
 		}
 		
@@ -215,10 +216,11 @@ int main(int argc, char **argv) {
 	lastObjsIteration = numObjs - numObjsIteration * iteration;
 	printf ("\n[cuda kmean] data block %i - number of objects %i\n", 
 				iteration + 1, lastObjsIteration);
-	if (iteration != 0)
-		objects = file_read_block(isBinaryFile, filename, lastObjsIteration, numCoords);
-	if (objects == NULL)
-		exit(1);
+	if (iteration != 0) {
+		dataset_free(data);
+		data    = file_read_block(isBinaryFile, filename, lastObjsIteration, numCoords);
+		objects = data->rows;
+	}
 
 	clusters = cuda_kmeans(objects, numCoords, lastObjsIteration, numClusters,
 			clustersInit, threshold, membershipIteration, &loop_iterations);
@@ -234,12 +236,12 @@ int main(int argc, char **argv) {
 
 	/* free memory part 1 --------------------------------------------------*/
 	file_read_close(isBinaryFile);
-	free(objects);
+	dataset_free(data);
 	free(clustersInit);
 	free(membershipIteration);
 
     /* output: the coordinates of the cluster centres ----------------------*/
-    file_write(filename, numClusters, numObjs, numCoords, clusters,
+    file_write(0, filename, numClusters, numObjs, numCoords, clusters,
                membership);
 
 	/*- wait for key to continue -------------------------------------------*/
@@ -269,26 +271,21 @@ int main(int argc, char **argv) {
 	/* display results if needed --------------------------------------------*/
 	if (graph) {
 		file_read_head(isBinaryFile, filename, &numObjs, &numCoords);
-		objects = file_read_block(isBinaryFile, filename, numObjs, numCoords);
+		data = file_read_block(isBinaryFile, filename, numObjs, numCoords);
 		file_read_close(isBinaryFile);
-		float* xObj = (float*)malloc(numObjs * sizeof(float));
-		float* yObj = (float*)malloc(numObjs * sizeof(float));
+		/* the first two coordinates, contiguous in the coordinate-major view */
+		float* xObj = dataset_soa(data);
+		float* yObj = xObj + numObjs;
 		float* xClu = (float*)malloc(numClusters * sizeof(float));
 		float* yClu = (float*)malloc(numClusters * sizeof(float));
 		for (i=0; i<numClusters; i++) {
 			xClu[i] = clusters[i][0];
 			yClu[i] = clusters[i][1];
 		}
-		for(i=0; i<numObjs; i++) {
-			xObj[i] = objects[i][0];
-			yObj[i] = objects[i][1];
-		}
 		pdf_kmean(xObj, yObj, numObjs, xClu, yClu, numClusters, membership);
-		free(xObj);
-		free(yObj);
 		free(xClu);
 		free(yClu);
-		free(objects);
+		dataset_free(data);
 	}
 	
 	/* free memory part 2 */
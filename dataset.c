@@ -0,0 +1,177 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         dataset.c                                                 */
+/*   Description:  Storage of a block of data objects. All coordinates live  */
+/*                 in one DATA_ALIGN-byte aligned buffer of packed rows, the */
+/*                 layout of the binary files, so that a block is read in    */
+/*                 place. rows[] keeps the [numObjs][numCoords]              */
+/*                 float** interface of the engines, the library call and    */
+/*                 the CUDA version; soa is a coordinate-major copy made on  */
+/*                 demand. dataset_map() maps the packed rows of a binary    */
+/*                 file in place of the buffer.                              */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _DEFAULT_SOURCE   /* posix_memalign(), MAP_ANONYMOUS, madvise() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>     /* uintptr_t */
+#include <unistd.h>     /* sysconf() */
+#include <sys/mman.h>   /* mmap() */
+
+#include "kmeans.h"
+
+#define HUGE_PAGE  (2UL << 20)   /* bytes, x86-64 huge page */
+
+
+/*----< dataset_create() >---------------------------------------------------*/
+/* as dataset_alloc() but neither data nor rows[] are initialized, so that   */
+/* the caller chooses which thread touches each page first. The caller sets  */
+/* rows[i] to data + i * numCoords                                           */
+dataset* dataset_create(int numObjs,
+                        int numCoords)
+{
+    size_t   len;
+    void    *data;
+    dataset *ds;
+
+    ds = (dataset*) malloc(sizeof(dataset));
+    assert(ds != NULL);
+    ds->numObjs   = numObjs;
+    ds->numCoords = numCoords;
+    ds->soa       = NULL;
+    ds->map       = NULL;
+    ds->mapLen    = 0;
+
+    /* at least one row, so that rows[0] is valid for an empty block */
+    len = (size_t)(numObjs > 0 ? numObjs : 1) * numCoords * sizeof(float);
+    if (posix_memalign(&data, DATA_ALIGN, len) != 0)
+        data = NULL;
+    assert(data != NULL);
+    ds->data = (float*) data;
+
+    ds->rows = (float**) malloc((numObjs > 0 ? numObjs : 1) * sizeof(float*));
+    assert(ds->rows != NULL);
+
+    return ds;
+}
+
+/*----< dataset_alloc() >----------------------------------------------------*/
+/* the rows are zero-filled                                                  */
+dataset* dataset_alloc(int numObjs,
+                       int numCoords)
+{
+    int      i;
+    dataset *ds = dataset_create(numObjs, numCoords);
+
+    memset(ds->data, 0, (size_t)(numObjs > 0 ? numObjs : 1) * numCoords *
+                        sizeof(float));
+    ds->rows[0] = ds->data;
+    for (i=1; i<numObjs; i++)
+        ds->rows[i] = ds->rows[i-1] + numCoords;
+
+    return ds;
+}
+
+/*----< dataset_map() >------------------------------------------------------*/
+/* map numObjs packed rows found at byte offset of the open file fd instead  */
+/* of reading them: read-only and private, so nothing is copied and runs on  */
+/* the same file share its page cache. The address is congruent to the file  */
+/* offset modulo HUGE_PAGE, so that the kernel can use huge pages where the  */
+/* file system supports it. The rows are swept in order by every loop of the */
+/* engines, and read ahead at once when they fit in the free memory. Return  */
+/* NULL if the file cannot be mapped                                         */
+dataset* dataset_map(int       fd,          /* open binary file */
+                     long long offset,      /* bytes to the first row */
+                     int       numObjs,
+                     int       numCoords)
+{
+    int      i;
+    size_t   pageSize = sysconf(_SC_PAGESIZE);
+    off_t    start    = offset / pageSize * pageSize;
+    size_t   len      = (size_t)(offset - start) +
+                        (size_t)numObjs * numCoords * sizeof(float);
+    size_t   mapLen   = (len + pageSize - 1) / pageSize * pageSize;
+    size_t   skip;
+    char    *area, *addr;
+    dataset *ds;
+
+    if (numObjs <= 0) return NULL;
+
+    /* reserve room for an aligned address, map the file there and give
+       back the rest of the room */
+    area = (char*) mmap(NULL, mapLen + HUGE_PAGE, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) return NULL;
+    skip = ((uintptr_t)start - (uintptr_t)area) & (HUGE_PAGE - 1);
+    addr = (char*) mmap(area + skip, mapLen, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                        fd, start);
+    if (addr == MAP_FAILED) {
+        munmap(area, mapLen + HUGE_PAGE);
+        return NULL;
+    }
+    if (skip > 0) munmap(area, skip);
+    munmap(addr + mapLen, HUGE_PAGE - skip);
+
+#ifdef MADV_HUGEPAGE
+    madvise(addr, mapLen, MADV_HUGEPAGE);
+#endif
+    madvise(addr, mapLen, MADV_SEQUENTIAL);
+    if (mapLen / pageSize < (size_t)sysconf(_SC_AVPHYS_PAGES))
+        madvise(addr, mapLen, MADV_WILLNEED);
+
+    ds = (dataset*) malloc(sizeof(dataset));
+    assert(ds != NULL);
+    ds->numObjs   = numObjs;
+    ds->numCoords = numCoords;
+    ds->data      = (float*) (addr + (offset - start));
+    ds->soa       = NULL;
+    ds->map       = addr;
+    ds->mapLen    = mapLen;
+
+    ds->rows = (float**) malloc(numObjs * sizeof(float*));
+    assert(ds->rows != NULL);
+    for (i=0; i<numObjs; i++)
+        ds->rows[i] = ds->data + (size_t)i * numCoords;
+
+    return ds;
+}
+
+/*----< dataset_soa() >------------------------------------------------------*/
+/* coordinate-major copy [numCoords][numObjs], built on the first call and   */
+/* kept until dataset_free(); it is not updated if the rows change           */
+float* dataset_soa(dataset *ds)
+{
+    int    i, j;
+    size_t len;
+    void  *soa;
+
+    if (ds->soa != NULL) return ds->soa;
+
+    len = (size_t)ds->numCoords * (ds->numObjs > 0 ? ds->numObjs : 1) *
+          sizeof(float);
+    if (posix_memalign(&soa, DATA_ALIGN, len) != 0)
+        soa = NULL;
+    assert(soa != NULL);
+    ds->soa = (float*) soa;
+
+    for (i=0; i<ds->numObjs; i++)
+        for (j=0; j<ds->numCoords; j++)
+            ds->soa[(size_t)j * ds->numObjs + i] = ds->rows[i][j];
+
+    return ds->soa;
+}
+
+/*----< dataset_free() >-----------------------------------------------------*/
+void dataset_free(dataset *ds)
+{
+    if (ds == NULL) return;
+    if (ds->map != NULL)
+        munmap(ds->map, ds->mapLen);
+    else
+        free(ds->data);
+    free(ds->rows);
+    free(ds->soa);
+    free(ds);
+}
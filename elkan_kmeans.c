@@ -0,0 +1,194 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         elkan_kmeans.c                                            */
+/*   Description:  Lloyd's iteration accelerated with the triangle           */
+/*                 inequality (C. Elkan, "Using the Triangle Inequality to   */
+/*                 Accelerate k-Means", ICML 2003). Every object keeps an    */
+/*                 upper bound on the distance to its own center and one     */
+/*                 lower bound per center; a distance is only computed when  */
+/*                 the bounds cannot rule the center out. The clustering is  */
+/*                 the same as the one of plain Lloyd's iteration, up to     */
+/*                 objects exactly equidistant to two centers.               */
+/*                                                                           */
+/*                 Memory: numObjs * numClusters floats for the lower        */
+/*                 bounds, see hamerly_kmeans() for a lighter alternative.   */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+
+/*----< elkan_kmeans() >-----------------------------------------------------*/
+/* return an array of cluster centers of size [numClusters][numCoords]       */
+float** elkan_kmeans(int     nthreads,     /* no. threads, 1 for sequential */
+                     int     maxIter,      /* max no. loops */
+                     float **objects,      /* in: [numObjs][numCoords] */
+                     int     numCoords,    /* no. features */
+                     int     numObjs,      /* no. objects */
+                     int     numClusters,  /* no. clusters */
+                     float **clustersInit, /* init value for cluster */
+                     float   threshold,    /* % objects change membership */
+                     int    *membership,   /* in/out: [numObjs] */
+                     int    *loop_iterations)
+{
+    int      i, j, loop=0;
+    float    delta;          /* % of objects change their clusters */
+    double   numDist;        /* no. distances computed, for debug */
+    float  **clusters;       /* out: [numClusters][numCoords] */
+    int     *assign;         /* [numObjs] current center of each object */
+    float   *upper;          /* [numObjs] upper bound to own center */
+    float   *lower;          /* [numObjs][numClusters] lower bounds */
+    float   *halfDist;       /* [numClusters][numClusters] half center distances */
+    float   *halfMin;        /* [numClusters] half distance to closest center */
+    float   *shift;          /* [numClusters] distance moved by each center */
+    int     *size;           /* [numClusters] running no. members */
+    double  *sum;            /* [numClusters][numCoords] running member sums */
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    for (i=0; i<numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            clusters[i][j] = clustersInit[i][j];
+
+    assign   = (int*)   malloc(numObjs * sizeof(int));
+    assert(assign != NULL);
+    upper    = (float*) malloc(numObjs * sizeof(float));
+    assert(upper != NULL);
+    lower    = (float*) malloc((size_t)numObjs * numClusters * sizeof(float));
+    assert(lower != NULL);
+    halfDist = (float*) malloc((size_t)numClusters * numClusters * sizeof(float));
+    assert(halfDist != NULL);
+    halfMin  = (float*) malloc(numClusters * sizeof(float));
+    assert(halfMin != NULL);
+    shift    = (float*) malloc(numClusters * sizeof(float));
+    assert(shift != NULL);
+    size     = (int*)    calloc(numClusters, sizeof(int));
+    assert(size != NULL);
+    sum      = (double*) calloc((size_t)numClusters * numCoords, sizeof(double));
+    assert(sum != NULL);
+
+    kernels_init();
+
+    /* first loop: all distances, exactly as Lloyd */
+    numDist = (double)numObjs * numClusters;
+    #pragma omp parallel for num_threads(nthreads) private(i,j) schedule(static)
+    for (i=0; i<numObjs; i++) {
+        float *l = lower + (size_t)i * numClusters;
+        int    index = 0;
+        for (j=0; j<numClusters; j++) {
+            l[j] = sqrtf(euclid_dist_2(numCoords, objects[i], clusters[j]));
+            if (l[j] < l[index]) index = j;
+        }
+        assign[i] = index;
+        upper[i]  = l[index];
+    }
+
+    do {
+        delta = 0.0;
+
+        if (loop > 0) {
+            double loopDist = 0.0;
+
+            /* half distances between centers, and to the closest other one */
+            #pragma omp parallel num_threads(nthreads) private(i,j)
+            {
+                #pragma omp for schedule(dynamic, 16) reduction(+:loopDist)
+                for (i=0; i<numClusters; i++) {
+                    halfDist[(size_t)i * numClusters + i] = 0.0f;
+                    for (j=i+1; j<numClusters; j++) {
+                        float h = 0.5f * sqrtf(euclid_dist_2(numCoords,
+                                                   clusters[i], clusters[j]));
+                        halfDist[(size_t)i * numClusters + j] = h;
+                        halfDist[(size_t)j * numClusters + i] = h;
+                    }
+                    loopDist += numClusters - 1 - i;
+                }
+                #pragma omp for schedule(static)
+                for (i=0; i<numClusters; i++) {
+                    float min = INFINITY;
+                    for (j=0; j<numClusters; j++)
+                        if (j != i && halfDist[(size_t)i * numClusters + j] < min)
+                            min = halfDist[(size_t)i * numClusters + j];
+                    halfMin[i] = min;
+                }
+            }
+
+            /* assignment filtered by the bounds */
+            #pragma omp parallel for num_threads(nthreads) private(i,j) \
+                    schedule(dynamic, 256) reduction(+:loopDist)
+            for (i=0; i<numObjs; i++) {
+                float *l     = lower + (size_t)i * numClusters;
+                float  u     = upper[i];
+                int    a     = assign[i];
+                int    tight = 0;   /* u is the exact distance to a */
+
+                if (u <= halfMin[a]) continue;
+
+                for (j=0; j<numClusters; j++) {
+                    float *h = halfDist + (size_t)a * numClusters;
+                    float  d;
+                    if (j == a || u <= l[j] || u <= h[j]) continue;
+
+                    if (!tight) {
+                        u = sqrtf(euclid_dist_2(numCoords, objects[i],
+                                                clusters[a]));
+                        l[a]  = u;
+                        tight = 1;
+                        loopDist += 1.0;
+                        if (u <= l[j] || u <= h[j]) continue;
+                    }
+                    d = sqrtf(euclid_dist_2(numCoords, objects[i], clusters[j]));
+                    l[j] = d;
+                    loopDist += 1.0;
+                    if (d < u || (d == u && j < a)) {
+                        a = j;
+                        u = d;
+                    }
+                }
+                assign[i] = a;
+                upper[i]  = u;
+            }
+            numDist += loopDist;
+        }
+
+        /* move the objects that changed cluster (delta) from one running
+           sum to the other: new centers and how far they moved */
+        delta = update_centers(nthreads, objects, numCoords, numObjs,
+                               numClusters, assign, membership, size, sum,
+                               clusters, shift);
+
+        /* relax the bounds by the center movements */
+        #pragma omp parallel for num_threads(nthreads) private(i,j) schedule(static)
+        for (i=0; i<numObjs; i++) {
+            float *l = lower + (size_t)i * numClusters;
+            for (j=0; j<numClusters; j++) {
+                l[j] -= shift[j];
+                if (l[j] < 0.0f) l[j] = 0.0f;
+            }
+            upper[i] += shift[assign[i]];
+        }
+
+        delta /= numObjs;
+        if (_debug)
+            printf("delta = %.3f distances = %.0f (%.1f%% of lloyd)\n", delta,
+                   numDist, 100.0 * numDist /
+                   ((double)(loop + 1) * numObjs * numClusters));
+
+    } while (delta > threshold && loop++ < maxIter);
+
+    *loop_iterations = loop + 1;
+
+    free(assign);
+    free(upper);
+    free(lower);
+    free(halfDist);
+    free(halfMin);
+    free(shift);
+    free(size);
+    free(sum);
+
+    return clusters;
+}
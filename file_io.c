@@ -7,6 +7,14 @@
 /*                 binary file: first 4-byte integer is the number of data   */
 /*                 objects and 2nd integer is the no. of features (or        */
 /*                 coordinates) of each object                               */
+/*                 chunked file: see chunk_io.c, read with the binary flag   */
+/*                 A file named "-" is the standard input. Binary pipes and  */
+/*                 FIFOs are streamed: read once, in order, forward seeks    */
+/*                 skip objects and backward ones fail; ASCII ones are read  */
+/*                 whole before they are indexed.                            */
+/*                 ASCII files are mapped whole and indexed once by          */
+/*                 file_read_head(); the threads then parse disjoint runs of */
+/*                 lines straight into the dataset rows.                     */
 /*                                                                           */
 /*   Author:  Wei-keng Liao                                                  */
 /*            ECE Department Northwestern University                         */
@@ -17,20 +25,318 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>     /* strtok() */
+#include <string.h>     /* memchr() */
+#include <stdint.h>     /* uint64_t */
 #include <sys/types.h>  /* open() */
 #include <sys/stat.h>
+#include <sys/mman.h>   /* mmap() */
 #include <fcntl.h>
 #include <unistd.h>     /* read(), close() */
 
+#include <omp.h>
 #include "kmeans.h"
 
-#define MAX_CHAR_PER_LINE 128
+#define ASCII_MARK   1024   /* objects from one mark of the index to the next */
+#define WRITE_CHUNK  65536  /* objects formatted at once by a thread */
+#define WRITE_LINE   24     /* longest membership line, "%d %d\n" */
+
+/* separators of the coordinates of an ASCII line */
+#define IS_SEP(c)    ((c) == ' ' || (c) == '\t' || (c) == ',' || (c) == '\r')
 
 int infile_b;
-FILE *infile_t;
-int   lineLen;
+static int       chunked    = 0;   /* the binary file is a chunked one */
+static int       streamed   = 0;   /* the binary file is a pipe or FIFO */
+static long long streamNext = 0;   /* object of a stream read next */
+
+/* the open ASCII file and its index: the offset of every ASCII_MARK-th
+   object of each thread's chunk */
+static char   *text       = NULL;
+static size_t  textLen    = 0;
+static int     textMapped = 0;     /* text is a mapping, not a buffer */
+static int     textObjs   = 0;     /* no. objects (non-blank lines) */
+static int     textNext   = 0;     /* next object to read */
+static int     numMarks   = 0;
+static int    *markObj    = NULL;  /* [numMarks] object of each mark */
+static size_t *markOff    = NULL;  /* [numMarks] offset of its line */
+
+/* powers of ten exactly representable as doubles */
+static const double pow10tab[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/*---< line_end() >---------------------------------------------------------------*/
+/* end of the line starting at p: its '\n' or the end of the text. memchr()  */
+/* is vectorized by the C library                                            */
+static inline
+const char* line_end(const char *p)
+{
+	const char *q = (const char*) memchr(p, '\n', text + textLen - p);
+	return (q != NULL) ? q : text + textLen;
+}
+
+/*---< blank_line() >-------------------------------------------------------------*/
+static inline
+int blank_line(const char *p, const char *eol)
+{
+	while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p == eol;
+}
+
+/*---< parse_float() >------------------------------------------------------------*/
+/* the number at p, as atof() reads it. Decimal mantissas below 2^53 with a  */
+/* power of ten up to 22 are converted exactly in double precision          */
+/* (Clinger's fast path), which gives the correctly rounded result of       */
+/* strtod(); anything else (more digits, inf, hex, ...) goes to strtod().   */
+/* *next is set after the number                                            */
+static
+float parse_float(const char *p, const char *eol, const char **next)
+{
+	const char *s = p;
+	uint64_t    mant = 0;
+	int         digits = 0, exp10 = 0, neg = 0, any = 0;
+	double      v;
+
+	if (p < eol && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+	for (; p < eol && *p >= '0' && *p <= '9'; p++) {
+		any = 1;
+		if (mant == 0 && *p == '0') continue;
+		if (++digits <= 19) mant = mant * 10 + (*p - '0');
+		else exp10++;
+	}
+	if (p < eol && *p == '.')
+		for (p++; p < eol && *p >= '0' && *p <= '9'; p++) {
+			any = 1;
+			if (mant == 0 && *p == '0') { exp10--; continue; }
+			if (++digits <= 19) { mant = mant * 10 + (*p - '0'); exp10--; }
+		}
+	if (any && p < eol && (*p == 'e' || *p == 'E')) {
+		const char *e = p + 1;
+		int         eneg = 0, ev = 0;
+		if (e < eol && (*e == '-' || *e == '+')) eneg = (*e++ == '-');
+		if (e < eol && *e >= '0' && *e <= '9') {
+			for (; e < eol && *e >= '0' && *e <= '9'; e++)
+				if (ev < 100000) ev = ev * 10 + (*e - '0');
+			exp10 += eneg ? -ev : ev;
+			p = e;
+		}
+	}
+
+	if (any && digits <= 19 && mant <= (1ULL << 53) && exp10 >= -22 &&
+	    exp10 <= 22 && (p == eol || IS_SEP(*p))) {
+		v = (double) mant;
+		v = (exp10 < 0) ? v / pow10tab[-exp10] : v * pow10tab[exp10];
+		*next = p;
+		return (float) (neg ? -v : v);
+	}
+
+	/* slow path on a NUL-terminated copy of the token */
+	{
+		char   buf[64];
+		size_t n;
+		for (p=s; p < eol && !IS_SEP(*p); p++) ;
+		n = p - s;
+		if (n > sizeof(buf) - 1) n = sizeof(buf) - 1;
+		memcpy(buf, s, n);
+		buf[n] = '\0';
+		*next = p;
+		return (float) strtod(buf, NULL);
+	}
+}
+
+/*---< parse_line() >-------------------------------------------------------------*/
+/* coordinates of the object on the line [p, eol): the first token is the   */
+/* object id and is skipped; missing coordinates are 0                       */
+static
+void parse_line(const char *p, const char *eol, int numCoords, float *row)
+{
+	int j;
+
+	while (p < eol && IS_SEP(*p)) p++;
+	while (p < eol && !IS_SEP(*p)) p++;
+	for (j=0; j<numCoords; j++) {
+		while (p < eol && IS_SEP(*p)) p++;
+		row[j] = (p < eol) ? parse_float(p, eol, &p) : 0.0f;
+	}
+}
+
+/*---< text_open() >--------------------------------------------------------------*/
+/* map the ASCII file, or read it whole if it cannot be mapped (empty file,  */
+/* pipe, "-" for the standard input)                                         */
+static
+int text_open(char *filename)
+{
+	int         fd;
+	struct stat st;
+	ssize_t     n;
+	size_t      cap;
+
+	fd = (strcmp(filename, "-") == 0) ? STDIN_FILENO
+	                                  : open(filename, O_RDONLY);
+	if (fd == -1) return 0;
+	textLen    = 0;
+	textMapped = 0;
+	text       = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		text = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (text != MAP_FAILED) {
+			textLen    = st.st_size;
+			textMapped = 1;
+		}
+		else
+			text = NULL;
+	}
+	if (!textMapped) {
+		cap  = 1 << 20;
+		text = (char*) malloc(cap);
+		assert(text != NULL);
+		while ((n = read(fd, text + textLen, cap - textLen)) > 0) {
+			textLen += n;
+			if (textLen == cap) {
+				cap *= 2;
+				text = (char*) realloc(text, cap);
+				assert(text != NULL);
+			}
+		}
+	}
+	if (fd != STDIN_FILENO) close(fd);
+	return 1;
+}
 
+/*---< text_index() >-------------------------------------------------------------*/
+/* one pass over the text: the threads split it at line boundaries, count    */
+/* the objects of their chunk and keep the offset of every ASCII_MARK-th one */
+static
+void text_index(void)
+{
+	int      t, m, nthreads = omp_get_max_threads();
+	size_t  *start;   /* [nthreads + 1] chunk boundaries, at line starts */
+	int     *count;   /* [nthreads] objects per chunk */
+	int     *nmarks;  /* [nthreads] */
+	size_t **marks;   /* [nthreads][nmarks] offsets of the chunk marks */
+
+	start  = (size_t*)  malloc((nthreads + 1) * sizeof(size_t));
+	assert(start != NULL);
+	count  = (int*)     malloc(nthreads * sizeof(int));
+	assert(count != NULL);
+	nmarks = (int*)     calloc(nthreads, sizeof(int));
+	assert(nmarks != NULL);
+	marks  = (size_t**) malloc(nthreads * sizeof(size_t*));
+	assert(marks != NULL);
+
+	start[0]        = 0;
+	start[nthreads] = textLen;
+	for (t=1; t<nthreads; t++) {
+		size_t s = textLen / nthreads * t;
+		if (s < start[t-1]) s = start[t-1];
+		s = line_end(text + s) - text;
+		start[t] = (s < textLen) ? s + 1 : textLen;
+	}
+
+	#pragma omp parallel for num_threads(nthreads) private(t) schedule(static,1)
+	for (t=0; t<nthreads; t++) {
+		const char *p   = text + start[t];
+		const char *end = text + start[t+1];
+		int         n = 0, cap = 16;
+
+		marks[t] = (size_t*) malloc(cap * sizeof(size_t));
+		assert(marks[t] != NULL);
+		while (p < end) {
+			const char *eol = line_end(p);
+			if (!blank_line(p, eol)) {
+				if (n % ASCII_MARK == 0) {
+					if (nmarks[t] == cap) {
+						cap *= 2;
+						marks[t] = (size_t*) realloc(marks[t], cap * sizeof(size_t));
+						assert(marks[t] != NULL);
+					}
+					marks[t][nmarks[t]++] = p - text;
+				}
+				n++;
+			}
+			p = eol + 1;
+		}
+		count[t] = n;
+	}
+
+	/* object no. of the marks from the counts of the chunks before */
+	for (t=0, numMarks=0; t<nthreads; t++) numMarks += nmarks[t];
+	markObj = (int*)    malloc((numMarks + 1) * sizeof(int));
+	assert(markObj != NULL);
+	markOff = (size_t*) malloc((numMarks + 1) * sizeof(size_t));
+	assert(markOff != NULL);
+	for (t=0, textObjs=0, numMarks=0; t<nthreads; t++) {
+		for (m=0; m<nmarks[t]; m++, numMarks++) {
+			markObj[numMarks] = textObjs + m * ASCII_MARK;
+			markOff[numMarks] = marks[t][m];
+		}
+		textObjs += count[t];
+		free(marks[t]);
+	}
+	textNext = 0;
+
+	free(start);
+	free(count);
+	free(nmarks);
+	free(marks);
+}
+
+/*---< text_find() >--------------------------------------------------------------*/
+/* start of the line of object index (< textObjs): the lines from the last   */
+/* mark at or before it are skipped                                          */
+static
+const char* text_find(int index)
+{
+	int         lo = 0, hi = numMarks - 1, n;
+	const char *p, *eol;
+
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (markObj[mid] <= index) lo = mid;
+		else                       hi = mid - 1;
+	}
+	p = text + markOff[lo];
+	for (n=markObj[lo]; ; p=eol+1) {
+		eol = line_end(p);
+		if (blank_line(p, eol)) continue;
+		if (n++ == index) return p;
+	}
+}
+
+/*---< text_close() >-------------------------------------------------------------*/
+static
+void text_close(void)
+{
+	if (textMapped)
+		munmap(text, textLen);
+	else
+		free(text);
+	free(markObj);
+	free(markOff);
+	text     = NULL;
+	markObj  = NULL;
+	markOff  = NULL;
+	numMarks = 0;
+	textObjs = 0;
+}
+
+
+/*---< read_all() >--------------------------------------------------------------*/
+/* read len bytes of the binary file, fewer at its end; return the no. read */
+static
+size_t read_all(void *buf, size_t len)
+{
+	ssize_t numBytesRead;
+	size_t  got = 0;
+
+	while (got < len) {
+		numBytesRead = read(infile_b, (char*)buf + got, len - got);
+		if (numBytesRead <= 0) break;
+		got += numBytesRead;
+	}
+	return got;
+}
 
 /*---< file_read_head() >---------------------------------------------------------*/
 int file_read_head(int   isBinaryFile,  /* flag: 0 or 1 */
@@ -38,148 +344,308 @@ int file_read_head(int   isBinaryFile,  /* flag: 0 or 1 */
                   int  *numObjs,       /* no. data objects (local) */
                   int  *numCoords)     /* no. coordinates */
 {
-	int     len;
-	ssize_t numBytesRead;
+	struct stat st;
+	int         isStdin = (strcmp(filename, "-") == 0);
+
+	/* pipes and FIFOs cannot be probed for a chunked header and read again */
+	streamed   = isStdin || (stat(filename, &st) == 0 && !S_ISREG(st.st_mode));
+	streamNext = 0;
 
 	if (isBinaryFile) {  /* input file is in raw binary format -------------*/
-		if ((infile_b = open(filename, O_RDONLY, "0600")) == -1) {
+		if (!streamed) {
+			chunked = chunk_open(filename, numObjs, numCoords);
+			if (chunked) return 1;
+		}
+		infile_b = isStdin ? STDIN_FILENO : open(filename, O_RDONLY);
+		if (infile_b == -1) {
 			fprintf(stderr, "[file io] error: no such file (%s)\n", filename);
 			return 0;
 		}
-		numBytesRead = read(infile_b, numObjs,    sizeof(int));
-		assert(numBytesRead == sizeof(int));
-		numBytesRead = read(infile_b, numCoords, sizeof(int));
-		assert(numBytesRead == sizeof(int));
+		if (read_all(numObjs, sizeof(int)) != sizeof(int) ||
+		    read_all(numCoords, sizeof(int)) != sizeof(int)) {
+			fprintf(stderr, "[file io] error: no header (%s)\n", filename);
+			return 0;
+		}
+		if (*numObjs <= 0 || *numCoords <= 0) {
+			fprintf(stderr, "[file io] error: bad header, %d objects of %d "
+			        "coordinates (%s)\n", *numObjs, *numCoords, filename);
+			return 0;
+		}
+		if (streamed && *numObjs == CHUNK_MAGIC) {
+			fprintf(stderr, "[file io] error: a chunked file cannot be "
+			        "streamed (%s)\n", filename);
+			return 0;
+		}
 		if (_debug) {
 			printf("[file io] file %s numObjs   = %d\n",filename,*numObjs);
 			printf("[file io] file %s numCoords = %d\n",filename,*numCoords);
 		}
         
 	} else {  /* input file is in ASCII format -------------------------------*/
-		char *line, *ret;
+		const char *p, *eol;
 
-		if ((infile_t = fopen(filename, "r")) == NULL) {
+		if (!text_open(filename)) {
 			fprintf(stderr, "[file io] error: no such file (%s)\n", filename);
 			return 0;
 		}
+		text_index();
+		*numObjs = textObjs;
 
-		/* first find the number of objects */
-		lineLen = MAX_CHAR_PER_LINE;
-		line = (char*) malloc(lineLen);
-		assert(line != NULL);
+		/* the no. coordinates of the first object, without its id */
+		*numCoords = 0;
+		if (textObjs > 0) {
+			p   = text_find(0);
+			eol = line_end(p);
+			while (p < eol && IS_SEP(*p)) p++;
+			while (p < eol && !IS_SEP(*p)) p++;
+			for (;;) {
+				while (p < eol && IS_SEP(*p)) p++;
+				if (p == eol) break;
+				while (p < eol && !IS_SEP(*p)) p++;
+				(*numCoords)++;
+			}
+		}
+		if (_debug) {
+			printf("[file io] file %s numObjs   = %d\n",filename,*numObjs);
+			printf("[file io] file %s numCoords = %d\n",filename,*numCoords);
+		}
+    }    
+	return 1;
+}
+
+/*---< file_read_rows() >---------------------------------------------------------*/
+/* read the next numObjs objects of the open file into rows first, first+1, */
+/* ... of ds; return the no. objects read, less than numObjs at the end of  */
+/* the file                                                                  */
+int file_read_rows(int      isBinaryFile,  /* flag: 0 or 1 */
+                   dataset *ds,            /* out: rows [first][numCoords] on */
+                   int      first,         /* first row to fill */
+                   int      numObjs)       /* no. data objects to read */
+{
+	int     i;
+	int     numCoords = ds->numCoords;
 
-		(*numObjs) = 0;
+	if (isBinaryFile && chunked)
+		return chunk_read_rows(ds, first, numObjs);
+	if (isBinaryFile) {  /* input file is in raw binary format -------------*/
+		size_t rowLen = (size_t)numCoords * sizeof(float);
+		size_t got;
 
-		while (fgets(line, lineLen, infile_t) != NULL) {
-			/* check each line to find the max line length */
-			while (strlen(line) == lineLen-1) {
-				/* this line read is not complete */
-				len = strlen(line);
-				fseek(infile_t, -len, SEEK_CUR);
+		/* the file rows are packed as in ds */
+		got = read_all(ds->rows[first], (size_t)numObjs * rowLen);
+		streamNext += got / rowLen;
+		return got / rowLen;
 
-				/* increase lineLen */
-				lineLen += MAX_CHAR_PER_LINE;
-				line = (char*) realloc(line, lineLen);
-				assert(line != NULL);
+	} else {  /* input file is in ASCII format -------------------------------*/
+		int n = (numObjs < textObjs - textNext) ? numObjs : textObjs - textNext;
 
-				ret = fgets(line, lineLen, infile_t);
-				assert(ret != NULL);
-			}
+		/* each thread finds its first line from the index and parses its
+		   share of the objects straight into the rows */
+		#pragma omp parallel if (n >= ASCII_MARK) private(i)
+		{
+			int         nt = omp_get_num_threads();
+			int         t  = omp_get_thread_num();
+			int         a  = (long long)n * t / nt;
+			int         b  = (long long)n * (t + 1) / nt;
+			const char *p, *eol;
 
-			if (strtok(line, " \t\n") != 0)
-				(*numObjs)++;
+			if (a < b)
+				for (p=text_find(textNext + a), i=a; i<b; p=eol+1) {
+					eol = line_end(p);
+					if (blank_line(p, eol)) continue;
+					parse_line(p, eol, numCoords, ds->rows[first + i]);
+					i++;
+				}
 		}
-		rewind(infile_t);
-		if (_debug) printf("[file io] lineLen = %d\n",lineLen);
+		textNext += (n > 0) ? n : 0;
+		return (n > 0) ? n : 0;
+	}
+}
 
-		/* find the no. objects of each object */
-		(*numCoords) = 0;
-		while (fgets(line, lineLen, infile_t) != NULL) {
-			if (strtok(line, " \t\n") != 0) {
-				/* ignore the id (first coordiinate): numCoords = 1; */
-				while (strtok(NULL, " ,\t\n") != NULL) (*numCoords)++;
-				break; /* this makes read from 1st object */
-			}
-		}
-		rewind(infile_t);
-		if (_debug) {
-			printf("[file io] file %s numObjs   = %d\n",filename,*numObjs);
-			printf("[file io] file %s numCoords = %d\n",filename,*numCoords);
+/*---< file_read_seek() >---------------------------------------------------------*/
+/* move the open file to object index. Return 1 on success                   */
+int file_read_seek(int isBinaryFile,  /* flag: 0 or 1 */
+                   int index,         /* object to read next */
+                   int numCoords)     /* no. coordinates */
+{
+	if (isBinaryFile && chunked)
+		return chunk_seek(index);
+	if (isBinaryFile && streamed) {
+		/* forward only: read and drop the objects in between */
+		char   skip[65536];
+		size_t len = (index > streamNext)
+		             ? (size_t)(index - streamNext) * numCoords * sizeof(float)
+		             : 0;
+		if (index < streamNext) return 0;
+		while (len > 0) {
+			size_t n = read_all(skip, (len < sizeof(skip)) ? len : sizeof(skip));
+			if (n == 0) return 0;
+			len -= n;
 		}
-    }    
+		streamNext = index;
+		return 1;
+	}
+	if (isBinaryFile) {
+		off_t pos = 2 * sizeof(int) + (off_t)index * numCoords * sizeof(float);
+		return lseek(infile_b, pos, SEEK_SET) == pos;
+	}
+	if (index < 0 || index > textObjs) return 0;
+	textNext = index;
 	return 1;
 }
 
-/*---< file_read_head() >---------------------------------------------------------*/
-float** file_read_block(int   isBinaryFile,  /* flag: 0 or 1 */
+/*---< file_read_exact() >--------------------------------------------------------*/
+/* file_read_rows() of numObjs objects that must all be there. A binary or  */
+/* chunked file that ends early, or a chunk that does not decode, is fatal: */
+/* the blocks would be clustered with rows that were never read             */
+void file_read_exact(int      isBinaryFile,  /* flag: 0 or 1 */
+                     dataset *ds,            /* out: rows [first][numCoords] on */
+                     int      first,         /* first row to fill */
+                     int      numObjs)       /* no. data objects to read */
+{
+	int numRead = file_read_rows(isBinaryFile, ds, first, numObjs);
+
+	if (isBinaryFile && numRead != numObjs) {
+		fprintf(stderr, "[file io] error: %d of %d objects read, the file is "
+		        "truncated or corrupt\n", (numRead > 0) ? numRead : 0, numObjs);
+		exit(1);
+	}
+}
+
+/*---< file_read_block() >--------------------------------------------------------*/
+dataset* file_read_block(int   isBinaryFile,  /* flag: 0 or 1 */
                   char *filename,      /* input file name */
                   int  numObjs,       /* no. data objects (local) */
                   int  numCoords)     /* no. coordinates */
 {
-	int     i, j;
-	ssize_t numBytesRead;
-	float **objects;
-    
-	int len = numObjs * numCoords;
+	dataset *ds;
 	
 	if (_debug)
 		printf("\n[file io] read a block of %ix%i objects\n", numObjs, numCoords);
-	if (isBinaryFile) {  /* input file is in raw binary format -------------*/
-		
-		objects    = (float**)malloc(numObjs * sizeof(float*));
-		assert(objects != NULL);
-		objects[0] = (float*) malloc(len * sizeof(float));
-        assert(objects[0] != NULL);
-        for (i=1; i<numObjs; i++)
-            objects[i] = objects[i-1] + numCoords;
+	ds = dataset_alloc(numObjs, numCoords);
+	file_read_exact(isBinaryFile, ds, 0, numObjs);
+	
+    return ds;
+}
 
-		numBytesRead = read(infile_b, objects[0], len*sizeof(float));
-		assert(numBytesRead == len*sizeof(float));
+/*---< file_map_block() >---------------------------------------------------------*/
+/* as file_read_block(), but the next numObjs objects of a binary file are   */
+/* mapped, see dataset_map(): no copy, the pages are read on first access.  */
+/* The rows are packed and read-only. ASCII and chunked files, and binary   */
+/* files that cannot be mapped, are read                                     */
+dataset* file_map_block(int   isBinaryFile,  /* flag: 0 or 1 */
+                        char *filename,      /* input file name */
+                        int   numObjs,       /* no. data objects (local) */
+                        int   numCoords)     /* no. coordinates */
+{
+	dataset     *ds;
+	off_t        pos;
+	off_t        len = (off_t)numObjs * numCoords * sizeof(float);
+	struct stat  st;
 
-	} else {  /* input file is in ASCII format -------------------------------*/
+	if (!isBinaryFile || chunked || streamed)
+		return file_read_block(isBinaryFile, filename, numObjs, numCoords);
 
-		char *line = (char*) malloc(lineLen);
-		int llen;
-        objects    = (float**)malloc(numObjs * sizeof(float*));
-        assert(objects != NULL);
-        objects[0] = (float*) malloc(len * sizeof(float));
-        assert(objects[0] != NULL);
-        for (i=1; i<numObjs; i++)
-            objects[i] = objects[i-1] + numCoords;
-
-        i = 0;
-        /* read all objects */
-        while (fgets(line, lineLen, infile_t) != NULL && i < numObjs) {
-			if (i == 0)
-				llen = strlen(line);
-            if (strtok(line, " \t\n") == NULL)
-				continue;
-            for (j=0; j<numCoords; j++)
-                objects[i][j] = atof(strtok(NULL, " ,\t\n"));
-            i++;
-        }
-		fseek(infile_t, -llen, SEEK_CUR);
-        free(line);
-    }
-    //if(_debug)
-		//printf("[file io] first data values: %.4f %.4f %.4f %.4f\n", objects[0][0], objects[0][1], objects[1][0], objects[1][1]);
-	
-    return objects;
+	pos = lseek(infile_b, 0, SEEK_CUR);
+	if (fstat(infile_b, &st) == 0 && pos + len <= st.st_size &&
+	    (ds = dataset_map(infile_b, pos, numObjs, numCoords)) != NULL) {
+		if (_debug)
+			printf("\n[file io] mapped a block of %ix%i objects\n", numObjs,
+				   numCoords);
+		lseek(infile_b, pos + len, SEEK_SET);
+		return ds;
+	}
+	return file_read_block(isBinaryFile, filename, numObjs, numCoords);
+}
+
+/*---< file_read_stream() >-------------------------------------------------------*/
+/* 1 if the open file is a binary pipe or FIFO: it is read once, in order   */
+int file_read_stream(int isBinaryFile)  /* flag: 0 or 1 */
+{
+	return isBinaryFile && streamed;
 }
 
-       
 int file_read_close(int isBinaryFile)
 {
-	if (isBinaryFile)
+	if (isBinaryFile && chunked)
+		chunk_close();
+	else if (isBinaryFile && infile_b != STDIN_FILENO)
 		close(infile_b);
-	else
-		fclose(infile_t);
+	else if (!isBinaryFile)
+		text_close();
+	chunked  = 0;
+	streamed = 0;
 	
 	return 1;
 }
 
+/*---< format_int() >----------------------------------------------------------*/
+/* the decimal digits of v at p, as "%d" prints them; return their end       */
+static inline
+char* format_int(char *p, int v)
+{
+	char     tmp[12];
+	int      n = 0;
+	unsigned u = (v < 0) ? -(unsigned)v : (unsigned)v;
+
+	if (v < 0) *p++ = '-';
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+	while (n > 0) *p++ = tmp[--n];
+	return p;
+}
+
+/*---< write_membership_text() >------------------------------------------------*/
+/* the lines "i membership[i]" of all objects: the threads format runs of    */
+/* WRITE_CHUNK objects each into their own buffer, which are then written in */
+/* order                                                                     */
+static
+void write_membership_text(FILE *fptr,
+                           int   numObjs,
+                           int  *membership)   /* [numObjs] */
+{
+	int     t, start, nthreads = omp_get_max_threads();
+	size_t *len;   /* [nthreads] bytes formatted by each thread */
+	char   *buf;   /* [nthreads][WRITE_CHUNK * WRITE_LINE] */
+
+	len = (size_t*) malloc(nthreads * sizeof(size_t));
+	assert(len != NULL);
+	buf = (char*)   malloc((size_t)nthreads * WRITE_CHUNK * WRITE_LINE);
+	assert(buf != NULL);
+
+	for (start=0; start<numObjs; start+=nthreads*WRITE_CHUNK) {
+		#pragma omp parallel for num_threads(nthreads) private(t) schedule(static,1)
+		for (t=0; t<nthreads; t++) {
+			int   i;
+			int   first = start + t * WRITE_CHUNK;
+			int   last  = (numObjs - first < WRITE_CHUNK) ? numObjs
+			                                             : first + WRITE_CHUNK;
+			char *p     = buf + (size_t)t * WRITE_CHUNK * WRITE_LINE;
+			for (i=first; i<last; i++) {
+				p    = format_int(p, i);
+				*p++ = ' ';
+				p    = format_int(p, membership[i]);
+				*p++ = '\n';
+			}
+			len[t] = p - (buf + (size_t)t * WRITE_CHUNK * WRITE_LINE);
+		}
+		for (t=0; t<nthreads; t++)
+			fwrite(buf + (size_t)t * WRITE_CHUNK * WRITE_LINE, 1, len[t], fptr);
+	}
+
+	free(len);
+	free(buf);
+}
+
 /*---< file_write() >---------------------------------------------------------*/
-int file_write(char      *filename,     /* input file name */
+/* the binary format is the one of mpi_write(): the centers file holds the    */
+/* no. clusters and the no. coordinates (4-byte integers), then the centers  */
+/* as 4-byte floats; the membership file holds numObjs then the membership   */
+/* of each object, 4-byte integers                                           */
+int file_write(int        isOutFileBinary, /* flag: 0 or 1 */
+               char      *filename,     /* input file name */
                int        numClusters,  /* no. clusters */
                int        numObjs,      /* no. data objects */
                int        numCoords,    /* no. coordinates (local) */
@@ -194,22 +660,33 @@ int file_write(char      *filename,     /* input file name */
     sprintf(outFileName, "%s.cluster_centres", filename);
     printf("\n[file io] writing coordinates of K=%d cluster centers to file \"%s\"\n",
            numClusters, outFileName);
-    fptr = fopen(outFileName, "w");
-    for (i=0; i<numClusters; i++) {
-        fprintf(fptr, "%d ", i);
-        for (j=0; j<numCoords; j++)
-            fprintf(fptr, "%f ", clusters[i][j]);
-        fprintf(fptr, "\n");
+    fptr = fopen(outFileName, isOutFileBinary ? "wb" : "w");
+    if (isOutFileBinary) {
+        fwrite(&numClusters, sizeof(int), 1, fptr);
+        fwrite(&numCoords,   sizeof(int), 1, fptr);
+        for (i=0; i<numClusters; i++)
+            fwrite(clusters[i], sizeof(float), numCoords, fptr);
     }
+    else
+        for (i=0; i<numClusters; i++) {
+            fprintf(fptr, "%d ", i);
+            for (j=0; j<numCoords; j++)
+                fprintf(fptr, "%f ", clusters[i][j]);
+            fprintf(fptr, "\n");
+        }
     fclose(fptr);
 
     /* output: the closest cluster centre to each of the data points --------*/
     sprintf(outFileName, "%s.membership", filename);
     printf("[file io] writing membership of N=%d data objects to file \"%s\"\n",
            numObjs, outFileName);
-    fptr = fopen(outFileName, "w");
-    for (i=0; i<numObjs; i++)
-        fprintf(fptr, "%d %d\n", i, membership[i]);
+    fptr = fopen(outFileName, isOutFileBinary ? "wb" : "w");
+    if (isOutFileBinary) {
+        fwrite(&numObjs, sizeof(int), 1, fptr);
+        fwrite(membership, sizeof(int), numObjs, fptr);
+    }
+    else
+        write_membership_text(fptr, numObjs, membership);
     fclose(fptr);
 
     return 1;
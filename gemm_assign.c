@@ -0,0 +1,301 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         gemm_assign.c                                             */
+/*   Description:  Nearest-cluster assignment written as a blocked matrix    */
+/*                 product. Squared distances are expanded into              */
+/*                 ||x||^2 - 2 x.c + ||c||^2 so the inner loop becomes a     */
+/*                 register-blocked dot product of 4 objects against a       */
+/*                 panel of 16 cluster centers. Objects are tiled into       */
+/*                 blocks of GEMM_MB rows and centers into blocks that fit   */
+/*                 in L2, so each loaded coordinate is reused many times.    */
+/*                                                                           */
+/*                 Packed centers layout (see gemm_pack()):                  */
+/*                   [numPanels][numCoords][16] coordinates, then            */
+/*                   [numPanels * 16] squared norms, +inf for padding lanes  */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "kmeans.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_X86 1
+#include <immintrin.h>
+#endif
+
+#define GEMM_NR      16           /* centers per panel */
+#define GEMM_MR      4            /* objects per micro tile */
+#define GEMM_MB      128          /* objects per block */
+#define GEMM_KBYTES  (128*1024)   /* bytes of packed centers per block */
+
+typedef void (*ukernel_t)(int, float**, float*, float*, int, float*, int*);
+
+
+/*----< ukernel_scalar() >---------------------------------------------------*/
+/* update the running minimum of (||c||^2 - 2 x.c) of GEMM_MR objects over   */
+/* one panel of GEMM_NR centers, lane by lane                                */
+static
+void ukernel_scalar(int     numCoords,
+                    float **rows,      /* [GEMM_MR] object pointers */
+                    float  *panel,     /* [numCoords][GEMM_NR] */
+                    float  *cnorm,     /* [GEMM_NR] */
+                    int     base,      /* cluster id of lane 0 */
+                    float  *bestVal,   /* [GEMM_MR][GEMM_NR] */
+                    int    *bestIdx)   /* [GEMM_MR][GEMM_NR] */
+{
+    int   d, r, l;
+    float acc[GEMM_MR][GEMM_NR];
+
+    for (r=0; r<GEMM_MR; r++)
+        for (l=0; l<GEMM_NR; l++)
+            acc[r][l] = 0.0;
+
+    for (d=0; d<numCoords; d++) {
+        float *c = panel + d * GEMM_NR;
+        for (r=0; r<GEMM_MR; r++) {
+            float x = rows[r][d];
+            for (l=0; l<GEMM_NR; l++)
+                acc[r][l] += x * c[l];
+        }
+    }
+
+    for (r=0; r<GEMM_MR; r++) {
+        for (l=0; l<GEMM_NR; l++) {
+            float v = cnorm[l] - 2.0f * acc[r][l];
+            if (v < bestVal[r*GEMM_NR + l]) {
+                bestVal[r*GEMM_NR + l] = v;
+                bestIdx[r*GEMM_NR + l] = base + l;
+            }
+        }
+    }
+}
+
+#ifdef GEMM_X86
+
+/*----< ukernel_avx2() >-----------------------------------------------------*/
+/* 4x16 tile held in 8 ymm accumulators                                      */
+__attribute__((target("avx2,fma"))) static
+void ukernel_avx2(int     numCoords,
+                  float **rows,
+                  float  *panel,
+                  float  *cnorm,
+                  int     base,
+                  float  *bestVal,
+                  int    *bestIdx)
+{
+    int    d, r, h;
+    __m256 acc[GEMM_MR][2];
+    __m256 mtwo = _mm256_set1_ps(-2.0f);
+
+    for (r=0; r<GEMM_MR; r++)
+        acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+
+    for (d=0; d<numCoords; d++) {
+        __m256 c0 = _mm256_loadu_ps(panel + d*GEMM_NR);
+        __m256 c1 = _mm256_loadu_ps(panel + d*GEMM_NR + 8);
+        for (r=0; r<GEMM_MR; r++) {
+            __m256 x = _mm256_broadcast_ss(rows[r] + d);
+            acc[r][0] = _mm256_fmadd_ps(x, c0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(x, c1, acc[r][1]);
+        }
+    }
+
+    for (h=0; h<2; h++) {
+        __m256  cn  = _mm256_loadu_ps(cnorm + 8*h);
+        __m256i idx = _mm256_add_epi32(_mm256_set1_epi32(base + 8*h),
+                          _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        for (r=0; r<GEMM_MR; r++) {
+            float  *bv = bestVal + r*GEMM_NR + 8*h;
+            int    *bi = bestIdx + r*GEMM_NR + 8*h;
+            __m256  v  = _mm256_fmadd_ps(acc[r][h], mtwo, cn);
+            __m256  b  = _mm256_loadu_ps(bv);
+            __m256  lt = _mm256_cmp_ps(v, b, _CMP_LT_OQ);
+            _mm256_storeu_ps(bv, _mm256_blendv_ps(b, v, lt));
+            _mm256_storeu_si256((__m256i*)bi, _mm256_castps_si256(
+                _mm256_blendv_ps(_mm256_loadu_ps((float*)bi),
+                                 _mm256_castsi256_ps(idx), lt)));
+        }
+    }
+}
+
+/*----< ukernel_avx512() >---------------------------------------------------*/
+/* 4x16 tile held in 4 zmm accumulators                                      */
+__attribute__((target("avx512f"))) static
+void ukernel_avx512(int     numCoords,
+                    float **rows,
+                    float  *panel,
+                    float  *cnorm,
+                    int     base,
+                    float  *bestVal,
+                    int    *bestIdx)
+{
+    int     d;
+    __m512  a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+    __m512  a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+    __m512  mtwo = _mm512_set1_ps(-2.0f);
+    __m512  cn   = _mm512_loadu_ps(cnorm);
+    __m512i idx  = _mm512_add_epi32(_mm512_set1_epi32(base),
+                       _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                         8, 9,10,11,12,13,14,15));
+    float  *r0 = rows[0], *r1 = rows[1], *r2 = rows[2], *r3 = rows[3];
+
+    for (d=0; d<numCoords; d++) {
+        __m512 c = _mm512_loadu_ps(panel + d*GEMM_NR);
+        a0 = _mm512_fmadd_ps(_mm512_set1_ps(r0[d]), c, a0);
+        a1 = _mm512_fmadd_ps(_mm512_set1_ps(r1[d]), c, a1);
+        a2 = _mm512_fmadd_ps(_mm512_set1_ps(r2[d]), c, a2);
+        a3 = _mm512_fmadd_ps(_mm512_set1_ps(r3[d]), c, a3);
+    }
+
+#define UPDATE_ROW(r, a) do {                                                \
+        float    *bv = bestVal + (r)*GEMM_NR;                                \
+        int      *bi = bestIdx + (r)*GEMM_NR;                                \
+        __m512    v  = _mm512_fmadd_ps(a, mtwo, cn);                         \
+        __mmask16 lt = _mm512_cmp_ps_mask(v, _mm512_loadu_ps(bv), _CMP_LT_OQ); \
+        _mm512_mask_storeu_ps(bv, lt, v);                                    \
+        _mm512_mask_storeu_epi32(bi, lt, idx);                               \
+    } while (0)
+
+    UPDATE_ROW(0, a0);
+    UPDATE_ROW(1, a1);
+    UPDATE_ROW(2, a2);
+    UPDATE_ROW(3, a3);
+#undef UPDATE_ROW
+}
+
+#endif /* GEMM_X86 */
+
+static ukernel_t ukernel = ukernel_scalar;
+
+
+/*----< gemm_norms() >-------------------------------------------------------*/
+/* squared norm of every object. Computed once per run and reused by all     */
+/* iterations.                                                               */
+void gemm_norms(int     numObjs,     /* no. objects */
+                int     numCoords,   /* no. coordinates */
+                float **objects,     /* [numObjs][numCoords] */
+                float  *norms)       /* out: [numObjs] */
+{
+    int i, j;
+
+    for (i=0; i<numObjs; i++) {
+        float s = 0.0;
+        for (j=0; j<numCoords; j++)
+            s += objects[i][j] * objects[i][j];
+        norms[i] = s;
+    }
+}
+
+/*----< gemm_packed_size() >-------------------------------------------------*/
+/* no. floats needed by gemm_pack() */
+size_t gemm_packed_size(int numClusters, int numCoords)
+{
+    size_t numPanels = (numClusters + GEMM_NR - 1) / GEMM_NR;
+    return numPanels * GEMM_NR * (size_t)(numCoords + 1);
+}
+
+/*----< gemm_pack() >--------------------------------------------------------*/
+/* repack the cluster centers into panels of GEMM_NR columns followed by     */
+/* their squared norms. Must be called after every center update, before    */
+/* any thread calls gemm_nearest().                                          */
+void gemm_pack(int     numClusters,  /* no. clusters */
+               int     numCoords,    /* no. coordinates */
+               float **clusters,     /* [numClusters][numCoords] */
+               float  *packed)       /* out: gemm_packed_size() floats */
+{
+    int    p, d, l, c;
+    int    numPanels = (numClusters + GEMM_NR - 1) / GEMM_NR;
+    float *cnorm     = packed + (size_t)numPanels * GEMM_NR * numCoords;
+
+    for (p=0; p<numPanels; p++) {
+        float *panel = packed + (size_t)p * GEMM_NR * numCoords;
+        for (l=0; l<GEMM_NR; l++) {
+            float s = 0.0;
+            c = p * GEMM_NR + l;
+            for (d=0; d<numCoords; d++) {
+                float v = (c < numClusters) ? clusters[c][d] : 0.0f;
+                panel[d*GEMM_NR + l] = v;
+                s += v * v;
+            }
+            /* padding lanes can never win */
+            cnorm[c] = (c < numClusters) ? s : INFINITY;
+        }
+    }
+
+    ukernel = ukernel_scalar;
+#ifdef GEMM_X86
+    if (kernels_level() >= KERNELS_AVX512)
+        ukernel = ukernel_avx512;
+    else if (kernels_level() >= KERNELS_AVX2)
+        ukernel = ukernel_avx2;
+#endif
+}
+
+/*----< gemm_nearest() >-----------------------------------------------------*/
+/* for each of numObjs objects, the nearest packed center and its squared    */
+/* distance. Ties go to the lowest cluster index as in                       */
+/* find_nearest_cluster(). Safe to call concurrently on disjoint objects.    */
+void gemm_nearest(int     numObjs,     /* no. objects */
+                  int     numCoords,   /* no. coordinates */
+                  float **objects,     /* [numObjs][numCoords] */
+                  float  *objNorms,    /* [numObjs] from gemm_norms() */
+                  int     numClusters, /* no. clusters */
+                  float  *packed,      /* from gemm_pack() */
+                  int    *index,       /* out: [numObjs] nearest cluster */
+                  float  *distance)    /* out: [numObjs] squared distance */
+{
+    int    ob, mb, pb, pe, p, r, q, l;
+    int    numPanels = (numClusters + GEMM_NR - 1) / GEMM_NR;
+    int    kb;
+    float *cnorm     = packed + (size_t)numPanels * GEMM_NR * numCoords;
+    float *rows[GEMM_MR];
+
+    /* one row per object of the block, plus room for the padded last tile */
+    float  bestVal[(GEMM_MB + GEMM_MR) * GEMM_NR];
+    int    bestIdx[(GEMM_MB + GEMM_MR) * GEMM_NR];
+
+    kb = GEMM_KBYTES / (GEMM_NR * sizeof(float) * numCoords);
+    if (kb < 1) kb = 1;
+
+    for (ob=0; ob<numObjs; ob+=GEMM_MB) {
+        mb = (numObjs - ob < GEMM_MB) ? numObjs - ob : GEMM_MB;
+
+        for (l=0; l<(mb + GEMM_MR) * GEMM_NR; l++) {
+            bestVal[l] = INFINITY;
+            bestIdx[l] = 0;
+        }
+
+        for (pb=0; pb<numPanels; pb+=kb) {
+            pe = (pb + kb < numPanels) ? pb + kb : numPanels;
+            for (r=0; r<mb; r+=GEMM_MR) {
+                /* a short last tile repeats its last object */
+                for (q=0; q<GEMM_MR; q++)
+                    rows[q] = objects[ob + ((r+q < mb) ? r+q : mb-1)];
+                for (p=pb; p<pe; p++)
+                    ukernel(numCoords, rows,
+                            packed + (size_t)p * GEMM_NR * numCoords,
+                            cnorm + p * GEMM_NR, p * GEMM_NR,
+                            bestVal + r * GEMM_NR, bestIdx + r * GEMM_NR);
+            }
+        }
+
+        /* reduce the GEMM_NR lanes of each object */
+        for (r=0; r<mb; r++) {
+            float *bv  = bestVal + r * GEMM_NR;
+            int   *bi  = bestIdx + r * GEMM_NR;
+            float  min = bv[0];
+            int    idx = bi[0];
+            for (l=1; l<GEMM_NR; l++) {
+                if (bv[l] < min || (bv[l] == min && bi[l] < idx)) {
+                    min = bv[l];
+                    idx = bi[l];
+                }
+            }
+            min += objNorms[ob + r];
+            index[ob + r]    = idx;
+            distance[ob + r] = (min > 0.0f) ? min : 0.0f;
+        }
+    }
+}
@@ -0,0 +1,210 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         hamerly_kmeans.c                                          */
+/*   Description:  Lloyd's iteration accelerated with a single lower bound   */
+/*                 per object (G. Hamerly, "Making k-means even faster",     */
+/*                 SDM 2010). Every object keeps an upper bound on the       */
+/*                 distance to its own center and a lower bound on the       */
+/*                 distance to the second closest one. When the bounds       */
+/*                 cannot prove the assignment, all k distances are          */
+/*                 computed. The clustering is the same as the one of plain  */
+/*                 Lloyd's iteration, up to objects exactly equidistant to   */
+/*                 two centers.                                              */
+/*                                                                           */
+/*                 Memory: two floats per object, which makes it the method  */
+/*                 of choice for large low-dimensional data sets where       */
+/*                 elkan_kmeans() cannot afford k bounds per object.         */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+
+/*----< nearest_two() >------------------------------------------------------*/
+/* nearest center (ties to the lowest index, as find_nearest_cluster())      */
+/* and the distances to the nearest and second nearest centers               */
+__inline static
+int nearest_two(int     numClusters,
+                int     numCoords,
+                float  *object,
+                float **clusters,
+                float  *dist,     /* [numClusters] scratch */
+                float  *d1,
+                float  *d2)
+{
+    int   j, index = 0;
+    float min1 = INFINITY, min2 = INFINITY;
+
+    cluster_distances(numClusters, numCoords, object, clusters, dist);
+    for (j=0; j<numClusters; j++) {
+        float d = dist[j];
+        if (d < min1) {
+            min2  = min1;
+            min1  = d;
+            index = j;
+        }
+        else if (d < min2)
+            min2 = d;
+    }
+    *d1 = sqrtf(min1);
+    *d2 = sqrtf(min2);
+    return index;
+}
+
+/*----< hamerly_kmeans() >---------------------------------------------------*/
+/* return an array of cluster centers of size [numClusters][numCoords]       */
+float** hamerly_kmeans(int     nthreads,     /* no. threads, 1 for sequential */
+                       int     maxIter,      /* max no. loops */
+                       float **objects,      /* in: [numObjs][numCoords] */
+                       int     numCoords,    /* no. features */
+                       int     numObjs,      /* no. objects */
+                       int     numClusters,  /* no. clusters */
+                       float **clustersInit, /* init value for cluster */
+                       float   threshold,    /* % objects change membership */
+                       int    *membership,   /* in/out: [numObjs] */
+                       int    *loop_iterations)
+{
+    int      i, j, loop=0;
+    float    delta;          /* % of objects change their clusters */
+    double   numDist;        /* no. distances computed, for debug */
+    float  **clusters;       /* out: [numClusters][numCoords] */
+    int     *assign;         /* [numObjs] current center of each object */
+    float   *upper;          /* [numObjs] upper bound to own center */
+    float   *lower;          /* [numObjs] lower bound to any other center */
+    float   *halfMin;        /* [numClusters] half distance to closest center */
+    float   *shift;          /* [numClusters] distance moved by each center */
+    int     *size;           /* [numClusters] running no. members */
+    double  *sum;            /* [numClusters][numCoords] running member sums */
+    float   *scratch;        /* [nthreads][numClusters] distance rows */
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    for (i=0; i<numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            clusters[i][j] = clustersInit[i][j];
+
+    assign  = (int*)   malloc(numObjs * sizeof(int));
+    assert(assign != NULL);
+    upper   = (float*) malloc(numObjs * sizeof(float));
+    assert(upper != NULL);
+    lower   = (float*) malloc(numObjs * sizeof(float));
+    assert(lower != NULL);
+    halfMin = (float*) malloc(numClusters * sizeof(float));
+    assert(halfMin != NULL);
+    shift   = (float*) malloc(numClusters * sizeof(float));
+    assert(shift != NULL);
+    size    = (int*)    calloc(numClusters, sizeof(int));
+    assert(size != NULL);
+    sum     = (double*) calloc((size_t)numClusters * numCoords, sizeof(double));
+    assert(sum != NULL);
+    scratch = (float*) malloc((size_t)nthreads * numClusters * sizeof(float));
+    assert(scratch != NULL);
+
+    kernels_init();
+
+    /* first loop: all distances, exactly as Lloyd */
+    numDist = (double)numObjs * numClusters;
+    #pragma omp parallel for num_threads(nthreads) private(i) schedule(static)
+    for (i=0; i<numObjs; i++)
+        assign[i] = nearest_two(numClusters, numCoords, objects[i], clusters,
+                        scratch + (size_t)omp_get_thread_num() * numClusters,
+                        &upper[i], &lower[i]);
+
+    do {
+        delta = 0.0;
+
+        if (loop > 0) {
+            double loopDist = 0.0;
+
+            /* half distance from each center to the closest other one */
+            #pragma omp parallel for num_threads(nthreads) private(i,j) \
+                    schedule(dynamic, 16)
+            for (i=0; i<numClusters; i++) {
+                float *d   = scratch + (size_t)omp_get_thread_num() * numClusters;
+                float  min = INFINITY;
+                cluster_distances(numClusters, numCoords, clusters[i],
+                                  clusters, d);
+                for (j=0; j<numClusters; j++)
+                    if (j != i && d[j] < min) min = d[j];
+                halfMin[i] = 0.5f * sqrtf(min);
+            }
+            loopDist += (double)numClusters * (numClusters - 1);
+
+            /* assignment filtered by the bounds */
+            #pragma omp parallel for num_threads(nthreads) private(i) \
+                    schedule(dynamic, 256) reduction(+:loopDist)
+            for (i=0; i<numObjs; i++) {
+                int   a = assign[i];
+                float m = (halfMin[a] > lower[i]) ? halfMin[a] : lower[i];
+
+                if (upper[i] <= m) continue;
+
+                /* tighten the upper bound and try again */
+                upper[i] = sqrtf(euclid_dist_2(numCoords, objects[i],
+                                               clusters[a]));
+                loopDist += 1.0;
+                if (upper[i] <= m) continue;
+
+                assign[i] = nearest_two(numClusters, numCoords, objects[i],
+                        clusters,
+                        scratch + (size_t)omp_get_thread_num() * numClusters,
+                        &upper[i], &lower[i]);
+                loopDist += numClusters;
+            }
+            numDist += loopDist;
+        }
+
+        /* move the objects that changed cluster (delta) from one running
+           sum to the other: new centers and how far they moved */
+        delta = update_centers(nthreads, objects, numCoords, numObjs,
+                               numClusters, assign, membership, size, sum,
+                               clusters, shift);
+
+        /* relax the bounds: the lower bound by the largest move among the
+           other centers, i.e. the second largest move for the object whose
+           own center moved the most */
+        {
+            int   far = 0;
+            float max1 = 0.0, max2 = 0.0;
+            for (j=0; j<numClusters; j++) {
+                if (shift[j] > max1) {
+                    max2 = max1;
+                    max1 = shift[j];
+                    far  = j;
+                }
+                else if (shift[j] > max2)
+                    max2 = shift[j];
+            }
+
+            #pragma omp parallel for num_threads(nthreads) private(i) \
+                    schedule(static)
+            for (i=0; i<numObjs; i++) {
+                upper[i] += shift[assign[i]];
+                lower[i] -= (assign[i] == far) ? max2 : max1;
+            }
+        }
+
+        delta /= numObjs;
+        if (_debug)
+            printf("delta = %.3f distances = %.0f (%.1f%% of lloyd)\n", delta,
+                   numDist, 100.0 * numDist /
+                   ((double)(loop + 1) * numObjs * numClusters));
+
+    } while (delta > threshold && loop++ < maxIter);
+
+    *loop_iterations = loop + 1;
+
+    free(assign);
+    free(upper);
+    free(lower);
+    free(halfMin);
+    free(shift);
+    free(size);
+    free(sum);
+    free(scratch);
+
+    return clusters;
+}
@@ -0,0 +1,417 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         kdtree_kmeans.c                                           */
+/*   Description:  Lloyd's iteration with the filtering algorithm of         */
+/*                 T. Kanungo et al., "An Efficient k-Means Clustering       */
+/*                 Algorithm: Analysis and Implementation", PAMI 2002.       */
+/*                 A kd-tree is built once over the objects, each node       */
+/*                 keeping its bounding box and the sum of its objects.      */
+/*                 Every loop pushes the centers down the tree and drops     */
+/*                 the ones that are farther than another center from the    */
+/*                 whole box; when a single candidate is left, the whole     */
+/*                 subtree goes to it through the node sum, without          */
+/*                 touching its objects. A subtree that keeps the same       */
+/*                 owner from one loop to the next costs one visit, so a     */
+/*                 loop gets sublinear in numObjs once well separated        */
+/*                 clusters settle. The clustering is the same as the one    */
+/*                 of plain Lloyd's iteration, up to objects exactly         */
+/*                 equidistant to two centers and the rounding of the sums.  */
+/*                                                                           */
+/*                 Best for low dimensional data (2 to 16 coordinates): in   */
+/*                 higher dimension the boxes overlap most centers and no    */
+/*                 candidate gets pruned.                                    */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+#define LEAF_SIZE    16   /* max. no. objects in a leaf */
+#define TASKS_PER_THREAD 8 /* subtrees per thread for the load balance */
+
+/* the nodes are stored in preorder, so the subtree of node n is the range
+   of nodes [n, last) */
+typedef struct {
+    int start, end;      /* objects perm[start .. end-1] */
+    int left, right;     /* children, -1 for a leaf */
+    int last;            /* one past the last node of the subtree */
+    int owner;           /* center owning all the objects, -1 if unknown */
+} kdnode;
+
+typedef struct {
+    int      numCoords;
+    float  **objects;
+    int     *perm;       /* [numObjs] objects sorted by node */
+    kdnode  *nodes;
+    float   *box;        /* [numNodes][2][numCoords] low and high corners */
+    double  *sum;        /* [numNodes][numCoords] sum of the objects */
+    int      numNodes, maxNodes;
+    int     *tasks;      /* subtrees run in parallel */
+    int      numTasks, maxTasks;
+    int      depth;      /* depth of the deepest leaf */
+} kdtree;
+
+typedef struct {         /* per thread state of a loop */
+    double  *sum;        /* [numClusters][numCoords] */
+    int     *size;       /* [numClusters] */
+    int     *cand;       /* [depth+1][numClusters] candidate lists */
+    float  **ptrs;       /* [numClusters] coordinates of the candidates */
+    double   delta;      /* no. objects that changed cluster */
+    double   numDist;    /* no. distances computed, for debug */
+} kdwork;
+
+
+/*----< select_median() >----------------------------------------------------*/
+/* reorder perm[lo..hi-1] so that perm[mid] has the median coordinate dim,   */
+/* smaller ones before and larger ones after (Hoare's selection)             */
+static
+void select_median(float **objects, int *perm, int lo, int hi, int mid, int dim)
+{
+    hi--;
+    while (hi > lo) {
+        float pivot = objects[perm[(lo + hi) / 2]][dim];
+        int   i = lo, j = hi;
+        while (i <= j) {
+            while (objects[perm[i]][dim] < pivot) i++;
+            while (objects[perm[j]][dim] > pivot) j--;
+            if (i <= j) {
+                int t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+                i++; j--;
+            }
+        }
+        if (mid <= j)      hi = j;
+        else if (mid >= i) lo = i;
+        else break;
+    }
+}
+
+/*----< build_node() >-------------------------------------------------------*/
+/* build the subtree of the objects perm[start..end-1], return its node      */
+static
+int build_node(kdtree *t, int start, int end, int depth, int taskDepth)
+{
+    int     i, j, n, split, dim = 0, d = t->numCoords;
+    float  *lo, *hi;
+    double *s;
+
+    if (t->numNodes == t->maxNodes) {
+        t->maxNodes *= 2;
+        t->nodes = (kdnode*) realloc(t->nodes, t->maxNodes * sizeof(kdnode));
+        t->box   = (float*)  realloc(t->box, (size_t)t->maxNodes * 2 * d *
+                                     sizeof(float));
+        t->sum   = (double*) realloc(t->sum, (size_t)t->maxNodes * d *
+                                     sizeof(double));
+        assert(t->nodes != NULL && t->box != NULL && t->sum != NULL);
+    }
+    n = t->numNodes++;
+    t->nodes[n].start = start;
+    t->nodes[n].end   = end;
+    t->nodes[n].left  = t->nodes[n].right = -1;
+    t->nodes[n].owner = -1;
+    if (depth > t->depth) t->depth = depth;
+
+    /* bounding box and sum */
+    lo = t->box + (size_t)n * 2 * d;
+    hi = lo + d;
+    s  = t->sum + (size_t)n * d;
+    for (j=0; j<d; j++) {
+        lo[j] = hi[j] = t->objects[t->perm[start]][j];
+        s[j]  = 0.0;
+    }
+    for (i=start; i<end; i++) {
+        float *x = t->objects[t->perm[i]];
+        for (j=0; j<d; j++) {
+            if (x[j] < lo[j]) lo[j] = x[j];
+            if (x[j] > hi[j]) hi[j] = x[j];
+            s[j] += x[j];
+        }
+    }
+
+    /* split at the median of the widest side, unless all objects are equal */
+    for (j=1; j<d; j++)
+        if (hi[j] - lo[j] > hi[dim] - lo[dim]) dim = j;
+    split = (end - start > LEAF_SIZE && hi[dim] > lo[dim]);
+
+    /* the subtrees at taskDepth, or the leaves above it, are the units of
+       the parallel loop */
+    if (depth == taskDepth || (depth < taskDepth && !split)) {
+        if (t->numTasks == t->maxTasks) {
+            t->maxTasks *= 2;
+            t->tasks = (int*) realloc(t->tasks, t->maxTasks * sizeof(int));
+            assert(t->tasks != NULL);
+        }
+        t->tasks[t->numTasks++] = n;
+    }
+
+    if (split) {
+        int mid = start + (end - start) / 2;
+        int left, right;
+        select_median(t->objects, t->perm, start, end, mid, dim);
+        left  = build_node(t, start, mid, depth + 1, taskDepth);
+        right = build_node(t, mid,   end, depth + 1, taskDepth);
+        t->nodes[n].left  = left;   /* nodes may have been realloc-ed */
+        t->nodes[n].right = right;
+    }
+    t->nodes[n].last = t->numNodes;
+    return n;
+}
+
+/*----< is_farther() >-------------------------------------------------------*/
+/* true when center z is farther than center best from every point of the    */
+/* box: |x-z|^2 - |x-best|^2 is linear in x, its minimum over the box is at  */
+/* the corner the farthest in the direction z - best                         */
+__inline static
+int is_farther(int numCoords, float *z, float *best, float *lo, float *hi)
+{
+    int   j;
+    float dz = 0.0, db = 0.0;
+
+    for (j=0; j<numCoords; j++) {
+        float v = (z[j] > best[j]) ? hi[j] : lo[j];
+        dz += (v - z[j])    * (v - z[j]);
+        db += (v - best[j]) * (v - best[j]);
+    }
+    return dz > db;
+}
+
+/*----< assign_subtree() >---------------------------------------------------*/
+/* all the objects of node n go to center c                                  */
+static
+void assign_subtree(kdtree *t, int n, int c, int *membership, kdwork *w)
+{
+    int     i, j, d = t->numCoords;
+    kdnode *node = t->nodes + n;
+    double *s    = t->sum + (size_t)n * d;
+
+    for (j=0; j<d; j++)
+        w->sum[(size_t)c * d + j] += s[j];
+    w->size[c] += node->end - node->start;
+
+    if (node->owner == c) return;   /* nothing changed below */
+
+    for (i=node->start; i<node->end; i++) {
+        int p = t->perm[i];
+        if (membership[p] != c) {
+            membership[p] = c;
+            w->delta += 1.0;
+        }
+    }
+    /* the owners below are out of date */
+    for (i=n+1; i<node->last; i++) t->nodes[i].owner = -1;
+    node->owner = c;
+}
+
+/*----< filter() >-----------------------------------------------------------*/
+/* assign the objects of node n to the nearest of the nc centers cand[],     */
+/* cand[] is sorted so ties go to the lowest index as in Lloyd's iteration   */
+static
+void filter(kdtree   *t,
+            int       n,
+            int      *cand,
+            int       nc,
+            int       depth,
+            float   **clusters,
+            int      *membership,
+            kdwork   *w)
+{
+    int     i, j, c, best, d = t->numCoords;
+    int     numClusters;
+    kdnode *node = t->nodes + n;
+    float  *lo   = t->box + (size_t)n * 2 * d;
+    float  *hi   = lo + d;
+    int    *next;
+
+    if (nc == 1) {
+        assign_subtree(t, n, cand[0], membership, w);
+        return;
+    }
+    node->owner = -1;
+
+    if (node->left < 0) {
+        /* leaf: nearest candidate of each object */
+        for (c=0; c<nc; c++) w->ptrs[c] = clusters[cand[c]];
+        for (i=node->start; i<node->end; i++) {
+            int   p = t->perm[i];
+            float dist;
+            c = cand[find_nearest_cluster(nc, d, &dist, t->objects[p],
+                                          w->ptrs)];
+            for (j=0; j<d; j++)
+                w->sum[(size_t)c * d + j] += t->objects[p][j];
+            w->size[c]++;
+            if (membership[p] != c) {
+                membership[p] = c;
+                w->delta += 1.0;
+            }
+        }
+        w->numDist += (double)nc * (node->end - node->start);
+        return;
+    }
+
+    /* candidate closest to the middle of the box */
+    {
+        float mid[d], min = INFINITY;
+        for (j=0; j<d; j++) mid[j] = 0.5f * (lo[j] + hi[j]);
+        best = cand[0];
+        for (c=0; c<nc; c++) {
+            float dist = euclid_dist_2(d, mid, clusters[cand[c]]);
+            if (dist < min) {
+                min  = dist;
+                best = cand[c];
+            }
+        }
+    }
+
+    /* drop the candidates farther than best from the whole box */
+    numClusters = 0;
+    next = cand + nc;
+    for (c=0; c<nc; c++)
+        if (cand[c] == best ||
+            !is_farther(d, clusters[cand[c]], clusters[best], lo, hi))
+            next[numClusters++] = cand[c];
+    w->numDist += 3.0 * nc;
+
+    if (numClusters == 1) {
+        assign_subtree(t, n, best, membership, w);
+        return;
+    }
+    filter(t, node->left,  next, numClusters, depth + 1, clusters,
+           membership, w);
+    filter(t, node->right, next, numClusters, depth + 1, clusters,
+           membership, w);
+}
+
+/*----< kdtree_kmeans() >----------------------------------------------------*/
+/* return an array of cluster centers of size [numClusters][numCoords]       */
+float** kdtree_kmeans(int     nthreads,     /* no. threads, 1 for sequential */
+                      int     maxIter,      /* max no. loops */
+                      float **objects,      /* in: [numObjs][numCoords] */
+                      int     numCoords,    /* no. features */
+                      int     numObjs,      /* no. objects */
+                      int     numClusters,  /* no. clusters */
+                      float **clustersInit, /* init value for cluster */
+                      float   threshold,    /* % objects change membership */
+                      int    *membership,   /* in/out: [numObjs] */
+                      int    *loop_iterations)
+{
+    int      i, j, loop=0, taskDepth;
+    float    delta;          /* % of objects change their clusters */
+    double   numDist = 0.0;  /* no. distances computed, for debug */
+    float  **clusters;       /* out: [numClusters][numCoords] */
+    kdtree   tree;
+    kdwork  *work;           /* [nthreads] */
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    for (i=0; i<numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            clusters[i][j] = clustersInit[i][j];
+
+    kernels_init();
+
+    /* build the tree, once for all loops */
+    tree.numCoords = numCoords;
+    tree.objects   = objects;
+    tree.perm      = (int*) malloc(numObjs * sizeof(int));
+    assert(tree.perm != NULL);
+    for (i=0; i<numObjs; i++) tree.perm[i] = i;
+    tree.maxNodes  = 2 * (numObjs / LEAF_SIZE) + 16;
+    tree.numNodes  = 0;
+    tree.nodes     = (kdnode*) malloc(tree.maxNodes * sizeof(kdnode));
+    tree.box       = (float*)  malloc((size_t)tree.maxNodes * 2 * numCoords *
+                                      sizeof(float));
+    tree.sum       = (double*) malloc((size_t)tree.maxNodes * numCoords *
+                                      sizeof(double));
+    assert(tree.nodes != NULL && tree.box != NULL && tree.sum != NULL);
+    tree.maxTasks  = 16;
+    tree.numTasks  = 0;
+    tree.tasks     = (int*) malloc(tree.maxTasks * sizeof(int));
+    assert(tree.tasks != NULL);
+    tree.depth     = 0;
+
+    for (taskDepth=0; (1 << taskDepth) < nthreads * TASKS_PER_THREAD &&
+                      nthreads > 1; taskDepth++);
+    if (numObjs > 0)
+        build_node(&tree, 0, numObjs, 0, taskDepth);
+
+    work = (kdwork*) malloc(nthreads * sizeof(kdwork));
+    assert(work != NULL);
+    for (i=0; i<nthreads; i++) {
+        work[i].sum  = (double*) malloc((size_t)numClusters * numCoords *
+                                        sizeof(double));
+        work[i].size = (int*)    malloc(numClusters * sizeof(int));
+        work[i].cand = (int*)    malloc((size_t)(tree.depth + 2) *
+                                        numClusters * sizeof(int));
+        work[i].ptrs = (float**) malloc(numClusters * sizeof(float*));
+        assert(work[i].sum != NULL && work[i].size != NULL &&
+               work[i].cand != NULL && work[i].ptrs != NULL);
+    }
+
+    if (_debug)
+        printf("kd-tree: %d nodes, depth %d, %d subtrees\n", tree.numNodes,
+               tree.depth, tree.numTasks);
+
+    do {
+        #pragma omp parallel num_threads(nthreads) private(i,j)
+        {
+            kdwork *w = work + omp_get_thread_num();
+
+            memset(w->sum,  0, (size_t)numClusters * numCoords * sizeof(double));
+            memset(w->size, 0, numClusters * sizeof(int));
+            w->delta   = 0.0;
+            w->numDist = 0.0;
+
+            #pragma omp for schedule(dynamic, 1)
+            for (i=0; i<tree.numTasks; i++) {
+                for (j=0; j<numClusters; j++) w->cand[j] = j;
+                filter(&tree, tree.tasks[i], w->cand, numClusters, 0,
+                       clusters, membership, w);
+            }
+        }
+
+        /* new centers: reduce the thread sums in thread order */
+        delta = 0.0;
+        for (i=0; i<nthreads; i++) {
+            delta   += work[i].delta;
+            numDist += work[i].numDist;
+        }
+        for (i=0; i<numClusters; i++) {
+            int size = 0;
+            int t;
+            for (t=0; t<nthreads; t++) size += work[t].size[i];
+            if (size == 0) continue;
+            for (j=0; j<numCoords; j++) {
+                double s = 0.0;
+                for (t=0; t<nthreads; t++)
+                    s += work[t].sum[(size_t)i * numCoords + j];
+                clusters[i][j] = s / size;
+            }
+        }
+
+        delta /= numObjs;
+        if (_debug)
+            printf("delta = %.3f distances = %.0f (%.1f%% of lloyd)\n", delta,
+                   numDist, 100.0 * numDist /
+                   ((double)(loop + 1) * numObjs * numClusters));
+
+    } while (delta > threshold && loop++ < maxIter);
+
+    *loop_iterations = loop + 1;
+
+    for (i=0; i<nthreads; i++) {
+        free(work[i].sum);
+        free(work[i].size);
+        free(work[i].cand);
+        free(work[i].ptrs);
+    }
+    free(work);
+    free(tree.perm);
+    free(tree.nodes);
+    free(tree.box);
+    free(tree.sum);
+    free(tree.tasks);
+
+    return clusters;
+}
@@ -0,0 +1,522 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         kernels.c                                                 */
+/*   Description:  Distance and nearest-cluster kernels shared by the        */
+/*                 sequential, OpenMP and MPI engines. Each kernel has a     */
+/*                 scalar, SSE, AVX2 and AVX-512 implementation; the best    */
+/*                 one supported by the running CPU is picked once, by       */
+/*                 kernels_init() (CPUID through __builtin_cpu_supports()).  */
+/*                                                                           */
+/*                 Within each instruction set, the kernels are specialized  */
+/*                 for the common numbers of coordinates (2, 3, 4, 8, 16,    */
+/*                 32, 64) so the distance loop is fully unrolled, and       */
+/*                 find_nearest_clusters() keeps up to 16 centers in         */
+/*                 registers for the whole block of objects.                 */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "kmeans.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#define TARGET_SSE    __attribute__((target("sse2")))
+#define TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+#define SMALLK_MAX_K  16   /* max. no. centers held in registers */
+#define SMALLK_MAX_D  64   /* max. no. coordinates for these kernels */
+
+
+/*----< specializations >----------------------------------------------------*/
+/* SPECIALIZE() expands KERNEL(dist, numdims) once per specialized number of */
+/* coordinates, where the inlined distance gets a constant loop count, and   */
+/* once with the run-time numCoords as fallback. Up to 4 coordinates the     */
+/* unrolled scalar distance wins: it needs no masked load nor horizontal sum */
+#define SPECIALIZE(KERNEL, dist, numCoords)                                   \
+    switch (numCoords) {                                                      \
+        case  2: KERNEL(dist_scalar,  2); break;                              \
+        case  3: KERNEL(dist_scalar,  3); break;                              \
+        case  4: KERNEL(dist_scalar,  4); break;                              \
+        case  8: KERNEL(dist,  8); break;                                     \
+        case 16: KERNEL(dist, 16); break;                                     \
+        case 32: KERNEL(dist, 32); break;                                     \
+        case 64: KERNEL(dist, 64); break;                                     \
+        default: KERNEL(dist, numCoords);                                     \
+    }
+
+#define DIST_KERNEL(dist, numdims)                                            \
+    ans = dist(numdims, coord1, coord2)
+
+#define NEAREST_KERNEL(dist, numdims) {                                       \
+    min_dist = dist(numdims, object, clusters[0]);                            \
+    for (i=1; i<numClusters; i++) {                                           \
+        float d = dist(numdims, object, clusters[i]);                         \
+        if (d < min_dist) {                                                   \
+            min_dist = d;                                                     \
+            index    = i;                                                     \
+        }                                                                     \
+    }                                                                         \
+}
+
+#define ALL_KERNEL(dist, numdims)                                             \
+    for (i=0; i<numClusters; i++)                                             \
+        distances[i] = dist(numdims, object, clusters[i])
+
+/* euclid_dist_2_<isa>(), find_nearest_cluster_<isa>() and
+   cluster_distances_<isa>() on top of the inlined dist_<isa>() */
+#define DEFINE_KERNELS(isa, TARGET)                                           \
+static TARGET                                                                 \
+float euclid_dist_2_##isa(int numdims, float *coord1, float *coord2)          \
+{                                                                             \
+    float ans;                                                                \
+    SPECIALIZE(DIST_KERNEL, dist_##isa, numdims)                              \
+    return(ans);                                                              \
+}                                                                             \
+                                                                              \
+static TARGET                                                                 \
+int find_nearest_cluster_##isa(int     numClusters,                           \
+                               int     numCoords,                             \
+                               float  *distance,                              \
+                               float  *object,                                \
+                               float **clusters)                              \
+{                                                                             \
+    int   index = 0, i;                                                       \
+    float min_dist;                                                           \
+    SPECIALIZE(NEAREST_KERNEL, dist_##isa, numCoords)                         \
+    *distance = min_dist;                                                     \
+    return(index);                                                            \
+}                                                                             \
+                                                                              \
+static TARGET                                                                 \
+void cluster_distances_##isa(int     numClusters,                             \
+                             int     numCoords,                               \
+                             float  *object,                                  \
+                             float **clusters,                                \
+                             float  *distances)                               \
+{                                                                             \
+    int i;                                                                    \
+    SPECIALIZE(ALL_KERNEL, dist_##isa, numCoords);                            \
+}
+
+
+/*----< scalar kernels >-----------------------------------------------------*/
+__inline static
+float dist_scalar(int numdims, float *coord1, float *coord2)
+{
+    int i;
+    float ans=0.0;
+
+    for (i=0; i<numdims; i++)
+        ans += (coord1[i]-coord2[i]) * (coord1[i]-coord2[i]);
+
+    return(ans);
+}
+
+DEFINE_KERNELS(scalar, )
+
+#ifdef KERNELS_X86
+
+/*----< SSE kernels >--------------------------------------------------------*/
+/* 4 coordinates per step, scalar tail                                       */
+__inline static TARGET_SSE
+float dist_sse(int numdims, float *coord1, float *coord2)
+{
+    int    i;
+    float  ans;
+    __m128 acc = _mm_setzero_ps();
+
+    for (i=0; i+4<=numdims; i+=4) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(coord1+i), _mm_loadu_ps(coord2+i));
+        acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    ans = _mm_cvtss_f32(acc);
+
+    for (; i<numdims; i++)
+        ans += (coord1[i]-coord2[i]) * (coord1[i]-coord2[i]);
+
+    return(ans);
+}
+
+DEFINE_KERNELS(sse, TARGET_SSE)
+
+/*----< AVX2 kernels >-------------------------------------------------------*/
+/* 16 coordinates per step in two FMA chains, masked tail                    */
+__inline static TARGET_AVX2
+__m256i avx2_tail_mask(int n)   /* first n lanes set, 0 <= n < 8 */
+{
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n),
+                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__inline static TARGET_AVX2
+float dist_avx2(int numdims, float *coord1, float *coord2)
+{
+    int    i;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m128 lo;
+
+    for (i=0; i+16<=numdims; i+=16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(coord1+i),
+                                  _mm256_loadu_ps(coord2+i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(coord1+i+8),
+                                  _mm256_loadu_ps(coord2+i+8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    if (i+8 <= numdims) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(coord1+i),
+                                 _mm256_loadu_ps(coord2+i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+        i += 8;
+    }
+    if (i < numdims) {
+        __m256i m = avx2_tail_mask(numdims - i);
+        __m256  d = _mm256_sub_ps(_mm256_maskload_ps(coord1+i, m),
+                                  _mm256_maskload_ps(coord2+i, m));
+        acc1 = _mm256_fmadd_ps(d, d, acc1);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    lo   = _mm_add_ps(_mm256_castps256_ps128(acc0),
+                      _mm256_extractf128_ps(acc0, 1));
+    lo   = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo   = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+
+    return _mm_cvtss_f32(lo);
+}
+
+DEFINE_KERNELS(avx2, TARGET_AVX2)
+
+/* the nearest of the numClusters distances d[] as find_nearest_cluster()
+   scans them: the first one, replaced by any smaller one. Used when the
+   minimum over the registers is not finite (a NaN or inf coordinate), so
+   that the index is always a valid cluster */
+static
+void smallk_scan(const float *d, int numClusters, int *index, float *distance)
+{
+    int i, best = 0;
+
+    for (i=1; i<numClusters; i++)
+        if (d[i] < d[best]) best = i;
+    *index    = best;
+    *distance = d[best];
+}
+
+/* up to 16 centers in two registers, coordinate j of every center in
+   ct[2j] and ct[2j+1]; ties go to the lowest index */
+__inline static TARGET_AVX2
+void smallk_avx2(int     numObjs,
+                 int     numdims,
+                 int     numClusters,
+                 float **objects,
+                 __m256 *ct,
+                 __m256  pad0,       /* +inf on the lanes without center */
+                 __m256  pad1,
+                 int    *index,
+                 float  *distance)
+{
+    int i, j;
+
+    for (i=0; i<numObjs; i++) {
+        __m256 acc0 = pad0, acc1 = pad1, m;
+        __m128 lo;
+        int    bits;
+        for (j=0; j<numdims; j++) {
+            __m256 x  = _mm256_broadcast_ss(objects[i] + j);
+            __m256 d0 = _mm256_sub_ps(x, ct[2*j]);
+            __m256 d1 = _mm256_sub_ps(x, ct[2*j+1]);
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        }
+        m  = _mm256_min_ps(acc0, acc1);
+        lo = _mm_min_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+        lo = _mm_min_ps(lo, _mm_movehl_ps(lo, lo));
+        lo = _mm_min_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+        distance[i] = _mm_cvtss_f32(lo);
+        if (!(distance[i] < INFINITY)) {
+            float lane[SMALLK_MAX_K];
+            _mm256_storeu_ps(lane, acc0);
+            _mm256_storeu_ps(lane + 8, acc1);
+            smallk_scan(lane, numClusters, index + i, distance + i);
+            continue;
+        }
+        m  = _mm256_broadcastss_ps(lo);
+        bits = _mm256_movemask_ps(_mm256_cmp_ps(acc0, m, _CMP_EQ_OQ)) |
+               _mm256_movemask_ps(_mm256_cmp_ps(acc1, m, _CMP_EQ_OQ)) << 8;
+        index[i] = __builtin_ctz(bits);
+    }
+}
+
+#define SMALLK_AVX2_KERNEL(dist, numdims)                                     \
+    smallk_avx2(numObjs, numdims, numClusters, objects, ct, pad0, pad1,      \
+                index, distance)
+
+static TARGET_AVX2
+void find_nearest_clusters_avx2(int     numObjs,
+                                int     numCoords,
+                                float **objects,
+                                int     numClusters,
+                                float **clusters,
+                                int    *index,
+                                float  *distance)
+{
+    int    i, j;
+    float  t[SMALLK_MAX_K];
+    __m256 ct[2 * SMALLK_MAX_D], pad0, pad1;
+
+    for (j=0; j<numCoords; j++) {
+        for (i=0; i<SMALLK_MAX_K; i++)
+            t[i] = (i < numClusters) ? clusters[i][j] : 0.0f;
+        ct[2*j]   = _mm256_loadu_ps(t);
+        ct[2*j+1] = _mm256_loadu_ps(t + 8);
+    }
+    for (i=0; i<SMALLK_MAX_K; i++)
+        t[i] = (i < numClusters) ? 0.0f : INFINITY;
+    pad0 = _mm256_loadu_ps(t);
+    pad1 = _mm256_loadu_ps(t + 8);
+
+    SPECIALIZE(SMALLK_AVX2_KERNEL, , numCoords)
+}
+
+/*----< AVX-512 kernels >----------------------------------------------------*/
+/* 16 coordinates per step, masked tail                                      */
+__inline static TARGET_AVX512
+float dist_avx512(int numdims, float *coord1, float *coord2)
+{
+    int    i;
+    __m512 acc = _mm512_setzero_ps();
+
+    for (i=0; i+16<=numdims; i+=16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(coord1+i),
+                                 _mm512_loadu_ps(coord2+i));
+        acc = _mm512_fmadd_ps(d, d, acc);
+    }
+    if (i < numdims) {
+        __mmask16 m = (__mmask16)((1u << (numdims - i)) - 1);
+        __m512    d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, coord1+i),
+                                    _mm512_maskz_loadu_ps(m, coord2+i));
+        acc = _mm512_fmadd_ps(d, d, acc);
+    }
+    return _mm512_reduce_add_ps(acc);
+}
+
+DEFINE_KERNELS(avx512, TARGET_AVX512)
+
+/* up to 16 centers in one register, coordinate j of every center in ct[j];
+   ties go to the lowest index */
+__inline static TARGET_AVX512
+void smallk_avx512(int     numObjs,
+                   int     numdims,
+                   int     numClusters,
+                   float **objects,
+                   __m512 *ct,
+                   __m512  pad,      /* +inf on the lanes without center */
+                   int    *index,
+                   float  *distance)
+{
+    int i, j;
+
+    for (i=0; i<numObjs; i++) {
+        __m512 acc = pad;
+        float  min;
+        for (j=0; j<numdims; j++) {
+            __m512 d = _mm512_sub_ps(_mm512_set1_ps(objects[i][j]), ct[j]);
+            acc = _mm512_fmadd_ps(d, d, acc);
+        }
+        min = _mm512_reduce_min_ps(acc);
+        if (!(min < INFINITY)) {
+            float lane[SMALLK_MAX_K];
+            _mm512_storeu_ps(lane, acc);
+            smallk_scan(lane, numClusters, index + i, distance + i);
+            continue;
+        }
+        index[i]    = __builtin_ctz(_mm512_cmp_ps_mask(acc, _mm512_set1_ps(min),
+                                                       _CMP_EQ_OQ));
+        distance[i] = min;
+    }
+}
+
+#define SMALLK_AVX512_KERNEL(dist, numdims)                                   \
+    smallk_avx512(numObjs, numdims, numClusters, objects, ct, pad, index,   \
+                  distance)
+
+static TARGET_AVX512
+void find_nearest_clusters_avx512(int     numObjs,
+                                  int     numCoords,
+                                  float **objects,
+                                  int     numClusters,
+                                  float **clusters,
+                                  int    *index,
+                                  float  *distance)
+{
+    int    i, j;
+    float  t[SMALLK_MAX_K];
+    __m512 ct[SMALLK_MAX_D], pad;
+
+    for (j=0; j<numCoords; j++) {
+        for (i=0; i<SMALLK_MAX_K; i++)
+            t[i] = (i < numClusters) ? clusters[i][j] : 0.0f;
+        ct[j] = _mm512_loadu_ps(t);
+    }
+    for (i=0; i<SMALLK_MAX_K; i++)
+        t[i] = (i < numClusters) ? 0.0f : INFINITY;
+    pad = _mm512_loadu_ps(t);
+
+    SPECIALIZE(SMALLK_AVX512_KERNEL, , numCoords)
+}
+
+#endif /* KERNELS_X86 */
+
+
+/*----< runtime dispatch >---------------------------------------------------*/
+/* the pointers start on the scalar kernels and are set once, by the first   */
+/* kernels_init(). Every engine calls kernels_init() before its threads      */
+/* start, so no kernel is read while the pointers are written                */
+static float (*dist_fn)(int, float*, float*) = euclid_dist_2_scalar;
+static int   (*nearest_fn)(int, int, float*, float*, float**) =
+             find_nearest_cluster_scalar;
+static void  (*all_fn)(int, int, float*, float**, float*) =
+             cluster_distances_scalar;
+static void  (*smallk_fn)(int, int, float**, int, float**, int*, float*);
+static const char *isa_name  = "scalar";
+static int         isa_level = KERNELS_SCALAR;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/*----< kernels_select() >---------------------------------------------------*/
+/* select the widest instruction set supported by the CPU. The environment   */
+/* variable KMEANS_ISA (scalar, sse, avx2, avx512) caps the choice, which is */
+/* handy to compare kernels on the same machine.                             */
+static void kernels_select(void)
+{
+#ifdef KERNELS_X86
+    {
+        char *cap = getenv("KMEANS_ISA");
+        int   level = 3;
+
+        if (cap != NULL) {
+            if      (strcmp(cap, "scalar") == 0) level = 0;
+            else if (strcmp(cap, "sse")    == 0) level = 1;
+            else if (strcmp(cap, "avx2")   == 0) level = 2;
+        }
+        __builtin_cpu_init();
+        if (level >= 3 && __builtin_cpu_supports("avx512f")) {
+            dist_fn    = euclid_dist_2_avx512;
+            nearest_fn = find_nearest_cluster_avx512;
+            all_fn     = cluster_distances_avx512;
+            smallk_fn  = find_nearest_clusters_avx512;
+            isa_name   = "avx512";
+            isa_level  = KERNELS_AVX512;
+        }
+        else if (level >= 2 && __builtin_cpu_supports("avx2") &&
+                 __builtin_cpu_supports("fma")) {
+            dist_fn    = euclid_dist_2_avx2;
+            nearest_fn = find_nearest_cluster_avx2;
+            all_fn     = cluster_distances_avx2;
+            smallk_fn  = find_nearest_clusters_avx2;
+            isa_name   = "avx2";
+            isa_level  = KERNELS_AVX2;
+        }
+        else if (level >= 1 && __builtin_cpu_supports("sse2")) {
+            dist_fn    = euclid_dist_2_sse;
+            nearest_fn = find_nearest_cluster_sse;
+            all_fn     = cluster_distances_sse;
+            isa_name   = "sse";
+            isa_level  = KERNELS_SSE;
+        }
+    }
+#endif
+    if (_debug) printf("[kernels] using %s distance kernels\n", isa_name);
+}
+
+/*----< kernels_init() >-----------------------------------------------------*/
+/* run kernels_select() once per process, whichever thread gets here first   */
+void kernels_init(void)
+{
+    pthread_once(&kernels_once, kernels_select);
+}
+
+/*----< kernels_isa() >------------------------------------------------------*/
+const char* kernels_isa(void)
+{
+    kernels_init();
+    return isa_name;
+}
+
+/*----< kernels_level() >---------------------------------------------------*/
+/* one of KERNELS_SCALAR .. KERNELS_AVX512, for modules with their own       */
+/* per-ISA code paths                                                        */
+int kernels_level(void)
+{
+    kernels_init();
+    return isa_level;
+}
+
+/*----< euclid_dist_2() >----------------------------------------------------*/
+/* square of Euclid distance between two multi-dimensional points            */
+float euclid_dist_2(int    numdims,  /* no. dimensions */
+                    float *coord1,   /* [numdims] */
+                    float *coord2)   /* [numdims] */
+{
+    return dist_fn(numdims, coord1, coord2);
+}
+
+/*----< find_nearest_cluster() >---------------------------------------------*/
+/* index of the cluster center closest to object, its squared distance is    */
+/* stored in *distance. Ties go to the lowest index.                         */
+int find_nearest_cluster(int     numClusters, /* no. clusters */
+                         int     numCoords,   /* no. coordinates */
+                         float  *distance,    /* out: min squared distance */
+                         float  *object,      /* [numCoords] */
+                         float **clusters)    /* [numClusters][numCoords] */
+{
+    return nearest_fn(numClusters, numCoords, distance, object, clusters);
+}
+
+/*----< cluster_distances() >------------------------------------------------*/
+/* squared distances from object to every cluster center, in one call so the */
+/* dispatch cost is paid once per object                                     */
+void cluster_distances(int     numClusters, /* no. clusters */
+                       int     numCoords,   /* no. coordinates */
+                       float  *object,      /* [numCoords] */
+                       float **clusters,    /* [numClusters][numCoords] */
+                       float  *distances)   /* out: [numClusters] */
+{
+    all_fn(numClusters, numCoords, object, clusters, distances);
+}
+
+/*----< find_nearest_clusters() >--------------------------------------------*/
+/* find_nearest_cluster() for a block of objects. With AVX2 or AVX-512 and   */
+/* at most 16 centers of at most 64 coordinates, the centers are transposed  */
+/* once into registers and each object costs one broadcast and one FMA per   */
+/* coordinate for all centers at once. Ties go to the lowest index.          */
+void find_nearest_clusters(int     numObjs,     /* no. objects */
+                           int     numCoords,   /* no. coordinates */
+                           float **objects,     /* [numObjs][numCoords] */
+                           int     numClusters, /* no. clusters */
+                           float **clusters,    /* [numClusters][numCoords] */
+                           int    *index,       /* out: [numObjs] */
+                           float  *distance)    /* out: [numObjs] min squared
+                                                   distances */
+{
+    int i;
+
+    if (smallk_fn != NULL && numClusters <= SMALLK_MAX_K &&
+        numCoords <= SMALLK_MAX_D) {
+        smallk_fn(numObjs, numCoords, objects, numClusters, clusters, index,
+                  distance);
+        return;
+    }
+    for (i=0; i<numObjs; i++)
+        index[i] = nearest_fn(numClusters, numCoords, &distance[i], objects[i],
+                              clusters);
+}
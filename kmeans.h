@@ -41,12 +41,12 @@
 #define err(format, ...) do { fprintf(stderr, format, ##__VA_ARGS__); exit(1); } while (0)
 
 #define malloc2D(name, xDim, yDim, type) do {               \
-    name = (type **)malloc(xDim * sizeof(type *));          \
+    name = (type **)malloc((xDim) * sizeof(type *));        \
     assert(name != NULL);                                   \
-    name[0] = (type *)malloc(xDim * yDim * sizeof(type));   \
+    name[0] = (type *)malloc((size_t)(xDim) * (yDim) * sizeof(type)); \
     assert(name[0] != NULL);                                \
-    for (size_t i = 1; i < xDim; i++)                       \
-        name[i] = name[i-1] + yDim;                         \
+    for (size_t i = 1; i < (size_t)(xDim); i++)             \
+        name[i] = name[i-1] + (yDim);                       \
 } while (0)
 
 #ifdef __CUDACC__
@@ -68,16 +68,220 @@ inline void checkLastCudaError() {
 #define MAX_ITER 50
 #define DELTA_THRESHOLD 	0.001
 
-float** omp_kmeans(int, float**, int, int, int, float **, float, int*, int*);
-float** seq_kmeans(float**, int, int, int, float **, float, int*, int*);
+/* assignment methods of seq_kmeans() and omp_kmeans(), option -m */
+#define KM_LLOYD        0   /* one distance pass per cluster per object */
+#define KM_GEMM         1   /* blocked ||x||^2 - 2x.c + ||c||^2 */
+#define KM_ELKAN        2   /* triangle inequality, k bounds per object */
+#define KM_HAMERLY      3   /* triangle inequality, 2 bounds per object */
+#define KM_YINYANG      4   /* triangle inequality, k/10 group bounds */
+#define KM_KDTREE       5   /* kd-tree filtering, low dimension */
+#define KM_MINIBATCH    6   /* mini-batch gradient steps, streams files */
+
+/* initial centers, imethod of the library, option -c */
+#define KM_INIT_RANDOM  0   /* random coordinates of random objects */
+#define KM_INIT_KPP     1   /* k-means++ seeding */
+#define KM_INIT_KPAR    2   /* k-means|| seeding */
+
+#define KPAR_ROUNDS     5    /* k-means|| sampling rounds */
+#define KPAR_OVERSAMPLE 2    /* k-means|| samples per round, times k */
+
+/* several runs from different initial centers, option -R */
+#define NINIT_WARMUP    5    /* loops before a run can be dropped */
+#define NINIT_MARGIN    0.2  /* dropped when 20% costlier than the best */
+
+/* instruction set levels returned by kernels_level() */
+#define KERNELS_SCALAR  0
+#define KERNELS_SSE     1
+#define KERNELS_AVX2    2
+#define KERNELS_AVX512  3
+
+#define GEMM_BLOCK      1024 /* objects handed to gemm_nearest() at once */
+
+#define MINIBATCH_SIZE  1024 /* default no. objects per mini-batch */
+#define MINIBATCH_ITER  100  /* default no. mini-batches */
+
+#define DATA_ALIGN      64   /* bytes, alignment of the dataset rows */
+
+#define PREFETCH_BUFFERS 2   /* blocks in memory when the data are split */
+
+/* a block of objects stored by dataset_alloc(): [numObjs][numCoords] floats
+   in one contiguous, DATA_ALIGN-byte aligned buffer. rows[] points into data
+   and is what the engines take as objects; the kernels do not rely on the
+   alignment (unaligned loads). dataset_map() makes a read-only view of a
+   binary file instead: data points into the mapping */
+typedef struct {
+    int     numObjs;
+    int     numCoords;
+    float  *data;       /* [numObjs][numCoords] */
+    float **rows;       /* [numObjs] row pointers into data */
+    float  *soa;        /* [numCoords][numObjs] or NULL, see dataset_soa() */
+    void   *map;        /* file mapping holding data, or NULL */
+    size_t  mapLen;     /* bytes mapped */
+} dataset;
+
+/* reduced-precision storage of a block of objects (-Q), see quant.c: rows
+   packed [numObjs][numCoords], elemSize bytes per coordinate; int8 codes c
+   stand for c * scale + offset, one scale and offset per coordinate for
+   each group of QUANT_GROUP objects */
+#define QUANT_NONE      0    /* floats, dataset */
+#define QUANT_FP16      1    /* IEEE half floats */
+#define QUANT_BF16      2    /* upper 16 bits of the floats */
+#define QUANT_INT8      3    /* 8-bit integers, scaled */
+#define QUANT_GROUP     1024 /* objects sharing the int8 scales */
+#define QUANT_SEED      65536 /* max. objects expanded for -c 1 and -c 2 */
+
+typedef struct {
+    int            numObjs;
+    int            numCoords;
+    int            type;       /* QUANT_FP16, QUANT_BF16 or QUANT_INT8 */
+    int            elemSize;   /* bytes per coordinate */
+    unsigned char *data;       /* [numObjs][numCoords] */
+    float         *scale;      /* int8: [numGroups][numCoords], else NULL */
+    float         *offset;     /* int8: [numGroups][numCoords], else NULL */
+} qdataset;
+
+/* blocks of a split data set read ahead by a thread, see prefetch.c */
+typedef struct prefetch prefetch;
+
+/* chunked dataset files, see chunk_io.c. The magic takes the place of the
+   no. objects of a raw binary file */
+#define CHUNK_MAGIC     0x434d4b23   /* "#KMC" */
+#define CHUNK_VERSION   2
+#define CHUNK_ROWS      0            /* layout: [n][numCoords] per chunk */
+#define CHUNK_COLUMNS   1            /* layout: [numCoords][n] per chunk */
+#define CHUNK_FLOAT32   0            /* coordinate type */
+#define CHUNK_OBJS      65536        /* default no. objects per chunk */
+#define CHUNK_NONE      0            /* codec: chunks stored raw */
+#define CHUNK_LZ        1            /* codec: byte-shuffled, codec.c */
+
+typedef struct {
+    int magic;
+    int version;
+    int numObjs;
+    int numCoords;
+    int chunkObjs;   /* objects per chunk, the last one less */
+    int numChunks;
+    int layout;      /* CHUNK_ROWS or CHUNK_COLUMNS */
+    int dtype;       /* CHUNK_FLOAT32 */
+    int codec;       /* CHUNK_NONE or CHUNK_LZ, version 2 on */
+    int reserved;
+} chunk_header;
+
+/* per-thread buffers of omp_kmeans(), owned by the caller so that the blocks
+   of omp_main -s and of the library do not allocate them again and that
+   calls with different buffers can run at the same time. Zero-initialize,
+   pass to every call and free with omp_kmeans_release() */
+typedef struct {
+    int     nthreads;     /* sizes the buffers were made for, 0: none */
+    int     numClusters;
+    int     numCoords;
+    size_t  sizeStride;   /* ints per thread in localSize */
+    size_t  sumStride;    /* doubles per thread in localSum */
+    int    *nearest;      /* [nthreads][GEMM_BLOCK] */
+    float  *nearDist;     /* [nthreads][GEMM_BLOCK] */
+    int    *localSize;    /* [nthreads][sizeStride] */
+    double *localSum;     /* [nthreads][sumStride] */
+} omp_work;
+
+float** omp_kmeans(omp_work*, int, int, float**, int, int, int, float **, float, int*, int*);
+void    omp_kmeans_release(omp_work*);
+float** seq_kmeans(int, float**, int, int, int, float **, float, int*, int*);
 float** cuda_kmeans(float**, int, int, int, float **, float, int*, int*);
+float** elkan_kmeans(int, int, float**, int, int, int, float **, float, int*, int*);
+float** hamerly_kmeans(int, int, float**, int, int, int, float **, float, int*, int*);
+float** yinyang_kmeans(int, int, float**, int, int, int, float **, float, int*, int*);
+float** kdtree_kmeans(int, int, float**, int, int, int, float **, float, int*, int*);
+float** minibatch_kmeans(int, float**, int, int, int, int, float**, int, int, int,
+                         int*, int*);
+float** minibatch_stream(int, dataset*, int, int, int, int, float**, int, int*,
+                         int*);
+float** restart_kmeans(int, int, float**, int, int, int, float**, int, float,
+                       int*, int*);
+
+void    kpp_init(int, float**, int, int, int, float**);
+void    kpar_init(int, float**, int, int, int, float**);
+double  kpar_update(int, float**, int, int, float**, int, int, float*, int*);
+int     kpar_sample(int, int, float*, double, double, unsigned long long, int,
+                    int, unsigned char*);
+float** kpar_grow(float**, int, int);
+void    kpp_weighted(int, float**, double*, int, int, int,
+                     unsigned long long*, float**);
+double  seed_random(unsigned long long*);
+unsigned long long seed_state(void);
+
+int     update_centers(int, float**, int, int, int, int*, int*, int*, double*,
+                       float**, float*);
 
 void cuda_kpp_init(float**, float**, int*, int, int, int);
 
+void        kernels_init(void);
+const char* kernels_isa(void);
+float       euclid_dist_2(int, float*, float*);
+int         find_nearest_cluster(int, int, float*, float*, float**);
+void        cluster_distances(int, int, float*, float**, float*);
+void        find_nearest_clusters(int, int, float**, int, float**, int*, float*);
+int         kernels_level(void);
+
+void    gemm_norms(int, int, float**, float*);
+size_t  gemm_packed_size(int, int);
+void    gemm_pack(int, int, float**, float*);
+void    gemm_nearest(int, int, float**, float*, int, float*, int*, float*);
+
+/* dataset.c is compiled as C for the CUDA version too */
+#ifdef __cplusplus
+extern "C" {
+#endif
+dataset*  dataset_create(int, int);
+dataset*  dataset_alloc(int, int);
+dataset*  dataset_map(int, long long, int, int);
+float*    dataset_soa(dataset*);
+void      dataset_free(dataset*);
+#ifdef __cplusplus
+}
+#endif
+
 int 	file_read_head(int, char*, int*, int*);
-float** file_read_block(int, char*, int, int);
+int     file_read_rows(int, dataset*, int, int);
+void    file_read_exact(int, dataset*, int, int);
+int     file_read_seek(int, int, int);
+dataset* file_read_block(int, char*, int, int);
+dataset* file_map_block(int, char*, int, int);
+int     file_read_stream(int);
 int  	file_read_close(int);
-int     file_write(char*, int, int, int, float**, int*);
+int     file_write(int, char*, int, int, int, float**, int*);
+
+int     chunk_open(char*, int*, int*);
+int     chunk_read_rows(dataset*, int, int);
+int     chunk_seek(int);
+int     chunk_stats(int*, int*, int*, long long*, float**, float**, double**);
+int     chunk_close(void);
+int     chunk_create(char*, int, int, int, int, int);
+int     chunk_write(float**, int);
+int     chunk_finish(void);
+
+void    shuffle_bytes(const void*, size_t, int, void*);
+void    unshuffle_bytes(const void*, size_t, int, void*);
+size_t  lz_bound(size_t);
+size_t  lz_compress(const unsigned char*, size_t, unsigned char*);
+int     lz_decompress(const unsigned char*, size_t, unsigned char*, size_t);
+
+qdataset* quant_alloc(int, int, int);
+void      quant_free(qdataset*);
+int       quant_store(qdataset*, int, int, float**);
+void      quant_load(const qdataset*, int, int, float**);
+qdataset* quant_read_block(int, int, int, int);
+float**   quant_kmeans(int, qdataset*, int, float**, float, int*, int*);
+
+int      numa_init(int);
+int      numa_nodes(void);
+dataset* numa_alloc_block(int, int);
+dataset* numa_read_block(int, char*, int, int);
+void     numa_bandwidth(int, int, float**, double*);
+
+prefetch* prefetch_start(int, char*, int, int, int, int,
+                         dataset* (*)(int, int), int);
+dataset*  prefetch_next(prefetch*);
+void      prefetch_stop(prefetch*);
 
 void    gui_kmean(float*, float*, int, float*, float*, int, int*);
 void    pdf_kmean(float*, float*, int, float*, float*, int, int*);
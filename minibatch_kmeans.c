@@ -0,0 +1,288 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         minibatch_kmeans.c                                        */
+/*   Description:  Mini-batch k-means (D. Sculley, "Web-Scale K-Means        */
+/*                 Clustering", WWW 2010). Each step assigns a batch of      */
+/*                 objects to the current centers, then moves every center   */
+/*                 towards each of its objects with a learning rate of one   */
+/*                 over the no. objects the center has seen so far. The      */
+/*                 batches come from memory or are streamed from the open    */
+/*                 input file with file_read_rows(), so the data set does    */
+/*                 not have to fit in memory; a last pass over all objects   */
+/*                 gives the memberships. The result is an approximation of  */
+/*                 Lloyd's, reached in a fraction of a pass over the data.   */
+/*                 A pipe cannot be read twice: minibatch_stream() makes one */
+/*                 pass, the memberships given along the way.                */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+#define NUM_WINDOWS  8   /* random batch of a file: no. runs of objects */
+
+
+/*----< next_batch() >-------------------------------------------------------*/
+/* point rows[0..batchSize-1] to the next batch. From memory (objects not    */
+/* NULL) the batch is batchSize random objects, or the next batchSize ones.  */
+/* From the file it is read into buf: the next batchSize objects, wrapping   */
+/* around at the end, or NUM_WINDOWS runs of consecutive objects starting at */
+/* random positions (binary files only, a file cannot be sampled object by   */
+/* object at a reasonable cost)                                              */
+static
+void next_batch(float  **objects,       /* [numObjs][numCoords] or NULL */
+                int      isBinaryFile,
+                int      numObjs,
+                int      batchSize,
+                int      randomBatches,
+                int     *next,          /* in/out: next object in order */
+                dataset *buf,           /* [batchSize] rows read from file */
+                float  **rows)          /* out: [batchSize] batch rows */
+{
+    int i, n;
+
+    if (objects != NULL) {
+        for (i=0; i<batchSize; i++) {
+            if (randomBatches)
+                rows[i] = objects[rand() % numObjs];
+            else {
+                rows[i] = objects[*next];
+                *next   = (*next + 1) % numObjs;
+            }
+        }
+        return;
+    }
+
+    if (randomBatches && isBinaryFile) {
+        int w, len = (batchSize + NUM_WINDOWS - 1) / NUM_WINDOWS;
+        for (w=0, i=0; i<batchSize; w++, i+=n) {
+            int start;
+            n     = (batchSize - i < len) ? batchSize - i : len;
+            start = rand() % (numObjs - n + 1);
+            file_read_seek(isBinaryFile, start, buf->numCoords);
+            file_read_exact(isBinaryFile, buf, i, n);
+        }
+    }
+    else {
+        for (i=0; i<batchSize; i+=n) {
+            n = file_read_rows(isBinaryFile, buf, i, batchSize - i);
+            *next += n;
+            if (i + n < batchSize || *next == numObjs) {
+                /* end of the file: go on from the first object */
+                file_read_seek(isBinaryFile, 0, buf->numCoords);
+                *next = 0;
+            }
+        }
+    }
+    for (i=0; i<batchSize; i++) rows[i] = buf->rows[i];
+}
+
+/*----< batch_step() >-------------------------------------------------------*/
+/* one gradient step: the nearest centers of rows[0..n-1], into nearest and  */
+/* dist, then every center moved towards its objects                         */
+static
+void batch_step(int      nthreads,
+                float  **rows,          /* [n] batch rows */
+                int      n,
+                int      numCoords,
+                int      numClusters,
+                float  **clusters,      /* in/out: [numClusters][numCoords] */
+                double  *seen,          /* in/out: [numClusters] */
+                int     *nearest,       /* out: [n] */
+                float   *dist)          /* out: [n] */
+{
+    int b, i, j;
+
+    /* nearest centers of the whole batch, with the centers of the
+       beginning of the step */
+    #pragma omp parallel for num_threads(nthreads) private(b) \
+            schedule(static)
+    for (b=0; b<n; b+=GEMM_BLOCK)
+        find_nearest_clusters((n - b < GEMM_BLOCK) ? n - b : GEMM_BLOCK,
+                              numCoords, rows + b, numClusters, clusters,
+                              nearest + b, dist + b);
+
+    /* gradient steps in batch order; each thread owns the centers
+       c % nthreads == tid, so the result does not depend on nthreads */
+    #pragma omp parallel num_threads(nthreads) private(i,j)
+    {
+        int tid = omp_get_thread_num();
+        int nt  = omp_get_num_threads();
+        for (i=0; i<n; i++) {
+            int    c = nearest[i];
+            float  eta;
+            if (c % nt != tid) continue;
+            seen[c] += 1.0;
+            eta = 1.0 / seen[c];
+            for (j=0; j<numCoords; j++)
+                clusters[c][j] += eta * (rows[i][j] - clusters[c][j]);
+        }
+    }
+}
+
+/*----< minibatch_kmeans() >-------------------------------------------------*/
+/* return an array of cluster centers of size [numClusters][numCoords]. When */
+/* objects is NULL the objects are read from the input file opened by        */
+/* file_read_head(); the file is left at an unspecified position             */
+float** minibatch_kmeans(int     nthreads,      /* no. threads */
+                         float **objects,       /* in: [numObjs][numCoords],
+                                                   NULL to stream the file */
+                         int     isBinaryFile,  /* streamed file format */
+                         int     numCoords,     /* no. features */
+                         int     numObjs,       /* no. objects */
+                         int     numClusters,   /* no. clusters */
+                         float **clustersInit,  /* init value for cluster */
+                         int     batchSize,     /* no. objects per batch */
+                         int     numBatches,    /* no. batches */
+                         int     randomBatches, /* 1: random, 0: in order */
+                         int    *membership,    /* out: [numObjs] */
+                         int    *loop_iterations)
+{
+    int       i, j, b, loop, next = 0;
+    int       bufSize;        /* rows of buf, batches and last pass */
+    float   **clusters;       /* out: [numClusters][numCoords] */
+    double   *seen;           /* [numClusters] no. objects seen per center */
+    float   **rows;           /* [bufSize] rows of the current batch */
+    int      *nearest;        /* [bufSize] nearest center of the batch rows */
+    float    *dist;           /* [bufSize] distances to the nearest center */
+    dataset  *buf = NULL;     /* [bufSize] objects read from the file */
+
+    if (batchSize > numObjs) batchSize = numObjs;
+    bufSize = (batchSize > GEMM_BLOCK) ? batchSize : GEMM_BLOCK;
+    if (!isBinaryFile && objects == NULL && randomBatches) {
+        if (_debug) printf("mini-batch: random batches need a binary file, "
+                           "reading the batches in order\n");
+        randomBatches = 0;
+    }
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    for (i=0; i<numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            clusters[i][j] = clustersInit[i][j];
+
+    seen    = (double*) calloc(numClusters, sizeof(double));
+    assert(seen != NULL);
+    rows    = (float**) malloc(bufSize * sizeof(float*));
+    assert(rows != NULL);
+    nearest = (int*)    malloc(bufSize * sizeof(int));
+    assert(nearest != NULL);
+    dist    = (float*)  malloc(bufSize * sizeof(float));
+    assert(dist != NULL);
+    if (objects == NULL) {
+        buf = dataset_alloc(bufSize, numCoords);
+        file_read_seek(isBinaryFile, 0, numCoords);
+    }
+
+    kernels_init();
+
+    for (loop=0; loop<numBatches; loop++) {
+        next_batch(objects, isBinaryFile, numObjs, batchSize, randomBatches,
+                   &next, buf, rows);
+        batch_step(nthreads, rows, batchSize, numCoords, numClusters,
+                   clusters, seen, nearest, dist);
+
+        if (_debug) {
+            double sum = 0.0;
+            for (i=0; i<batchSize; i++) sum += dist[i];
+            printf("batch %d: mean distance = %f\n", loop, sum / batchSize);
+        }
+    }
+    *loop_iterations = numBatches;
+
+    /* last pass: membership of all objects */
+    if (objects == NULL) file_read_seek(isBinaryFile, 0, numCoords);
+    for (i=0; i<numObjs; i+=bufSize) {
+        int n = (numObjs - i < bufSize) ? numObjs - i : bufSize;
+        if (objects == NULL) {
+            file_read_exact(isBinaryFile, buf, 0, n);
+            for (j=0; j<n; j++) rows[j] = buf->rows[j];
+        }
+        else
+            for (j=0; j<n; j++) rows[j] = objects[i + j];
+
+        #pragma omp parallel for num_threads(nthreads) private(b) \
+                schedule(static)
+        for (b=0; b<n; b+=GEMM_BLOCK)
+            find_nearest_clusters((n - b < GEMM_BLOCK) ? n - b : GEMM_BLOCK,
+                                  numCoords, rows + b, numClusters, clusters,
+                                  membership + i + b, dist + b);
+    }
+
+    free(seen);
+    free(rows);
+    free(nearest);
+    free(dist);
+    dataset_free(buf);
+
+    return clusters;
+}
+
+/*----< minibatch_stream() >-------------------------------------------------*/
+/* mini-batch k-means in a single pass over a stream (file_read_stream()),   */
+/* which cannot be read again: first holds the first batchSize objects,      */
+/* already read, and the batches are it and the next batchSize objects of    */
+/* the file, to its end. The membership of an object is its nearest center   */
+/* at the step of its batch. Return the cluster centers, as                  */
+/* minibatch_kmeans()                                                        */
+float** minibatch_stream(int      nthreads,      /* no. threads */
+                         dataset *first,         /* in: the first batch */
+                         int      isBinaryFile,  /* streamed file format */
+                         int      numCoords,     /* no. features */
+                         int      numObjs,       /* no. objects */
+                         int      numClusters,   /* no. clusters */
+                         float  **clustersInit,  /* init value for cluster */
+                         int      batchSize,     /* no. objects per batch */
+                         int     *membership,    /* out: [numObjs] */
+                         int     *loop_iterations)
+{
+    int       i, j, n, loop;
+    float   **clusters;       /* out: [numClusters][numCoords] */
+    double   *seen;           /* [numClusters] no. objects seen per center */
+    float   **rows;           /* [batchSize] rows of the current batch */
+    float    *dist;           /* [batchSize] distances to the nearest center */
+    dataset  *buf;            /* [batchSize] objects read from the file */
+
+    if (batchSize > numObjs) batchSize = numObjs;
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    for (i=0; i<numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            clusters[i][j] = clustersInit[i][j];
+
+    seen = (double*) calloc(numClusters, sizeof(double));
+    assert(seen != NULL);
+    dist = (float*)  malloc(batchSize * sizeof(float));
+    assert(dist != NULL);
+    buf  = dataset_alloc(batchSize, numCoords);
+
+    kernels_init();
+
+    rows = first->rows;
+    n    = batchSize;
+    for (i=0, loop=0; i<numObjs; i+=n, loop++) {
+        if (i > 0) {
+            n = file_read_rows(isBinaryFile, buf, 0,
+                               (numObjs - i < batchSize) ? numObjs - i
+                                                         : batchSize);
+            if (n <= 0) break;   /* the stream ended early */
+            rows = buf->rows;
+        }
+        batch_step(nthreads, rows, n, numCoords, numClusters, clusters, seen,
+                   membership + i, dist);
+
+        if (_debug) {
+            double sum = 0.0;
+            for (j=0; j<n; j++) sum += dist[j];
+            printf("batch %d: mean distance = %f\n", loop, sum / n);
+        }
+    }
+    *loop_iterations = loop;
+
+    free(seen);
+    free(dist);
+    dataset_free(buf);
+
+    return clusters;
+}
@@ -7,6 +7,7 @@
 /*                 binary file: first 4-byte integer is the number of data   */
 /*                 objects and 2nd integer is the no. of features (or        */
 /*                 coordinates) of each object                               */
+/*                 chunked file: see chunk_io.c                              */
 /*                                                                           */
 /*   Author:  Wei-keng Liao                                                  */
 /*            ECE Department Northwestern University                         */
@@ -24,13 +25,13 @@
 
 
 /*---< mpi_read() >----------------------------------------------------------*/
-float** mpi_read(int       isBinaryFile,  /* flag: 0 or 1 */
+dataset* mpi_read(int       isBinaryFile,  /* flag: 0 or 1 */
                  char     *filename,      /* input file name */
                  int      *numObjs,       /* no. data objects (local) */
                  int      *numCoords,     /* no. coordinates */
                  MPI_Comm  comm)
 {
-    float    **objects;
+    dataset   *ds = NULL;
     int        i, j, len, divd, rem;
     int        rank, nproc;
     MPI_Status status;
@@ -38,7 +39,25 @@ float** mpi_read(int       isBinaryFile,  /* flag: 0 or 1 */
     MPI_Comm_rank(comm, &rank);
     MPI_Comm_size(comm, &nproc);
 
-    if (isBinaryFile) {  /* using MPI-IO to read file concurrently */
+    if (isBinaryFile && chunk_open(filename, numObjs, numCoords)) {
+        /* chunked file: each process reads its own objects, found through
+           the chunk offsets */
+        divd = (*numObjs) / nproc;
+        rem  = (*numObjs) % nproc;
+        len  = (rank < rem) ? rank*(divd+1) : rank*divd + rem;
+        (*numObjs) = (rank < rem) ? divd+1 : divd;
+
+        ds = dataset_alloc(*numObjs, *numCoords);
+        chunk_seek(len);
+        i = chunk_read_rows(ds, 0, *numObjs);
+        chunk_close();
+        if (i != *numObjs) {
+            printf("Error: file format (%s)\n",filename);
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+    else if (isBinaryFile) {  /* using MPI-IO to read file concurrently */
         int            err;
         MPI_Offset     disp;
         MPI_Datatype   filetype;
@@ -73,12 +92,7 @@ float** mpi_read(int       isBinaryFile,  /* flag: 0 or 1 */
         (*numObjs) = (rank < rem) ? divd+1 : divd;
 
         /* allocate space for data points */
-        objects    = (float**)malloc((*numObjs)              * sizeof(float*));
-        assert(objects != NULL);
-        objects[0] = (float*) malloc((*numObjs)*(*numCoords) * sizeof(float));
-        assert(objects[0] != NULL);
-        for (i=1; i<(*numObjs); i++)
-            objects[i] = objects[i-1] + (*numCoords);
+        ds = dataset_alloc(*numObjs, *numCoords);
 
         /* define a file type for file view */
         MPI_Type_contiguous((*numObjs), MPI_FLOAT, &filetype);
@@ -86,7 +100,7 @@ float** mpi_read(int       isBinaryFile,  /* flag: 0 or 1 */
 
         MPI_File_set_view(fh, disp, MPI_FLOAT, filetype, "native",
                           MPI_INFO_NULL);
-        MPI_File_read_all(fh, objects[0], (*numObjs)*(*numCoords),
+        MPI_File_read_all(fh, ds->data, (*numObjs)*(*numCoords),
                           MPI_FLOAT, &status);
         MPI_Type_free(&filetype);
         MPI_File_close(&fh);
@@ -95,9 +109,9 @@ float** mpi_read(int       isBinaryFile,  /* flag: 0 or 1 */
         if (rank == 0) {
 			    /* read data points from file ------------------------------------------*/
 			file_read_head(0, filename, numObjs, numCoords);
-			objects = file_read_block(0, filename, *numObjs, *numCoords);
+			ds = file_read_block(0, filename, *numObjs, *numCoords);
 			file_read_close(isBinaryFile);
-            if (objects == NULL) *numObjs = -1;
+            if (ds == NULL) *numObjs = -1;
         }
 
         /* broadcast global numObjs and numCoords to the rest proc */
@@ -113,44 +127,41 @@ float** mpi_read(int       isBinaryFile,  /* flag: 0 or 1 */
         rem  = (*numObjs) % nproc;
 
         if (rank == 0) {
-            int index = (rem > 0) ? divd+1 : divd;
+            int      index = (rem > 0) ? divd+1 : divd;
+            dataset *local;
 
+            assert(ds != NULL);
             /* index is the numObjs partitioned locally in proc 0 */
             (*numObjs) = index;
 
             /* distribute objects[] to other processes */
             for (i=1; i<nproc; i++) {
                 int msg_size = (i < rem) ? (divd+1) : divd;
-                MPI_Send(objects[index], msg_size*(*numCoords), MPI_FLOAT,
+                MPI_Send(ds->rows[index], msg_size*(*numCoords), MPI_FLOAT,
                          i, i, comm);
                 index += msg_size;
             }
 
             /* reduce the objects[] to local size */
-            objects[0] = realloc(objects[0],
-                                 (*numObjs)*(*numCoords)*sizeof(float));
-            assert(objects[0] != NULL);
-            objects    = realloc(objects, (*numObjs)*sizeof(float*));
-            assert(objects != NULL);
+            local = dataset_alloc(*numObjs, *numCoords);
+            memcpy(local->data, ds->data,
+                   (size_t)(*numObjs) * (*numCoords) * sizeof(float));
+            dataset_free(ds);
+            ds = local;
         }
         else {
             /*  local numObjs */
             (*numObjs) = (rank < rem) ? divd+1 : divd;
 
             /* allocate space for data points */
-            objects    = (float**)malloc((*numObjs)            *sizeof(float*));
-            assert(objects != NULL);
-            objects[0] = (float*) malloc((*numObjs)*(*numCoords)*sizeof(float));
-            assert(objects[0] != NULL);
-            for (i=1; i<(*numObjs); i++)
-                objects[i] = objects[i-1] + (*numCoords);
-
-            MPI_Recv(objects[0], (*numObjs)*(*numCoords), MPI_FLOAT, 0,
+            ds = dataset_alloc(*numObjs, *numCoords);
+
+            MPI_Recv(ds->data, (*numObjs)*(*numCoords), MPI_FLOAT, 0,
                      rank, comm, &status);
         }
     }
 
-    return objects;
+    return ds;
 }
 
 
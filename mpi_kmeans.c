@@ -19,52 +19,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #include <mpi.h>
 #include "kmeans.h"
 
 
-/*----< euclid_dist_2() >----------------------------------------------------*/
-/* square of Euclid distance between two multi-dimensional points            */
-__inline static
-float euclid_dist_2(int    numdims,  /* no. dimensions */
-                    float *coord1,   /* [numdims] */
-                    float *coord2)   /* [numdims] */
-{
-    int i;
-    float ans=0.0;
-
-    for (i=0; i<numdims; i++)
-        ans += (coord1[i]-coord2[i]) * (coord1[i]-coord2[i]);
-
-    return(ans);
-}
-
-/*----< find_nearest_cluster() >---------------------------------------------*/
-__inline static
-int find_nearest_cluster(int     numClusters, /* no. clusters */
-                         int     numCoords,   /* no. coordinates */
-                         float  *object,      /* [numCoords] */
-                         float **clusters)    /* [numClusters][numCoords] */
-{
-    int   index, i;
-    float dist, min_dist;
-
-    /* find the cluster id that has min distance to object */
-    index    = 0;
-    min_dist = euclid_dist_2(numCoords, object, clusters[0]);
-
-    for (i=1; i<numClusters; i++) {
-        dist = euclid_dist_2(numCoords, object, clusters[i]);
-        /* no need square root */
-        if (dist < min_dist) { /* find the min and its array index */
-            min_dist = dist;
-            index    = i;
-        }
-    }
-    return(index);
-}
-
 /*----< mpi_kmeans() >-------------------------------------------------------*/
 int mpi_kmeans(float    **objects,     /* in: [numObjs][numCoords] */
                int        numCoords,   /* no. coordinates */
@@ -81,26 +42,40 @@ int mpi_kmeans(float    **objects,     /* in: [numObjs][numCoords] */
     int     *clusterSize;    /* [numClusters]: temp buffer for Allreduce */
     float    delta;          /* % of objects change their clusters */
     float    delta_tmp;
-    float  **newClusters;    /* [numClusters][numCoords] */
+    float   *dist;           /* [GEMM_BLOCK] distances to the nearest
+                                center, unused */
+    int     *nearest;        /* [GEMM_BLOCK] nearest center of a block */
+    double **newClusters;    /* [numClusters][numCoords] local running sums */
+    double  *clusterSum;     /* [numClusters][numCoords]: temp buffer for
+                                Allreduce */
     extern int _debug;
 
     if (_debug) MPI_Comm_rank(comm, &rank);
 
+    kernels_init();
+
     /* initialize membership[] */
     for (i=0; i<numObjs; i++) membership[i] = -1;
 
+    dist    = (float*) malloc(GEMM_BLOCK * sizeof(float));
+    assert(dist != NULL);
+    nearest = (int*)   malloc(GEMM_BLOCK * sizeof(int));
+    assert(nearest != NULL);
+
     /* need to initialize newClusterSize and newClusters[0] to all 0 */
     newClusterSize = (int*) calloc(numClusters, sizeof(int));
     assert(newClusterSize != NULL);
     clusterSize    = (int*) calloc(numClusters, sizeof(int));
     assert(clusterSize != NULL);
 
-    newClusters    = (float**) malloc(numClusters *            sizeof(float*));
+    newClusters    = (double**) malloc(numClusters *            sizeof(double*));
     assert(newClusters != NULL);
-    newClusters[0] = (float*)  calloc(numClusters * numCoords, sizeof(float));
+    newClusters[0] = (double*)  calloc(numClusters * numCoords, sizeof(double));
     assert(newClusters[0] != NULL);
     for (i=1; i<numClusters; i++)
         newClusters[i] = newClusters[i-1] + numCoords;
+    clusterSum     = (double*)  malloc(numClusters * numCoords * sizeof(double));
+    assert(clusterSum != NULL);
 
     MPI_Allreduce(&numObjs, &total_numObjs, 1, MPI_INT, MPI_SUM, comm);
     if (_debug) printf("%2d: numObjs=%d total_numObjs=%d numClusters=%d numCoords=%d\n",rank,numObjs,total_numObjs,numClusters,numCoords);
@@ -109,36 +84,51 @@ int mpi_kmeans(float    **objects,     /* in: [numObjs][numCoords] */
         double curT = MPI_Wtime();
         delta = 0.0;
         for (i=0; i<numObjs; i++) {
-            /* find the array index of nestest cluster center */
-            index = find_nearest_cluster(numClusters, numCoords, objects[i],
-                                         clusters);
+            /* find the array index of nestest cluster center, a block of
+               objects at a time */
+            if (i % GEMM_BLOCK == 0)
+                find_nearest_clusters((numObjs - i < GEMM_BLOCK) ? numObjs - i
+                                                                 : GEMM_BLOCK,
+                                      numCoords, objects + i, numClusters,
+                                      clusters, nearest, dist);
+            index = nearest[i % GEMM_BLOCK];
 
             /* if membership changes, increase delta by 1 */
-            if (membership[i] != index) delta += 1.0;
-
-            /* assign the membership to object i */
-            membership[i] = index;
+            if (membership[i] == index) continue;
+            delta += 1.0;
 
-            /* update new cluster centers : sum of objects located within */
+            /* update new cluster centers : move object i from the local sum
+               of its old cluster to the sum of the new one */
+            if (membership[i] >= 0) {
+                newClusterSize[membership[i]]--;
+                for (j=0; j<numCoords; j++)
+                    newClusters[membership[i]][j] -= objects[i][j];
+            }
             newClusterSize[index]++;
             for (j=0; j<numCoords; j++)
                 newClusters[index][j] += objects[i][j];
+
+            /* assign the membership to object i */
+            membership[i] = index;
         }
 
-        /* sum all data objects in newClusters */
-        MPI_Allreduce(newClusters[0], clusters[0], numClusters*numCoords,
-                      MPI_FLOAT, MPI_SUM, comm);
+        /* sum the local sums of all processes, they are kept locally for
+           the next loop */
+        MPI_Allreduce(newClusters[0], clusterSum, numClusters*numCoords,
+                      MPI_DOUBLE, MPI_SUM, comm);
         MPI_Allreduce(newClusterSize, clusterSize, numClusters, MPI_INT,
                       MPI_SUM, comm);
 
-        /* average the sum and replace old cluster centers with newClusters */
+        /* average the sum and replace old cluster centers with it, empty
+           clusters keep their position */
         for (i=0; i<numClusters; i++) {
             for (j=0; j<numCoords; j++) {
-                if (clusterSize[i] > 1)
-                    clusters[i][j] /= clusterSize[i];
-                newClusters[i][j] = 0.0;   /* set back to 0 */
+                if (clusterSize[i] > 0)
+                    clusters[i][j] = clusterSum[i*numCoords + j] /
+                                     clusterSize[i];
+                if (newClusterSize[i] == 0)
+                    newClusters[i][j] = 0.0;   /* drop rounding residue */
             }
-            newClusterSize[i] = 0;   /* set back to 0 */
         }
             
         MPI_Allreduce(&delta, &delta_tmp, 1, MPI_FLOAT, MPI_SUM, comm);
@@ -156,9 +146,138 @@ int mpi_kmeans(float    **objects,     /* in: [numObjs][numCoords] */
 
     free(newClusters[0]);
     free(newClusters);
+    free(clusterSum);
     free(newClusterSize);
     free(clusterSize);
+    free(dist);
+    free(nearest);
 
     return 1;
 }
 
+
+
+/*----< mpi_kpar_init() >----------------------------------------------------*/
+/* k-means|| seeding (see seeding.c) of the objects spread over the          */
+/* processes of comm. The costs and the weights are summed by MPI_Allreduce  */
+/* and the samples of all processes are gathered on all of them in rank      */
+/* order, so every process holds the same candidates and, from the same      */
+/* seed, computes the same numClusters centers                               */
+void mpi_kpar_init(float    **objects,     /* in: [numObjs][numCoords] */
+                   int        numCoords,   /* no. coordinates */
+                   int        numObjs,     /* no. local objects */
+                   int        numClusters, /* no. clusters */
+                   float    **clusters,    /* out: [numClusters][numCoords] */
+                   MPI_Comm   comm)        /* MPI communicator */
+{
+    int                 i, p, r, rank, nproc, owner;
+    int                 numCand, numNew, maxCand, totalNew;
+    int                *numObjsAll;   /* [nproc] no. objects per process */
+    int                *counts;       /* [nproc] floats gathered per process */
+    int                *displs;       /* [nproc] */
+    long long           g, totalObjs = 0;
+    double              cost, localCost, ell;
+    float              *dist;         /* [numObjs] D^2 to nearest candidate */
+    int                *near;         /* [numObjs] nearest candidate */
+    unsigned char      *pick;         /* [numObjs] drawn in this round */
+    float              *sendBuf;      /* local samples of a round */
+    float             **cand;         /* [maxCand][numCoords] candidates */
+    double             *localWeight, *weight;   /* [numCand] */
+    unsigned long long  seed, state;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nproc);
+
+    /* the same generator on all processes, the samples of a process are
+       drawn from streams of its own rank */
+    if (rank == 0) seed = seed_state();
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, comm);
+    state = seed;
+    ell   = (double)KPAR_OVERSAMPLE * numClusters;
+
+    numObjsAll = (int*) malloc(3 * nproc * sizeof(int));
+    assert(numObjsAll != NULL);
+    counts = numObjsAll + nproc;
+    displs = counts + nproc;
+    MPI_Allgather(&numObjs, 1, MPI_INT, numObjsAll, 1, MPI_INT, comm);
+    for (p=0; p<nproc; p++) totalObjs += numObjsAll[p];
+
+    dist = (float*)         malloc((numObjs > 0 ? numObjs : 1) * sizeof(float));
+    assert(dist != NULL);
+    near = (int*)           malloc((numObjs > 0 ? numObjs : 1) * sizeof(int));
+    assert(near != NULL);
+    pick = (unsigned char*) malloc(numObjs > 0 ? numObjs : 1);
+    assert(pick != NULL);
+    for (i=0; i<numObjs; i++) {
+        dist[i] = INFINITY;
+        near[i] = -1;
+    }
+
+    maxCand = 1 + KPAR_ROUNDS * (int)(2 * ell);
+    if (maxCand > totalObjs) maxCand = (int)totalObjs;
+    malloc2D(cand, maxCand, numCoords, float);
+
+    kernels_init();
+
+    /* first candidate: one object drawn uniformly among all processes */
+    g = (long long)(seed_random(&state) * totalObjs);
+    for (owner=0; g >= numObjsAll[owner]; owner++) g -= numObjsAll[owner];
+    if (rank == owner)
+        memcpy(cand[0], objects[g], numCoords * sizeof(float));
+    MPI_Bcast(cand[0], numCoords, MPI_FLOAT, owner, comm);
+    numCand = 1;
+    localCost = kpar_update(1, objects, numCoords, numObjs, cand, 0, 1, dist,
+                            near);
+    MPI_Allreduce(&localCost, &cost, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+    for (r=0; r<KPAR_ROUNDS && cost > 0.0; r++) {
+        numNew = kpar_sample(1, numObjs, dist, cost, ell, seed, r, rank, pick);
+        MPI_Allgather(&numNew, 1, MPI_INT, counts, 1, MPI_INT, comm);
+        for (p=0, totalNew=0; p<nproc; p++) {
+            displs[p]  = totalNew * numCoords;
+            totalNew  += counts[p];
+            counts[p] *= numCoords;
+        }
+        if (numCand + totalNew > maxCand) {   /* unlikely many samples */
+            maxCand = numCand + totalNew;
+            cand    = kpar_grow(cand, numCoords, maxCand);
+        }
+
+        sendBuf = (float*) malloc(((size_t)numNew * numCoords + 1) *
+                                  sizeof(float));
+        assert(sendBuf != NULL);
+        for (i=0, numNew=0; i<numObjs; i++)
+            if (pick[i])
+                memcpy(sendBuf + (size_t)numNew++ * numCoords, objects[i],
+                       numCoords * sizeof(float));
+        MPI_Allgatherv(sendBuf, numNew * numCoords, MPI_FLOAT, cand[numCand],
+                       counts, displs, MPI_FLOAT, comm);
+        free(sendBuf);
+
+        localCost = kpar_update(1, objects, numCoords, numObjs, cand, numCand,
+                                totalNew, dist, near);
+        MPI_Allreduce(&localCost, &cost, 1, MPI_DOUBLE, MPI_SUM, comm);
+        numCand += totalNew;
+        if (_debug && rank == 0)
+            printf("[k-means||] round %d: %d candidates, cost %g\n", r + 1,
+                   numCand, cost);
+    }
+
+    /* weight of a candidate: no. objects nearest to it, all processes */
+    localWeight = (double*) calloc(2 * numCand, sizeof(double));
+    assert(localWeight != NULL);
+    weight = localWeight + numCand;
+    for (i=0; i<numObjs; i++) localWeight[near[i]] += 1.0;
+    MPI_Allreduce(localWeight, weight, numCand, MPI_DOUBLE, MPI_SUM, comm);
+
+    kpp_weighted(1, cand, weight, numCand, numCoords, numClusters, &state,
+                 clusters);
+
+    free(numObjsAll);
+    free(dist);
+    free(near);
+    free(pick);
+    free(cand[0]);
+    free(cand);
+    free(localWeight);
+}
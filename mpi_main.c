@@ -29,7 +29,8 @@ int      _debug;
 #include "kmeans.h"
 
 int     mpi_kmeans(float**, int, int, int, float, int*, float**, MPI_Comm);
-float** mpi_read(int, char*, int*, int*, MPI_Comm);
+void    mpi_kpar_init(float**, int, int, int, float**, MPI_Comm);
+dataset* mpi_read(int, char*, int*, int*, MPI_Comm);
 int     mpi_write(int, char*, int, int, int, float**, int*, int, MPI_Comm);
 
 
@@ -43,6 +44,8 @@ static void usage(char *argv0, float threshold) {
         "       -r             : output file in binary format (default no)\n"
         "       -n num_clusters: number of clusters (K must > 1)\n"
         "       -t threshold   : threshold value (default %.4f)\n"
+        "       -c imethod     : initial centers (default 0)\n"
+        "                        0: first objects, 2: k-means||\n"
         "       -o             : output timing results (default no)\n"
         "       -d             : enable debug mode\n";
     fprintf(stderr, help, argv0, threshold);
@@ -56,11 +59,13 @@ int main(int argc, char **argv) {
            int     i, j;
            int     isInFileBinary, isOutFileBinary;
            int     is_output_timing, is_print_usage;
+           int     imethod;       /* initial centers */
 
            int     numClusters, numCoords, numObjs, totalNumObjs;
            int    *membership;    /* [numObjs] */
            char   *filename;
-           float **objects;       /* [numObjs][numCoords] data objects */
+           dataset *data;         /* local block of objects */
+           float **objects;       /* [numObjs][numCoords] data->rows */
            float **clusters;      /* [numClusters][numCoords] cluster center */
            float   threshold;
            double  timing, io_timing, clustering_timing;
@@ -83,9 +88,10 @@ int main(int argc, char **argv) {
     isOutFileBinary  = 0;
     is_output_timing = 0;
     is_print_usage   = 0;
+    imethod          = 0;
     filename         = NULL;
 
-    while ( (opt=getopt(argc,argv,"p:i:n:t:abdorh"))!= EOF) {
+    while ( (opt=getopt(argc,argv,"p:i:n:t:c:abdorh"))!= EOF) {
         switch (opt) {
             case 'i': filename=optarg;
                       break;
@@ -97,6 +103,8 @@ int main(int argc, char **argv) {
                       break;
             case 'n': numClusters = atoi(optarg);
                       break;
+            case 'c': imethod = atoi(optarg);
+                      break;
             case 'o': is_output_timing = 1;
                       break;
             case 'd': _debug = 1;
@@ -108,7 +116,8 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (filename == 0 || numClusters <= 1 || is_print_usage == 1) {
+    if (filename == 0 || numClusters <= 1 || is_print_usage == 1 ||
+        (imethod != 0 && imethod != KM_INIT_KPAR)) {
         if (rank == 0) usage(argv[0], threshold);
         MPI_Finalize();
         exit(1);
@@ -120,8 +129,9 @@ int main(int argc, char **argv) {
     io_timing = MPI_Wtime();
 
     /* read data points from file ------------------------------------------*/
-    objects = mpi_read(isInFileBinary, filename, &numObjs, &numCoords,
+    data    = mpi_read(isInFileBinary, filename, &numObjs, &numCoords,
                        MPI_COMM_WORLD);
+    objects = data->rows;
 
     if (_debug) { /* print the first 4 objects' coordinates */
         int num = (numObjs < 4) ? numObjs : 4;
@@ -152,13 +162,21 @@ int main(int argc, char **argv) {
 
     MPI_Allreduce(&numObjs, &totalNumObjs, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
 
-    /* pick first numClusters elements in feature[] as initial cluster centers*/
-    if (rank == 0) {
-        for (i=0; i<numClusters; i++)
-            for (j=0; j<numCoords; j++)
-                clusters[i][j] = objects[i][j];
+    if (imethod == KM_INIT_KPAR)
+        /* k-means|| over the objects of all processes, same on all */
+        mpi_kpar_init(objects, numCoords, numObjs, numClusters, clusters,
+                      MPI_COMM_WORLD);
+    else {
+        /* pick first numClusters elements in feature[] as initial cluster
+           centers */
+        if (rank == 0) {
+            for (i=0; i<numClusters; i++)
+                for (j=0; j<numCoords; j++)
+                    clusters[i][j] = objects[i][j];
+        }
+        MPI_Bcast(clusters[0], numClusters*numCoords, MPI_FLOAT, 0,
+                  MPI_COMM_WORLD);
     }
-    MPI_Bcast(clusters[0], numClusters*numCoords, MPI_FLOAT, 0, MPI_COMM_WORLD);
 
     /* membership: the cluster id for each data object */
     membership = (int*) malloc(numObjs * sizeof(int));
@@ -168,8 +186,7 @@ int main(int argc, char **argv) {
     mpi_kmeans(objects, numCoords, numObjs, numClusters, threshold, membership,
                clusters, MPI_COMM_WORLD);
 
-    free(objects[0]);
-    free(objects);
+    dataset_free(data);
 
     timing            = MPI_Wtime();
     clustering_timing = timing - clustering_timing;
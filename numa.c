@@ -0,0 +1,221 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         numa.c                                                    */
+/*   Description:  NUMA placement for the OpenMP version (omp_main -N -P).   */
+/*                 A page lives on the node of the thread that first writes  */
+/*                 it, so a block read by one thread sits on one node and    */
+/*                 the threads of the other nodes read it remotely in every  */
+/*                 loop. numa_alloc_block() has each thread zero the blocks  */
+/*                 of GEMM_BLOCK objects it gets from the static schedule of */
+/*                 omp_kmeans() before the file is read into them.           */
+/*                 numa_init() can pin the threads, spread over the nodes in */
+/*                 order, so that a thread and its pages stay on one node.   */
+/*                 The node layout comes from /sys/devices/system/node; when */
+/*                 it is missing everything runs as a single node.           */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE   /* sched_setaffinity(), sched_getcpu() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+#define MAX_NODES    64   /* highest node no. looked for, plus one */
+#define NUM_SWEEPS    3   /* numa_bandwidth() keeps the best of the sweeps */
+
+static int numNodes = 1;
+static int numCpus  = 0;                /* no. cpus usable by the process */
+static int cpuOrder[CPU_SETSIZE];       /* usable cpus, sorted by node */
+static int nodeOfCpu[CPU_SETSIZE];      /* node of each cpu */
+
+
+/*----< numa_init() >--------------------------------------------------------*/
+/* read the cpus of every node and, if pin, bind OpenMP thread t of a team   */
+/* of n threads to cpu t * numCpus / n in node order: consecutive threads,   */
+/* which get consecutive objects, share a node and all nodes are used. The   */
+/* binding holds for the later parallel regions as long as the no. threads   */
+/* does not change. Return the no. nodes                                     */
+int numa_init(int pin)
+{
+    int        n, c, first, last;
+    char       path[64], list[4096], *p;
+    cpu_set_t  allowed;
+    FILE      *fp;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        for (c=0; c<CPU_SETSIZE; c++) CPU_SET(c, &allowed);
+
+    for (c=0; c<CPU_SETSIZE; c++) nodeOfCpu[c] = 0;
+    numNodes = 0;
+    numCpus  = 0;
+    for (n=0; n<MAX_NODES; n++) {
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", n);
+        if ((fp = fopen(path, "r")) == NULL) continue;
+        if (fgets(list, sizeof(list), fp) == NULL) list[0] = '\0';
+        fclose(fp);
+        numNodes = n + 1;
+
+        /* ranges such as "0-7,16-23" */
+        for (p=list; *p >= '0' && *p <= '9'; p++) {
+            first = last = strtol(p, &p, 10);
+            if (*p == '-') last = strtol(p + 1, &p, 10);
+            for (c=first; c<=last && c<CPU_SETSIZE; c++) {
+                nodeOfCpu[c] = n;
+                if (CPU_ISSET(c, &allowed)) cpuOrder[numCpus++] = c;
+            }
+            if (*p != ',') break;
+        }
+    }
+    if (numNodes == 0) {
+        /* no node information: one node with the usable cpus */
+        numNodes = 1;
+        for (c=0; c<CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &allowed)) cpuOrder[numCpus++] = c;
+    }
+
+    if (pin && numCpus > 0) {
+        #pragma omp parallel
+        {
+            cpu_set_t set;
+            int       t = omp_get_thread_num();
+            int       cpu = cpuOrder[(long)t * numCpus / omp_get_num_threads()];
+
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0 && t == 0)
+                perror("[numa] sched_setaffinity");
+            if (_debug)
+                printf("[numa] thread %d pinned to cpu %d (node %d)\n", t, cpu,
+                       nodeOfCpu[cpu]);
+        }
+    }
+
+    if (_debug)
+        printf("[numa] %d node(s), %d usable cpu(s)\n", numNodes, numCpus);
+
+    return numNodes;
+}
+
+/*----< numa_nodes() >-------------------------------------------------------*/
+int numa_nodes(void)
+{
+    return numNodes;
+}
+
+/*----< numa_alloc_block() >-------------------------------------------------*/
+/* as dataset_alloc(), but the pages of the block are first touched by the   */
+/* threads that will process them in omp_kmeans()                            */
+dataset* numa_alloc_block(int numObjs,
+                          int numCoords)
+{
+    int      b;
+    int      numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+    dataset *ds;
+
+    ds = dataset_create(numObjs, numCoords);
+    if (numObjs == 0) ds->rows[0] = ds->data;
+
+    /* same blocks and schedule as the assignment loop of omp_kmeans() */
+    #pragma omp parallel for private(b) schedule(static)
+    for (b=0; b<numBlocks; b++) {
+        int i, start = b * GEMM_BLOCK;
+        int end = (start + GEMM_BLOCK < numObjs) ? start + GEMM_BLOCK : numObjs;
+        memset(ds->data + (size_t)start * numCoords, 0,
+               (size_t)(end - start) * numCoords * sizeof(float));
+        for (i=start; i<end; i++)
+            ds->rows[i] = ds->data + (size_t)i * numCoords;
+    }
+
+    return ds;
+}
+
+/*----< numa_read_block() >--------------------------------------------------*/
+/* as file_read_block(), in a block from numa_alloc_block()                  */
+dataset* numa_read_block(int   isBinaryFile,  /* flag: 0 or 1 */
+                         char *filename,      /* input file name */
+                         int   numObjs,       /* no. data objects (local) */
+                         int   numCoords)     /* no. coordinates */
+{
+    dataset *ds;
+
+    if (_debug)
+        printf("\n[numa] read a block of %ix%i objects from %s\n", numObjs,
+               numCoords, filename);
+    ds = numa_alloc_block(numObjs, numCoords);
+    file_read_exact(isBinaryFile, ds, 0, numObjs);
+
+    return ds;
+}
+
+/*----< numa_bandwidth() >---------------------------------------------------*/
+/* read all objects with the block schedule of omp_kmeans() and return for   */
+/* each node the bytes its threads read over the time of its slowest thread, */
+/* in GB/s, best of NUM_SWEEPS sweeps. A node without threads gets 0         */
+void numa_bandwidth(int     numObjs,
+                    int     numCoords,
+                    float **objects,   /* [numObjs][numCoords] */
+                    double *bw)        /* out: [numa_nodes()] */
+{
+    int     b, n, t, sweep, nthreads = omp_get_max_threads();
+    int     numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+    int    *node;     /* [nthreads] node the thread ran on */
+    double *bytes;    /* [nthreads] */
+    double *seconds;  /* [nthreads] */
+    double  sink = 0.0;
+
+    node    = (int*)    malloc(nthreads * sizeof(int));
+    assert(node != NULL);
+    bytes   = (double*) malloc(nthreads * sizeof(double));
+    assert(bytes != NULL);
+    seconds = (double*) malloc(nthreads * sizeof(double));
+    assert(seconds != NULL);
+    for (n=0; n<numNodes; n++) bw[n] = 0.0;
+
+    for (sweep=0; sweep<NUM_SWEEPS; sweep++) {
+        for (t=0; t<nthreads; t++) bytes[t] = seconds[t] = 0.0;
+
+        #pragma omp parallel private(b) reduction(+:sink)
+        {
+            int    tid = omp_get_thread_num();
+            int    cpu = sched_getcpu();
+            double start;
+
+            node[tid] = (cpu >= 0 && cpu < CPU_SETSIZE) ? nodeOfCpu[cpu] : 0;
+            #pragma omp barrier
+            start = omp_get_wtime();
+            #pragma omp for schedule(static) nowait
+            for (b=0; b<numBlocks; b++) {
+                int   i, j, s = b * GEMM_BLOCK;
+                int   e = (s + GEMM_BLOCK < numObjs) ? s + GEMM_BLOCK : numObjs;
+                float sum = 0.0;
+                for (i=s; i<e; i++)
+                    for (j=0; j<numCoords; j++)
+                        sum += objects[i][j];
+                sink       += sum;
+                bytes[tid] += (double)(e - s) * numCoords * sizeof(float);
+            }
+            seconds[tid] = omp_get_wtime() - start;
+        }
+
+        for (n=0; n<numNodes; n++) {
+            double nodeBytes = 0.0, nodeSeconds = 0.0;
+            for (t=0; t<nthreads; t++) {
+                if (node[t] != n) continue;
+                nodeBytes += bytes[t];
+                if (seconds[t] > nodeSeconds) nodeSeconds = seconds[t];
+            }
+            if (nodeSeconds > 0.0 && nodeBytes / nodeSeconds / 1e9 > bw[n])
+                bw[n] = nodeBytes / nodeSeconds / 1e9;
+        }
+    }
+    if (_debug) printf("[numa] checksum of the sweeps %g\n", sink);
+
+    free(node);
+    free(bytes);
+    free(seconds);
+}
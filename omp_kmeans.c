@@ -17,60 +17,94 @@
 /*                                                                           */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#define _POSIX_C_SOURCE 200112L   /* posix_memalign() */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <omp.h>
 #include "kmeans.h"
 
+/* round n elements of size bytes up to whole DATA_ALIGN-byte cache lines */
+#define PAD_LINE(n, size) \
+    (((size_t)(n) * (size) + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN / (size))
 
-/*----< euclid_dist_2() >----------------------------------------------------*/
-/* square of Euclid distance between two multi-dimensional points            */
-__inline static
-float euclid_dist_2(int    numdims,  /* no. dimensions */
-                    float *coord1,   /* [numdims] */
-                    float *coord2)   /* [numdims] */
-{
-    int i;
-    float ans=0.0;
-
-    for (i=0; i<numdims; i++)
-        ans += (coord1[i]-coord2[i]) * (coord1[i]-coord2[i]);
 
-    return(ans);
+/*----< omp_kmeans_release() >-----------------------------------------------*/
+/* free the per-thread buffers of w; w can be used again                     */
+void omp_kmeans_release(omp_work *w)
+{
+    free(w->nearest);
+    free(w->nearDist);
+    free(w->localSize);
+    free(w->localSum);
+    w->nearest   = NULL;
+    w->nearDist  = NULL;
+    w->localSize = NULL;
+    w->localSum  = NULL;
+    w->nthreads  = 0;
 }
 
-/*----< find_nearest_cluster() >---------------------------------------------*/
-__inline static
-int find_nearest_cluster(int     numClusters, /* no. clusters */
-                         int     numCoords,   /* no. coordinates */
-						 float  *distance,
-                         float  *object,      /* [numCoords] */
-                         float **clusters)    /* [numClusters][numCoords] */
+/*----< omp_workspace() >----------------------------------------------------*/
+/* make the per-thread buffers of w unless the ones kept fit. Each thread    */
+/* calculates new centers using a private space, then the threads reduce    */
+/* them cluster by cluster. The private spaces are contiguous, aligned and   */
+/* padded to whole cache lines so that no two threads write to the same      */
+/* line; omp_kmeans() leaves them zeroed                                     */
+static void omp_workspace(omp_work *w,
+                          int       nthreads,
+                          int       local,        /* private spaces needed */
+                          int       numClusters,
+                          int       numCoords)
 {
-    int   index, i;
-    float dist, min_dist;
-
-    /* find the cluster id that has min distance to object */
-    index    = 0;
-    min_dist = euclid_dist_2(numCoords, object, clusters[0]);
-
-    for (i=1; i<numClusters; i++) {
-        dist = euclid_dist_2(numCoords, object, clusters[i]);
-        /* no need square root */
-        if (dist < min_dist) { /* find the min and its array index */
-            min_dist = dist;
-            index    = i;
-        }
+    int   i;
+    void *p;
+
+    if (nthreads == w->nthreads && numClusters == w->numClusters &&
+        numCoords == w->numCoords && (!local || w->localSum != NULL))
+        return;
+    omp_kmeans_release(w);
+
+    w->nearest  = (int*)   malloc(nthreads * GEMM_BLOCK * sizeof(int));
+    assert(w->nearest != NULL);
+    w->nearDist = (float*) malloc(nthreads * GEMM_BLOCK * sizeof(float));
+    assert(w->nearDist != NULL);
+    w->nthreads    = nthreads;
+    w->numClusters = numClusters;
+    w->numCoords   = numCoords;
+    if (!local) return;
+
+    w->sizeStride = PAD_LINE(numClusters, sizeof(int));
+    if (posix_memalign(&p, DATA_ALIGN, nthreads * w->sizeStride *
+                                       sizeof(int)) != 0)
+        p = NULL;
+    assert(p != NULL);
+    w->localSize = (int*) p;
+
+    w->sumStride = PAD_LINE((size_t)numClusters * numCoords, sizeof(double));
+    if (posix_memalign(&p, DATA_ALIGN, nthreads * w->sumStride *
+                                       sizeof(double)) != 0)
+        p = NULL;
+    assert(p != NULL);
+    w->localSum = (double*) p;
+
+    /* thread i zeroes space i, which places it on the thread's node */
+    #pragma omp parallel for private(i) schedule(static,1)
+    for (i=0; i<nthreads; i++) {
+        memset(w->localSize + i * w->sizeStride, 0,
+               w->sizeStride * sizeof(int));
+        memset(w->localSum + i * w->sumStride, 0,
+               w->sumStride * sizeof(double));
     }
-   *distance = min_dist;
-    return(index);
 }
 
-
 /*----< kmeans_clustering() >------------------------------------------------*/
-/* return an array of cluster centers of size [numClusters][numCoords]       */
-float** omp_kmeans(int     is_perform_atomic, /* in: */
+/* return an array of cluster centers of size [numClusters][numCoords]. The  */
+/* per-thread buffers are kept in work, NULL to make them for this call only */
+float** omp_kmeans(omp_work *work,            /* in/out: buffers or NULL */
+                   int     is_perform_atomic, /* in: */
+                   int     method,            /* KM_LLOYD, KM_GEMM, ... */
                    float **objects,           /* in: [numObjs][numCoords] */
                    int     numCoords,         /* no. coordinates */
                    int     numObjs,           /* no. objects */
@@ -80,20 +114,50 @@ float** omp_kmeans(int     is_perform_atomic, /* in: */
                    int    *membership,        /* out: [numObjs] */
 				   int    *loop_iterations)
 {
-    int      i, j, k, index, loop=0;
+    int      i, j, k, b, index, loop=0;
+    int      done = 0;       /* convergence, shared by the threads */
     int     *newClusterSize; /* [numClusters]: no. objects assigned in each
                                 new cluster */
     float    delta;          /* % of objects change their clusters */
     float  **clusters;       /* out: [numClusters][numCoords] */
-    float  **newClusters;    /* [numClusters][numCoords] */
-    double   timing;
+    double **newClusters;    /* [numClusters][numCoords] running sums */
+    double   timing = 0.0;
+    omp_work callWork = { 0 };   /* buffers of this call if work is NULL */
 
     int      nthreads;             /* no. threads */
-    int    **local_newClusterSize; /* [nthreads][numClusters] */
-    float ***local_newClusters;    /* [nthreads][numClusters][numCoords] */
 
     nthreads = omp_get_max_threads();
 
+    /* pick the distance kernels before the threads start */
+    kernels_init();
+
+    /* in-memory mini-batches, random objects, default sizes */
+    if (method == KM_MINIBATCH)
+        return minibatch_kmeans(nthreads, objects, 0, numCoords, numObjs,
+                                numClusters, clustersInit, MINIBATCH_SIZE,
+                                MINIBATCH_ITER, 1, membership, loop_iterations);
+
+    /* bound-based methods run their own loop */
+    if (method == KM_ELKAN || method == KM_HAMERLY || method == KM_YINYANG ||
+        method == KM_KDTREE) {
+        for (i=0; i<numObjs; i++) membership[i] = -1;
+        if (method == KM_ELKAN)
+            return elkan_kmeans(nthreads, 500, objects, numCoords, numObjs,
+                                numClusters, clustersInit, threshold,
+                                membership, loop_iterations);
+        if (method == KM_YINYANG)
+            return yinyang_kmeans(nthreads, 500, objects, numCoords, numObjs,
+                                  numClusters, clustersInit, threshold,
+                                  membership, loop_iterations);
+        if (method == KM_KDTREE)
+            return kdtree_kmeans(nthreads, 500, objects, numCoords, numObjs,
+                                 numClusters, clustersInit, threshold,
+                                 membership, loop_iterations);
+        return hamerly_kmeans(nthreads, 500, objects, numCoords, numObjs,
+                              numClusters, clustersInit, threshold,
+                              membership, loop_iterations);
+    }
+
     /* allocate a 2D space for returning variable clusters[] (coordinates
        of cluster centers) */
     clusters    = (float**) malloc(numClusters *             sizeof(float*));
@@ -108,144 +172,177 @@ float** omp_kmeans(int     is_perform_atomic, /* in: */
         for (j=0; j<numCoords; j++)
             clusters[i][j] = clustersInit[i][j];
 
-    /* initialize membership[] */
-    for (i=0; i<numObjs; i++) membership[i] = -1;
-
     /* need to initialize newClusterSize and newClusters[0] to all 0 */
     newClusterSize = (int*) calloc(numClusters, sizeof(int));
     assert(newClusterSize != NULL);
 
-    newClusters    = (float**) malloc(numClusters *            sizeof(float*));
+    newClusters    = (double**) malloc(numClusters *            sizeof(double*));
     assert(newClusters != NULL);
-    newClusters[0] = (float*)  calloc(numClusters * numCoords, sizeof(float));
+    newClusters[0] = (double*)  calloc(numClusters * numCoords, sizeof(double));
     assert(newClusters[0] != NULL);
     for (i=1; i<numClusters; i++)
         newClusters[i] = newClusters[i-1] + numCoords;
 	
-	/* initialize dist */
-	float* dist = (float*) malloc(numObjs * sizeof(float));
-	float totalDistance = 0.0;
-
-    if (!is_perform_atomic) {
-        /* each thread calculates new centers using a private space,
-           then thread 0 does an array reduction on them. This approach
-           should be faster */
-        local_newClusterSize    = (int**) malloc(nthreads * sizeof(int*));
-        assert(local_newClusterSize != NULL);
-        local_newClusterSize[0] = (int*)  calloc(nthreads*numClusters,
-                                                 sizeof(int));
-        assert(local_newClusterSize[0] != NULL);
-        for (i=1; i<nthreads; i++)
-            local_newClusterSize[i] = local_newClusterSize[i-1]+numClusters;
-
-        /* local_newClusters is a 3D array */
-        local_newClusters    =(float***)malloc(nthreads * sizeof(float**));
-        assert(local_newClusters != NULL);
-        local_newClusters[0] =(float**) malloc(nthreads * numClusters *
-                                               sizeof(float*));
-        assert(local_newClusters[0] != NULL);
-        for (i=1; i<nthreads; i++)
-            local_newClusters[i] = local_newClusters[i-1] + numClusters;
-        for (i=0; i<nthreads; i++) {
-            for (j=0; j<numClusters; j++) {
-                local_newClusters[i][j] = (float*)calloc(numCoords,
-                                                         sizeof(float));
-                assert(local_newClusters[i][j] != NULL);
-            }
-        }
+    double   totalDistance;  /* sum of the distances to the centers */
+
+    /* objects are distributed in blocks of GEMM_BLOCK so that the blocked
+       assignment can work on whole blocks; object norms are computed once */
+    int    numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+    float *objNorms  = NULL;  /* [numObjs] */
+    float *packed    = NULL;  /* centers packed by gemm_pack() */
+    if (method == KM_GEMM) {
+        objNorms = (float*) malloc(numObjs * sizeof(float));
+        assert(objNorms != NULL);
+        packed   = (float*) malloc(gemm_packed_size(numClusters, numCoords) *
+                                   sizeof(float));
+        assert(packed != NULL);
     }
+    if (work == NULL) work = &callWork;
+    omp_workspace(work, nthreads, !is_perform_atomic, numClusters, numCoords);
 
     if (_debug) timing = omp_get_wtime();
-    do {
-        delta = 0.0;
-
-        if (is_perform_atomic) {
-            #pragma omp parallel for \
-                    private(i,j,index) \
-                    firstprivate(numObjs,numClusters,numCoords) \
-                    shared(objects,clusters,membership,newClusters,newClusterSize) \
-                    schedule(static) \
-                    reduction(+:delta)
-            for (i=0; i<numObjs; i++) {
-                /* find the array index of nestest cluster center */
-                index = find_nearest_cluster(numClusters, numCoords, &dist[i],
-						objects[i], clusters);
-
-                /* if membership changes, increase delta by 1 */
-                if (membership[i] != index) delta += 1.0;
-
-                /* assign the membership to object i */
-                membership[i] = index;
-
-                /* update new cluster centers : sum of objects located within */
-                #pragma omp atomic
-                newClusterSize[index]++;
-                for (j=0; j<numCoords; j++)
-                    #pragma omp atomic
-                    newClusters[index][j] += objects[i][j];
-            }
+    delta         = 0.0;
+    totalDistance = 0.0;
+    if (method == KM_GEMM)
+        gemm_pack(numClusters, numCoords, clusters, packed);
+
+    /* one parallel region for the whole run: the serial steps of a loop are
+       done by one thread between barriers, so the threads are only forked
+       once per call */
+    #pragma omp parallel num_threads(nthreads) private(b,i,j,k,index) \
+            shared(objects,clusters,membership,newClusters,newClusterSize, \
+                   delta,totalDistance,loop,done)
+    {
+        int     tid    = omp_get_thread_num();
+        int    *near   = work->nearest  + tid * GEMM_BLOCK;
+        float  *dist   = work->nearDist + tid * GEMM_BLOCK;
+        int    *mySize = NULL;
+        double *mySum  = NULL;
+        if (!is_perform_atomic) {
+            mySize = work->localSize + tid * work->sizeStride;
+            mySum  = work->localSum  + tid * work->sumStride;
         }
-        else {
-            #pragma omp parallel \
-                    shared(objects,clusters,membership,local_newClusters,local_newClusterSize)
-            {
-                int tid = omp_get_thread_num();
-                #pragma omp for \
-                            private(i,j,index) \
-                            firstprivate(numObjs,numClusters,numCoords) \
-                            schedule(static) \
-                            reduction(+:delta)
-                for (i=0; i<numObjs; i++) {
-                    /* find the array index of nestest cluster center */
-                    index = find_nearest_cluster(numClusters, numCoords, &dist[i],
-						objects[i], clusters);
+
+        /* initialize membership[] (and the object norms) with the schedule
+           of the assignment loop, so that each page is first touched by the
+           thread that uses it */
+        #pragma omp for schedule(static)
+        for (b=0; b<numBlocks; b++) {
+            int start = b * GEMM_BLOCK;
+            int end   = (start + GEMM_BLOCK < numObjs) ? start + GEMM_BLOCK
+                                                       : numObjs;
+            for (i=start; i<end; i++) membership[i] = -1;
+            if (method == KM_GEMM)
+                gemm_norms(end - start, numCoords, objects + start,
+                           objNorms + start);
+        }
+
+        do {
+            #pragma omp for schedule(static) reduction(+:delta,totalDistance)
+            for (b=0; b<numBlocks; b++) {
+                int start = b * GEMM_BLOCK;
+                int end   = (start + GEMM_BLOCK < numObjs) ? start + GEMM_BLOCK
+                                                           : numObjs;
+
+                /* find the array index of nestest cluster centers */
+                if (method == KM_GEMM)
+                    gemm_nearest(end - start, numCoords, objects + start,
+                                 objNorms + start, numClusters, packed, near,
+                                 dist);
+                else
+                    find_nearest_clusters(end - start, numCoords,
+                                          objects + start, numClusters,
+                                          clusters, near, dist);
+
+                for (i=start; i<end; i++) {
+                    int     old = membership[i];
+                    double *s;
+                    index = near[i - start];
+                    totalDistance += dist[i - start];
 
                     /* if membership changes, increase delta by 1 */
-                    if (membership[i] != index) delta += 1.0;
+                    if (old == index) continue;
+                    delta += 1.0;
+
+                    /* update new cluster centers : move object i from the
+                       sum of its old cluster to the sum of the new one,
+                       directly or in the private space of the thread */
+                    if (is_perform_atomic) {
+                        if (old >= 0) {
+                            #pragma omp atomic
+                            newClusterSize[old]--;
+                            for (j=0; j<numCoords; j++)
+                                #pragma omp atomic
+                                newClusters[old][j] -= objects[i][j];
+                        }
+                        #pragma omp atomic
+                        newClusterSize[index]++;
+                        for (j=0; j<numCoords; j++)
+                            #pragma omp atomic
+                            newClusters[index][j] += objects[i][j];
+                    }
+                    else {
+                        if (old >= 0) {
+                            s = mySum + (size_t)old * numCoords;
+                            mySize[old]--;
+                            for (j=0; j<numCoords; j++)
+                                s[j] -= objects[i][j];
+                        }
+                        s = mySum + (size_t)index * numCoords;
+                        mySize[index]++;
+                        for (j=0; j<numCoords; j++)
+                            s[j] += objects[i][j];
+                    }
 
                     /* assign the membership to object i */
                     membership[i] = index;
-
-                    /* update new cluster centers : sum of all objects located
-                       within (average will be performed later) */
-                    local_newClusterSize[tid][index]++;
-                    for (j=0; j<numCoords; j++)
-                        local_newClusters[tid][index][j] += objects[i][j];
                 }
-            } /* end of #pragma omp parallel */
+            }
 
-            /* let the main thread perform the array reduction */
+            /* array reduction and new centers, partitioned by cluster: each
+               thread adds the private sums of all threads, in thread order,
+               for its own clusters, so its cost does not grow with nthreads,
+               then averages them and replaces the old cluster centers; the
+               sums are kept for the next loop */
+            #pragma omp for schedule(static)
             for (i=0; i<numClusters; i++) {
-                for (j=0; j<nthreads; j++) {
-                    newClusterSize[i] += local_newClusterSize[j][i];
-                    local_newClusterSize[j][i] = 0.0;
-                    for (k=0; k<numCoords; k++) {
-                        newClusters[i][k] += local_newClusters[j][i][k];
-                        local_newClusters[j][i][k] = 0.0;
+                if (!is_perform_atomic)
+                    for (j=0; j<nthreads; j++) {
+                        int    *n = work->localSize + j * work->sizeStride + i;
+                        double *s = work->localSum + j * work->sumStride +
+                                    (size_t)i * numCoords;
+                        newClusterSize[i] += *n;
+                        *n = 0;
+                        for (k=0; k<numCoords; k++) {
+                            newClusters[i][k] += s[k];
+                            s[k] = 0.0;
+                        }
                     }
+                for (j=0; j<numCoords; j++) {
+                    if (newClusterSize[i] > 0)
+                        clusters[i][j] = newClusters[i][j] / newClusterSize[i];
+                    else   /* drop rounding residue */
+                        newClusters[i][j] = 0.0;
                 }
             }
-        }
 
-        /* average the sum and replace old cluster centers with newClusters */
-        for (i=0; i<numClusters; i++) {
-            for (j=0; j<numCoords; j++) {
-                if (newClusterSize[i] > 1)
-                    clusters[i][j] = newClusters[i][j] / newClusterSize[i];
-                newClusters[i][j] = 0.0;   /* set back to 0 */
+            /* convergence test and display of the results, then set up
+               the next loop: three barriers per loop in all */
+            #pragma omp single
+            {
+                delta /= numObjs;
+                if (_debug)
+                    printf("Total distance = %f delta = %.3f\n", totalDistance,
+                           delta);
+
+                done = !(delta > threshold && loop++ < 500);
+                delta         = 0.0;
+                totalDistance = 0.0;
+                if (!done && method == KM_GEMM)
+                    gemm_pack(numClusters, numCoords, clusters, packed);
             }
-            newClusterSize[i] = 0;   /* set back to 0 */
-        }
-        
-        /* compute total distance and display results*/
-		totalDistance = 0.0;
-		for (i=0; i<numObjs; i++)
-			totalDistance += dist[i];
-        delta /= numObjs;
-		if (_debug)
-			printf("Total distance = %f delta = %.3f\n", totalDistance, delta);
-		
-    } while (delta > threshold && loop++ < 500);
+        } while (!done);
+    } /* end of #pragma omp parallel */
 	
 	*loop_iterations = loop + 1;
 
@@ -254,19 +351,12 @@ float** omp_kmeans(int     is_perform_atomic, /* in: */
         printf("nloops = %2d (T = %7.4f)",loop,timing);
     }
 
-    if (!is_perform_atomic) {
-        free(local_newClusterSize[0]);
-        free(local_newClusterSize);
-
-        for (i=0; i<nthreads; i++)
-            for (j=0; j<numClusters; j++)
-                free(local_newClusters[i][j]);
-        free(local_newClusters[0]);
-        free(local_newClusters);
-    }
     free(newClusters[0]);
     free(newClusters);
     free(newClusterSize);
+    free(objNorms);
+    free(packed);
+    omp_kmeans_release(&callWork);
 
     return clusters;
 }
@@ -16,44 +16,87 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <math.h>
+#include <omp.h>
 
 int      _debug;
 #include "kmeans.h"
 
-void kmeans (float** objects, float** centroids, int* membership, int numobj,
-				int numcoord, int numcluster, int pmethod, int imethod,
-				int split, int verbose, int save, char* filename)
+/* run one block with the engine selected by pmethod; with numRuns > 1,
+   clustersInit holds numRuns sets of centers and the best run is kept.
+   work holds the buffers of omp_kmeans() from one block to the next */
+static float** cluster_block(omp_work *work, int pmethod, int amethod,
+                             float **objects,
+                             int numCoords, int numObjs, int numClusters,
+                             float **clustersInit, int numRuns,
+                             float threshold, int *membership,
+                             int *loop_iterations)
+{
+	if (numRuns > 1)
+		return restart_kmeans((pmethod == 1) ? omp_get_max_threads() : 1,
+						(pmethod == 1) ? 500 : MAX_ITER, objects, numCoords,
+						numObjs, numClusters, clustersInit, numRuns, threshold,
+						membership, loop_iterations);
+	switch (pmethod) {
+		case 0:  return seq_kmeans(amethod, objects, numCoords, numObjs,
+						numClusters, clustersInit, threshold, membership,
+						loop_iterations);
+		case 1:  return omp_kmeans(work, 0, amethod, objects, numCoords, numObjs,
+						numClusters, clustersInit, threshold, membership,
+						loop_iterations);
+		default: return cuda_kmeans(objects, numCoords, numObjs, numClusters,
+						clustersInit, threshold, membership, loop_iterations);
+	}
+}
+
+void kmeans_ex (float** objects, float** centroids, int* membership,
+				int numobj, int numcoord, int numcluster, int pmethod,
+				int imethod, int amethod, int ninit, int split, int verbose,
+				int save, int binary, char* filename)
 {
 	float **clustersInit, **clusters, **objectsIter;
-	double timing, io_timing, clustering_timing;
-	int  i, j, loop_iterations, splitNumber, iteration, lastObjsIteration;
+	dataset *block;
+	double timing = 0.0, io_timing = 0.0, clustering_timing = 0.0;
+	int  i, j, r, loop_iterations, splitNumber, iteration, lastObjsIteration;
 	int *membershipIteration;
 	float threshold = DELTA_THRESHOLD;
+	omp_work work = { 0 };   /* buffers of omp_kmeans(), kept by block */
 	
 	if (verbose > 1)
 		_debug = 1;
+	kernels_init();   /* before any parallel region */
     if (numcluster <= 1)
 		err("[pkmean] The number of clusters should be larger than 1");
 	if (numobj < 1)
 		err("[pkmean] The number of input points should be greater than 0");
 	if (numcoord < 1)
 		err("[pkmean] The number of coordinates should be greater than 0");
+	if (pmethod < 0 || pmethod > 2)
+		err("[pkmean] Unknown parallelization method %d", pmethod);
+	if (amethod != KM_LLOYD && pmethod == 2)
+		printf("[pkmean] The CUDA version only supports Lloyd's method\n");
+	if (ninit < 1 || (ninit > 1 && (pmethod == 2 || amethod == KM_MINIBATCH))) {
+		if (ninit > 1)
+			printf("[pkmean] Several runs need a CPU method other than "
+				   "mini-batch, making one\n");
+		ninit = 1;
+	}
 		
 
     if (verbose > 0) io_timing = wtime();
 
     /* init membership */
-    membership = (int*) malloc(numobj * sizeof(int));
     assert(membership != NULL);
     for (i=0; i<numobj; i++) membership[i] = -1;
 	
 	/* initialize some other algorithm variables */
+	splitNumber = (split > 0) ? split : 1;
 	int numObjsIteration = numobj / splitNumber;
-	malloc2D(objects, numObjsIteration, numcoord, float);
-    assert(objects != NULL);
-	malloc2D(clustersInit, numcluster, numcoord, float);
+	int maxObjsIteration = numObjsIteration + numobj % splitNumber;
+	block       = dataset_alloc(maxObjsIteration, numcoord);
+	objectsIter = block->rows;
+	malloc2D(clustersInit, ninit * numcluster, numcoord, float);
     assert(clustersInit != NULL);
-	membershipIteration = (int*) malloc(numObjsIteration * sizeof(int));
+	membershipIteration = (int*) malloc(maxObjsIteration * sizeof(int));
     assert(membershipIteration != NULL);
 
     /* start the timer for the core computation */
@@ -63,40 +106,51 @@ void kmeans (float** objects, float** centroids, int* membership, int numobj,
         clustering_timing = timing;
     }
 		
-	/* initialize the cluster vector */
-	if (imethod == 1)
-		cuda_kpp_init(objects, clustersInit, membership, numObjsIteration, numcoord, numcluster);
-	else
-		for (i=0; i<numcluster; i++)
-			for (j=0; j<numcoord; j++)
-				clustersInit[i][j] = objects[rand()%numObjsIteration][rand()%numcoord];
-	if (imethod > 1)
+	/* initialize the cluster vector, one set of numcluster centers per run */
+	for (r=0; r<ninit; r++) {
+		if (imethod == KM_INIT_KPP)
+			kpp_init((pmethod == 1) ? omp_get_max_threads() : 1, objects, numcoord,
+					 numObjsIteration, numcluster, clustersInit + r * numcluster);
+		else if (imethod == KM_INIT_KPAR)
+			kpar_init((pmethod == 1) ? omp_get_max_threads() : 1, objects, numcoord,
+					  numObjsIteration, numcluster, clustersInit + r * numcluster);
+		else
+			for (i=r*numcluster; i<(r+1)*numcluster; i++)
+				for (j=0; j<numcoord; j++)
+					clustersInit[i][j] = objects[rand()%numObjsIteration][rand()%numcoord];
+	}
+	if (imethod > KM_INIT_KPAR)
 		printf("[pkmean] This initialization method does not exist. Using random init");
 
  	/* data splitting to accelerate the process and minimize memory usage ---*/
  	iteration = 0;
  	while ( (iteration * numObjsIteration) < (numobj - numObjsIteration) ) {
- 		if (verbose > 0) printf ("\n[cuda kmean] data block %i - number of objects %i\n", 
+ 		if (verbose > 0) printf ("\n[pkmean] data block %i - number of objects %i\n", 
  				iteration + 1, numObjsIteration);
  		
  		// read data to clusterize
-		memcpy(&objectsIter[0][0], &objects[iteration * numObjsIteration][0],
-				numObjsIteration * numcoord * sizeof(float));
+		for (i=0; i<numObjsIteration; i++)
+			memcpy(objectsIter[i], objects[iteration * numObjsIteration + i],
+					numcoord * sizeof(float));
  		
  		// do clusterisation
- 		clusters = cuda_kmeans(objectsIter, numcoord, numObjsIteration, numcluster,
- 				clustersInit, threshold, membershipIteration, &loop_iterations);
+ 		clusters = cluster_block(&work, pmethod, amethod, objectsIter, numcoord,
+ 				numObjsIteration, numcluster, clustersInit,
+ 				(iteration == 0) ? ninit : 1, threshold,
+ 				membershipIteration, &loop_iterations);
  		
  		// keep the results
  		memcpy(&membership[iteration * numObjsIteration], &membershipIteration[0],
  				numObjsIteration * sizeof(int));
+ 		free(clustersInit[0]);
+ 		free(clustersInit);
  		clustersInit = clusters;
  		
 		// save in case of interruption
 		if (save > 2) {
 			char  tmpFilename[512];
 			sprintf(tmpFilename, "%s.tmp-%i", filename, iteration+1);
-			file_write(tmpFilename, numcluster, numobj, numcoord, clusters,
+			file_write(binary, tmpFilename, numcluster, numobj, numcoord, clusters,
 				membership);
 		}
 		
@@ -105,16 +159,23 @@ void kmeans (float** objects, float** centroids, int* membership, int numobj,
 	
 	/* last iteration -----------------------------------------------------*/
 	lastObjsIteration = numobj - numObjsIteration * iteration;
-	if (verbose > 0) printf ("\n[cuda kmean] data block %i - number of objects %i\n", 
+	if (verbose > 0) printf ("\n[pkmean] data block %i - number of objects %i\n", 
 				iteration + 1, lastObjsIteration);
 	
-	memcpy(&objectsIter[0][0], &objects[iteration * numObjsIteration][0],
-				lastObjsIteration * numcoord * sizeof(float));
-	clusters = cuda_kmeans(objectsIter, numcoord, lastObjsIteration, numcluster,
-			clustersInit, threshold, membershipIteration, &loop_iterations);
+	for (i=0; i<lastObjsIteration; i++)
+		memcpy(objectsIter[i], objects[iteration * numObjsIteration + i],
+				numcoord * sizeof(float));
+	clusters = cluster_block(&work, pmethod, amethod, objectsIter, numcoord,
+			lastObjsIteration, numcluster, clustersInit,
+			(iteration == 0) ? ninit : 1, threshold,
+			membershipIteration, &loop_iterations);
 	memcpy(&membership[iteration * numObjsIteration], &membershipIteration[0],
 			lastObjsIteration * sizeof(int));
 	
+	/* hand the centroids back to the caller */
+	for (i=0; i<numcluster; i++)
+		for (j=0; j<numcoord; j++)
+			centroids[i][j] = clusters[i][j];
 	
 	/* restart io timer ----------------------------------------------------*/
 	 if (verbose > 0) {
@@ -123,18 +184,20 @@ void kmeans (float** objects, float** centroids, int* membership, int numobj,
     }
 
 	/* free memory part 1 --------------------------------------------------*/
-	free(objects);
+	omp_kmeans_release(&work);
+	dataset_free(block);
+	free(clustersInit[0]);
 	free(clustersInit);
 	free(membershipIteration);
 
     /* output: the coordinates of the cluster centres ----------------------*/
-    if (save > 1) file_write(filename, numcluster, numobj, numcoord, clusters,
+    if (save > 0) file_write(binary, filename, numcluster, numobj, numcoord, clusters,
                membership);
 	
 	/*---- output performance numbers --------------------------------------*/
     if (verbose > 0) {
         io_timing += wtime() - timing;
-        printf("\n[cuda kmean] Performances results for cuda k-mean\n");
+        printf("\n[pkmean] Performances results for k-mean\n");
 
 		printf("------------------------------------------\n");
         printf("input file:     %s\n", filename);
@@ -169,12 +232,19 @@ void kmeans (float** objects, float** centroids, int* membership, int numobj,
 		free(yObj);
 		free(xClu);
 		free(yClu);
-		free(objects);
 	}
 	
 	/* free memory part 2 */
+	free(clusters[0]);
 	free(clusters);
-	free(membership);
 
     return;
 }
+
+void kmeans (float** objects, float** centroids, int* membership, int numobj,
+				int numcoord, int numcluster, int pmethod, int imethod,
+				int split, int verbose, int save, char* filename)
+{
+	kmeans_ex(objects, centroids, membership, numobj, numcoord, numcluster,
+			pmethod, imethod, KM_LLOYD, 1, split, verbose, save, 0, filename);
+}
@@ -28,7 +28,12 @@ extern "C" {
 
   void cuda_kpp_init(float**, float**, int*, int, int, int);
 
-  void kmeans (float** objects,		// tab of input data points [numobj][numcoord]
+  /* kmeans_ex() and kmeans() are not reentrant: the kernel selection, the
+     gemm microkernel, the random seeding and mini-batches (rand()), the
+     file readers and writers and the debug flag are process-wide. Call
+     them from one thread at a time; each call may use all the threads */
+
+  void kmeans_ex (float** objects,	// tab of input data points [numobj][numcoord]
 			float** centroids,		// tab of output centroids  [numcluster][numcoord]
 			int* membership,		// tab of output memberships [numobj]
 			int numobj,				// number of input data points
@@ -41,6 +46,18 @@ extern "C" {
 			int imethod,			// centroids init method
 										// 0: random
 										// 1: k++ seeding [https://en.wikipedia.org/wiki/K-means%2B%2B]
+										// 2: k-means|| seeding, few passes, for large k
+			int amethod,			// assignment method (CPU methods only)
+										// 0: Lloyd
+										// 1: blocked gemm, for large k and d
+										// 2: Elkan, same result as Lloyd with fewer distances
+										// 3: Hamerly, as Elkan with 2 bounds per point
+										// 4: Yinyang, as Elkan with k/10 group bounds, large k
+										// 5: kd-tree filtering, low dimension
+										// 6: mini-batch, approximate, 100 batches of 1024
+			int ninit,				// no. runs from different initial centers, the
+									// one of lowest cost is kept (CPU methods only,
+									// Lloyd's iteration, 1 for a single run)
 			int split,			// number of blocks to split sequentially the objects data 
 									// (the more blocks, the fastest but also the less accurate,
 									// especially if the initial distribution is not random)
@@ -53,7 +70,17 @@ extern "C" {
 										// 1: save centroids and membership 
 										// 2: save centroids and membership and .eps graph
 										// 3: save centroids and membership, .eps graph and temp files
+			int binary,				// format of the saved files
+										// 0: text
+										// 1: binary, as mpi_main -r: a count (int) then
+										//    the centroids (float) or memberships (int)
 			char* filename);
+
+  /* the call of version 1.0: kmeans_ex() with Lloyd's method (amethod 0),
+     a single run (ninit 1) and text files (binary 0) */
+  void kmeans (float** objects, float** centroids, int* membership, int numobj,
+			int numcoord, int numcluster, int pmethod, int imethod, int split,
+			int verbose, int save, char* filename);
 #ifdef __cplusplus
 }
 #endif
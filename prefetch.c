@@ -0,0 +1,183 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         prefetch.c                                                */
+/*   Description:  Read-ahead of the blocks of a split data set (option -s). */
+/*                 A reader thread fills a ring of numBuffers blocks with    */
+/*                 the next objects of the open input file while the caller  */
+/*                 clusters the current block, so reading and parsing block  */
+/*                 i+1 overlaps the clustering of block i. The buffers are   */
+/*                 allocated once, by the caller's thread so that NUMA       */
+/*                 placement holds, and refilled. Blocks of a mapped binary  */
+/*                 file (-M) have no buffer: the reader maps the next block  */
+/*                 and touches its pages, which reads them in.               */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>     /* sysconf() */
+#include <pthread.h>
+
+#include "kmeans.h"
+
+struct prefetch {
+    pthread_t        thread;
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;        /* a block was read or released */
+    int              isBinaryFile;
+    char            *filename;
+    int              numObjs;     /* no. objects of all blocks */
+    int              numCoords;
+    int              blockSize;   /* no. objects per block, the last one less */
+    int              numBlocks;
+    int              numBuffers;
+    int              map;         /* map the blocks instead of reading them */
+    dataset        **buf;         /* [numBuffers] block b is in b % numBuffers */
+    int              numRead;     /* no. blocks read by the reader thread */
+    int              numTaken;    /* no. blocks returned by prefetch_next() */
+    int              stop;
+};
+
+
+/*----< reader() >-----------------------------------------------------------*/
+/* read the blocks in order; buffer b % numBuffers is free once the caller   */
+/* has asked for the block after the one it holds                            */
+static
+void* reader(void *arg)
+{
+    prefetch *pf = (prefetch*) arg;
+    int       b, slot, n, stop;
+    dataset  *ds;
+
+    for (b=0; b<pf->numBlocks; b++) {
+        slot = b % pf->numBuffers;
+        n    = (pf->numObjs - b * pf->blockSize < pf->blockSize)
+               ? pf->numObjs - b * pf->blockSize : pf->blockSize;
+
+        pthread_mutex_lock(&pf->lock);
+        while (!pf->stop && b >= pf->numTaken + pf->numBuffers - 1)
+            pthread_cond_wait(&pf->cond, &pf->lock);
+        ds   = pf->buf[slot];
+        stop = pf->stop;
+        pthread_mutex_unlock(&pf->lock);
+        if (stop) break;
+
+        if (pf->map) {
+            size_t i, len, page = sysconf(_SC_PAGESIZE);
+            volatile char sum = 0;
+            dataset_free(ds);
+            ds  = file_map_block(pf->isBinaryFile, pf->filename, n,
+                                 pf->numCoords);
+            len = (size_t)n * pf->numCoords * sizeof(float);
+            for (i=0; i<len; i+=page)
+                sum += ((char*)ds->data)[i];
+        }
+        else {
+            file_read_exact(pf->isBinaryFile, ds, 0, n);
+            ds->numObjs = n;
+            free(ds->soa);   /* the copy of the previous block */
+            ds->soa = NULL;
+        }
+
+        pthread_mutex_lock(&pf->lock);
+        pf->buf[slot] = ds;
+        pf->numRead   = b + 1;
+        pthread_cond_broadcast(&pf->cond);
+        pthread_mutex_unlock(&pf->lock);
+    }
+    return NULL;
+}
+
+/*----< prefetch_start() >---------------------------------------------------*/
+/* start reading the numObjs objects of the file opened by file_read_head(), */
+/* from its current position, in blocks of blockSize objects. alloc makes a  */
+/* buffer (dataset_alloc, numa_alloc_block); with map, blocks of a binary    */
+/* file are mapped instead, see file_map_block(). At most numBuffers blocks  */
+/* are in memory, the one held by the caller included                        */
+prefetch* prefetch_start(int    isBinaryFile,  /* flag: 0 or 1 */
+                         char  *filename,      /* input file name */
+                         int    numObjs,       /* no. objects to read */
+                         int    numCoords,     /* no. coordinates */
+                         int    blockSize,     /* no. objects per block */
+                         int    numBuffers,    /* no. blocks in memory, >= 1 */
+                         dataset* (*alloc)(int, int),
+                         int    map)           /* map a binary file */
+{
+    int       i;
+    prefetch *pf;
+
+    pf = (prefetch*) malloc(sizeof(prefetch));
+    assert(pf != NULL);
+    pf->isBinaryFile = isBinaryFile;
+    pf->filename     = filename;
+    pf->numObjs      = numObjs;
+    pf->numCoords    = numCoords;
+    pf->blockSize    = blockSize;
+    pf->numBlocks    = (blockSize > 0) ? (numObjs + blockSize - 1) / blockSize
+                                       : 0;
+    pf->numBuffers   = (numBuffers < pf->numBlocks) ? numBuffers
+                                                    : pf->numBlocks;
+    if (pf->numBuffers < 1) pf->numBuffers = 1;
+    pf->map          = map && isBinaryFile;
+    pf->numRead      = 0;
+    pf->numTaken     = 0;
+    pf->stop         = 0;
+
+    pf->buf = (dataset**) calloc(pf->numBuffers, sizeof(dataset*));
+    assert(pf->buf != NULL);
+    if (!pf->map)
+        for (i=0; i<pf->numBuffers; i++)
+            pf->buf[i] = alloc(blockSize, numCoords);
+
+    if (_debug)
+        printf("[prefetch] %d blocks of %d objects, %d buffers\n",
+               pf->numBlocks, blockSize, pf->numBuffers);
+
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+    i = pthread_create(&pf->thread, NULL, reader, pf);
+    assert(i == 0);
+
+    return pf;
+}
+
+/*----< prefetch_next() >----------------------------------------------------*/
+/* wait for the next block and return it, or NULL after the last one. The    */
+/* block stays valid until the next call; the previous one is given back to  */
+/* the reader                                                                */
+dataset* prefetch_next(prefetch *pf)
+{
+    dataset *ds = NULL;
+
+    pthread_mutex_lock(&pf->lock);
+    if (pf->numTaken < pf->numBlocks) {
+        pf->numTaken++;
+        pthread_cond_broadcast(&pf->cond);
+        while (pf->numRead < pf->numTaken)
+            pthread_cond_wait(&pf->cond, &pf->lock);
+        ds = pf->buf[(pf->numTaken - 1) % pf->numBuffers];
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    return ds;
+}
+
+/*----< prefetch_stop() >----------------------------------------------------*/
+/* stop the reader and free the blocks, the last one returned included. The  */
+/* file is left open at an unspecified position                              */
+void prefetch_stop(prefetch *pf)
+{
+    int i;
+
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->thread, NULL);
+
+    for (i=0; i<pf->numBuffers; i++)
+        dataset_free(pf->buf[i]);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->cond);
+    free(pf->buf);
+    free(pf);
+}
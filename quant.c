@@ -0,0 +1,487 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         quant.c                                                   */
+/*   Description:  Reduced-precision storage of the objects (-Q of the       */
+/*                 mains): IEEE half floats (fp16), the upper half of the    */
+/*                 float (bf16), or 8-bit integers scaled per coordinate for */
+/*                 each group of QUANT_GROUP objects (int8). The rows are    */
+/*                 packed, 2 or 1 byte per coordinate instead of 4, so a     */
+/*                 block of objects takes 2 or 4 times less memory and       */
+/*                 memory bandwidth.                                         */
+/*                                                                           */
+/*                 quant_kmeans() is the Lloyd loop of omp_kmeans() on such  */
+/*                 a block: each thread expands QUANT_TILE objects at a time */
+/*                 into a float tile that stays in L1 and hands it to        */
+/*                 find_nearest_clusters(), so the distance kernels of       */
+/*                 kernels.c are used as they are; centers and sums stay in  */
+/*                 float and double. The expansion is vectorized with AVX2   */
+/*                 (F16C for fp16) when kernels_level() allows it.           */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _POSIX_C_SOURCE 200112L   /* posix_memalign() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QUANT_X86 1
+#include <immintrin.h>
+#endif
+
+#define QUANT_TILE  128   /* objects expanded at once by a thread */
+#define INT8_MAX_Q  127   /* int8 codes are -127 .. 127 */
+#define HALF_MAX_ROUND 65520.0f   /* smallest float rounded to fp16 inf */
+
+typedef void (*expand_t)(const qdataset*, int, int, float**);
+
+
+/*----< float_to_half() >----------------------------------------------------*/
+/* round to nearest even; overflow gives infinity                            */
+static inline
+uint16_t float_to_half(float f)
+{
+    uint32_t x, absx, sign;
+
+    memcpy(&x, &f, sizeof(x));
+    sign = (x >> 16) & 0x8000;
+    absx = x & 0x7fffffff;
+
+    if (absx >= 0x7f800000)                         /* inf, nan */
+        return sign | 0x7c00 | ((absx > 0x7f800000) ? 0x200 : 0);
+    if (absx >= 0x477ff000)                         /* 65520 and up */
+        return sign | 0x7c00;
+    if (absx < 0x38800000) {                        /* below 2^-14 */
+        /* adding 0.5 leaves the half subnormal bits, rounded, in the
+           low mantissa bits */
+        float    a;
+        uint32_t r;
+        memcpy(&a, &absx, sizeof(a));
+        a += 0.5f;
+        memcpy(&r, &a, sizeof(r));
+        return sign | (r - 0x3f000000);
+    }
+    /* rebias the exponent and round the 13 dropped bits */
+    return sign | ((absx + 0xc8000fff + ((absx >> 13) & 1)) >> 13);
+}
+
+/*----< half_to_float() >----------------------------------------------------*/
+static inline
+float half_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t e    = (h >> 10) & 0x1f;
+    uint32_t m    = h & 0x3ff;
+    uint32_t x;
+    float    f;
+
+    if (e == 0) {                                   /* zero, subnormal */
+        f = m * (1.0f / 16777216.0f);
+        memcpy(&x, &f, sizeof(x));
+        x |= sign;
+    }
+    else if (e == 31)                               /* inf, nan */
+        x = sign | 0x7f800000 | (m << 13);
+    else
+        x = sign | ((e + 112) << 23) | (m << 13);
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+/*----< float_to_bf16() >----------------------------------------------------*/
+/* round to nearest even, nan stays nan                                      */
+static inline
+uint16_t float_to_bf16(float f)
+{
+    uint32_t x;
+
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7fffffff) > 0x7f800000)
+        return (x >> 16) | 0x40;
+    return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+/*----< bf16_to_float() >----------------------------------------------------*/
+static inline
+float bf16_to_float(uint16_t b)
+{
+    uint32_t x = (uint32_t)b << 16;
+    float    f;
+
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+/*----< quant_alloc() >------------------------------------------------------*/
+/* storage for numObjs objects of the given type, QUANT_FP16, QUANT_BF16 or  */
+/* QUANT_INT8; the rows are not initialized                                  */
+qdataset* quant_alloc(int numObjs,
+                      int numCoords,
+                      int type)
+{
+    size_t    len;
+    void     *p;
+    qdataset *q;
+
+    q = (qdataset*) malloc(sizeof(qdataset));
+    assert(q != NULL);
+    q->numObjs   = numObjs;
+    q->numCoords = numCoords;
+    q->type      = type;
+    q->elemSize  = (type == QUANT_INT8) ? 1 : 2;
+    q->scale     = NULL;
+    q->offset    = NULL;
+
+    len = (size_t)(numObjs > 0 ? numObjs : 1) * numCoords * q->elemSize;
+    if (posix_memalign(&p, DATA_ALIGN, len) != 0)
+        p = NULL;
+    assert(p != NULL);
+    q->data = (unsigned char*) p;
+
+    if (type == QUANT_INT8) {
+        size_t n = (size_t)((numObjs + QUANT_GROUP - 1) / QUANT_GROUP + 1) *
+                   numCoords;
+        q->scale  = (float*) malloc(n * sizeof(float));
+        assert(q->scale != NULL);
+        q->offset = (float*) malloc(n * sizeof(float));
+        assert(q->offset != NULL);
+    }
+    return q;
+}
+
+/*----< quant_free() >-------------------------------------------------------*/
+void quant_free(qdataset *q)
+{
+    if (q == NULL) return;
+    free(q->data);
+    free(q->scale);
+    free(q->offset);
+    free(q);
+}
+
+/*----< quant_store() >------------------------------------------------------*/
+/* convert rows[0..n-1] into objects first .. first+n-1. first is a multiple */
+/* of QUANT_GROUP: int8 scales are made for the groups of these objects,     */
+/* which must be stored in a single call. Return the no. finite coordinates */
+/* that are beyond the fp16 range (|x| >= 65520) and were stored as inf      */
+int quant_store(qdataset *q,
+                 int       first,    /* first object, multiple of QUANT_GROUP */
+                 int       n,        /* no. objects */
+                 float   **rows)     /* [n][numCoords] */
+{
+    int    i, j, g, numCoords = q->numCoords, overflow = 0;
+    size_t rowLen = (size_t)numCoords * q->elemSize;
+
+    if (q->type == QUANT_FP16) {
+        for (i=0; i<n; i++) {
+            uint16_t *dst = (uint16_t*) (q->data + (first + i) * rowLen);
+            for (j=0; j<numCoords; j++) {
+                float a = fabsf(rows[i][j]);
+                if (a >= HALF_MAX_ROUND && a < INFINITY) overflow++;
+                dst[j] = float_to_half(rows[i][j]);
+            }
+        }
+        return overflow;
+    }
+    if (q->type == QUANT_BF16) {
+        for (i=0; i<n; i++) {
+            uint16_t *dst = (uint16_t*) (q->data + (first + i) * rowLen);
+            for (j=0; j<numCoords; j++)
+                dst[j] = float_to_bf16(rows[i][j]);
+        }
+        return 0;
+    }
+
+    /* int8: the codes -127 .. 127 span the range of each coordinate of the
+       group, centered on its middle */
+    for (g=0; g<n; g+=QUANT_GROUP) {
+        int    m      = (n - g < QUANT_GROUP) ? n - g : QUANT_GROUP;
+        float *scale  = q->scale  + (size_t)(first + g) / QUANT_GROUP * numCoords;
+        float *offset = q->offset + (size_t)(first + g) / QUANT_GROUP * numCoords;
+
+        for (j=0; j<numCoords; j++) {
+            float lo = rows[g][j], hi = rows[g][j], inv;
+            for (i=1; i<m; i++) {
+                if (rows[g + i][j] < lo) lo = rows[g + i][j];
+                if (rows[g + i][j] > hi) hi = rows[g + i][j];
+            }
+            offset[j] = 0.5f * (lo + hi);
+            scale[j]  = (hi - lo) / (2 * INT8_MAX_Q);
+            inv       = (scale[j] > 0.0f) ? 1.0f / scale[j] : 0.0f;
+            for (i=0; i<m; i++) {
+                float v = (rows[g + i][j] - offset[j]) * inv;
+                int   c = (int) (v + ((v < 0.0f) ? -0.5f : 0.5f));
+                if (c >  INT8_MAX_Q) c =  INT8_MAX_Q;
+                if (c < -INT8_MAX_Q) c = -INT8_MAX_Q;
+                ((int8_t*) q->data)[(size_t)(first + g + i) * numCoords + j] =
+                    (int8_t) c;
+            }
+        }
+    }
+    return 0;
+}
+
+/*----< expand_scalar() >----------------------------------------------------*/
+/* objects first .. first+n-1 back to floats in rows[0..n-1]                 */
+static
+void expand_scalar(const qdataset *q,
+                   int             first,
+                   int             n,
+                   float         **rows)
+{
+    int i, j, numCoords = q->numCoords;
+
+    for (i=0; i<n; i++) {
+        size_t o = (size_t)(first + i) * numCoords;
+        if (q->type == QUANT_FP16)
+            for (j=0; j<numCoords; j++)
+                rows[i][j] = half_to_float(((uint16_t*) q->data)[o + j]);
+        else if (q->type == QUANT_BF16)
+            for (j=0; j<numCoords; j++)
+                rows[i][j] = bf16_to_float(((uint16_t*) q->data)[o + j]);
+        else {
+            size_t g      = (size_t)(first + i) / QUANT_GROUP * numCoords;
+            float *scale  = q->scale + g;
+            float *offset = q->offset + g;
+            for (j=0; j<numCoords; j++)
+                rows[i][j] = ((int8_t*) q->data)[o + j] * scale[j] + offset[j];
+        }
+    }
+}
+
+#ifdef QUANT_X86
+
+/*----< expand_avx2() >------------------------------------------------------*/
+/* 8 coordinates per step, scalar tail                                       */
+__attribute__((target("avx2,fma,f16c"))) static
+void expand_avx2(const qdataset *q,
+                 int             first,
+                 int             n,
+                 float         **rows)
+{
+    int i, j, numCoords = q->numCoords;
+
+    for (i=0; i<n; i++) {
+        size_t o   = (size_t)(first + i) * numCoords;
+        float *row = rows[i];
+
+        if (q->type == QUANT_FP16) {
+            const uint16_t *src = (const uint16_t*) q->data + o;
+            for (j=0; j+8<=numCoords; j+=8)
+                _mm256_storeu_ps(row + j, _mm256_cvtph_ps(
+                    _mm_loadu_si128((const __m128i*) (src + j))));
+            for (; j<numCoords; j++) row[j] = half_to_float(src[j]);
+        }
+        else if (q->type == QUANT_BF16) {
+            const uint16_t *src = (const uint16_t*) q->data + o;
+            for (j=0; j+8<=numCoords; j+=8)
+                _mm256_storeu_ps(row + j, _mm256_castsi256_ps(
+                    _mm256_slli_epi32(_mm256_cvtepu16_epi32(
+                        _mm_loadu_si128((const __m128i*) (src + j))), 16)));
+            for (; j<numCoords; j++) row[j] = bf16_to_float(src[j]);
+        }
+        else {
+            const int8_t *src    = (const int8_t*) q->data + o;
+            size_t        g      = (size_t)(first + i) / QUANT_GROUP * numCoords;
+            const float  *scale  = q->scale + g;
+            const float  *offset = q->offset + g;
+            for (j=0; j+8<=numCoords; j+=8) {
+                __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(
+                               _mm_loadl_epi64((const __m128i*) (src + j))));
+                _mm256_storeu_ps(row + j, _mm256_fmadd_ps(v,
+                                 _mm256_loadu_ps(scale + j),
+                                 _mm256_loadu_ps(offset + j)));
+            }
+            for (; j<numCoords; j++) row[j] = src[j] * scale[j] + offset[j];
+        }
+    }
+}
+
+#endif /* QUANT_X86 */
+
+static expand_t expand_fn = NULL;
+
+/*----< quant_load() >-------------------------------------------------------*/
+/* objects first .. first+n-1 back to floats in rows[0..n-1]                 */
+void quant_load(const qdataset *q,
+                int             first,   /* first object */
+                int             n,       /* no. objects */
+                float         **rows)    /* out: [n][numCoords] */
+{
+    if (expand_fn == NULL) {
+        expand_fn = expand_scalar;
+#ifdef QUANT_X86
+        if (kernels_level() >= KERNELS_AVX2)
+            expand_fn = expand_avx2;
+#endif
+    }
+    expand_fn(q, first, n, rows);
+}
+
+/*----< quant_read_block() >-------------------------------------------------*/
+/* as file_read_block(), but the next numObjs objects of the open file are   */
+/* stored as type; they are read QUANT_GROUP at a time, so only one group is */
+/* ever held in floats. Return NULL if a coordinate does not fit in fp16     */
+qdataset* quant_read_block(int isBinaryFile,  /* flag: 0 or 1 */
+                           int numObjs,       /* no. data objects */
+                           int numCoords,     /* no. coordinates */
+                           int type)          /* QUANT_FP16, ... */
+{
+    int       i, n;
+    qdataset *q   = quant_alloc(numObjs, numCoords, type);
+    dataset  *buf = dataset_alloc(QUANT_GROUP, numCoords);
+
+    if (_debug)
+        printf("\n[quant] read a block of %ix%i objects, %d bytes each\n",
+               numObjs, numCoords, q->elemSize);
+    for (i=0; i<numObjs; i+=n) {
+        n       = (numObjs - i < QUANT_GROUP) ? numObjs - i : QUANT_GROUP;
+        file_read_exact(isBinaryFile, buf, 0, n);
+        if (quant_store(q, i, n, buf->rows) > 0) {
+            fprintf(stderr, "[quant] error: objects %d to %d have coordinates "
+                    "beyond the fp16 range (|x| >= %g), use -Q 2 or -Q 3\n",
+                    i, i + n - 1, HALF_MAX_ROUND);
+            quant_free(q);
+            dataset_free(buf);
+            return NULL;
+        }
+    }
+    dataset_free(buf);
+    return q;
+}
+
+/*----< quant_kmeans() >-----------------------------------------------------*/
+/* Lloyd's algorithm on the objects of q, as omp_kmeans() with KM_LLOYD:     */
+/* return an array of cluster centers of size [numClusters][numCoords]       */
+float** quant_kmeans(int        nthreads,      /* no. threads */
+                     qdataset  *q,             /* in: numObjs objects */
+                     int        numClusters,   /* no. clusters */
+                     float    **clustersInit,  /* [numClusters][numCoords] */
+                     float      threshold,     /* % objects change membership */
+                     int       *membership,    /* out: [numObjs] */
+                     int       *loop_iterations)
+{
+    int      i, j, t, loop = 0;
+    int      done = 0;         /* convergence, shared by the threads */
+    int      numObjs   = q->numObjs;
+    int      numCoords = q->numCoords;
+    int      numTiles  = (numObjs + QUANT_TILE - 1) / QUANT_TILE;
+    float    delta;            /* % of objects change their clusters */
+    float  **clusters;         /* out: [numClusters][numCoords] */
+    int     *newClusterSize;   /* [numClusters] */
+    double  *newClusters;      /* [numClusters][numCoords] running sums */
+    int     *partSize;         /* [nthreads][numClusters] */
+    double  *partSum;          /* [nthreads][numClusters][numCoords] */
+
+    kernels_init();
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    for (i=0; i<numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            clusters[i][j] = clustersInit[i][j];
+
+    newClusterSize = (int*)    calloc(numClusters, sizeof(int));
+    assert(newClusterSize != NULL);
+    newClusters    = (double*) calloc((size_t)numClusters * numCoords,
+                                      sizeof(double));
+    assert(newClusters != NULL);
+    partSize       = (int*)    calloc((size_t)nthreads * numClusters,
+                                      sizeof(int));
+    assert(partSize != NULL);
+    partSum        = (double*) calloc((size_t)nthreads * numClusters *
+                                      numCoords, sizeof(double));
+    assert(partSum != NULL);
+
+    for (i=0; i<numObjs; i++) membership[i] = -1;
+    delta = 0.0;
+
+    #pragma omp parallel num_threads(nthreads) private(i,j,t) \
+            shared(clusters,membership,delta,loop,done)
+    {
+        int      tid    = omp_get_thread_num();
+        int     *mySize = partSize + (size_t)tid * numClusters;
+        double  *mySum  = partSum  + (size_t)tid * numClusters * numCoords;
+        dataset *tile   = dataset_alloc(QUANT_TILE, numCoords);
+        int      near[QUANT_TILE];
+        float    dist[QUANT_TILE];
+
+        do {
+            #pragma omp for schedule(static) reduction(+:delta)
+            for (t=0; t<numTiles; t++) {
+                int start = t * QUANT_TILE;
+                int n     = (numObjs - start < QUANT_TILE) ? numObjs - start
+                                                           : QUANT_TILE;
+                quant_load(q, start, n, tile->rows);
+                find_nearest_clusters(n, numCoords, tile->rows, numClusters,
+                                      clusters, near, dist);
+
+                /* move the objects that changed cluster from the sum of
+                   their old cluster to the one of the new cluster */
+                for (i=0; i<n; i++) {
+                    int     old   = membership[start + i];
+                    int     index = near[i];
+                    float  *x     = tile->rows[i];
+                    double *s;
+                    if (old == index) continue;
+                    delta += 1.0;
+                    if (old >= 0) {
+                        s = mySum + (size_t)old * numCoords;
+                        mySize[old]--;
+                        for (j=0; j<numCoords; j++) s[j] -= x[j];
+                    }
+                    assert(index >= 0 && index < numClusters);
+                    s = mySum + (size_t)index * numCoords;
+                    mySize[index]++;
+                    for (j=0; j<numCoords; j++) s[j] += x[j];
+                    membership[start + i] = index;
+                }
+            }
+
+            /* reduction in thread order and new centers, by cluster */
+            #pragma omp for schedule(static)
+            for (i=0; i<numClusters; i++) {
+                double *sum = newClusters + (size_t)i * numCoords;
+                for (t=0; t<nthreads; t++) {
+                    int    *n = partSize + (size_t)t * numClusters + i;
+                    double *s = partSum + ((size_t)t * numClusters + i) *
+                                numCoords;
+                    newClusterSize[i] += *n;
+                    *n = 0;
+                    for (j=0; j<numCoords; j++) {
+                        sum[j] += s[j];
+                        s[j] = 0.0;
+                    }
+                }
+                for (j=0; j<numCoords; j++) {
+                    if (newClusterSize[i] > 0)
+                        clusters[i][j] = sum[j] / newClusterSize[i];
+                    else   /* drop rounding residue */
+                        sum[j] = 0.0;
+                }
+            }
+
+            #pragma omp single
+            {
+                delta /= numObjs;
+                if (_debug) printf("delta = %.3f\n", delta);
+                done  = !(delta > threshold && loop++ < 500);
+                delta = 0.0;
+            }
+        } while (!done);
+
+        dataset_free(tile);
+    }
+    *loop_iterations = loop + 1;
+
+    free(newClusterSize);
+    free(newClusters);
+    free(partSize);
+    free(partSum);
+
+    return clusters;
+}
@@ -0,0 +1,189 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         restart_kmeans.c                                          */
+/*   Description:  Several runs of Lloyd's iteration (n_init restarts) from  */
+/*                 different initial centers over the same objects, keeping  */
+/*                 the run of lowest cost (sum of squared distances). The    */
+/*                 runs advance together: each loop reads a block of         */
+/*                 GEMM_BLOCK objects once and assigns it to the centers of  */
+/*                 every run still going, while the block is in cache, so    */
+/*                 R runs cost one pass over the data per loop instead of R. */
+/*                 The cost of a run never grows from one loop to the next;  */
+/*                 after NINIT_WARMUP loops a run whose cost exceeds the     */
+/*                 best one by more than NINIT_MARGIN is dropped.            */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+/* state of a run */
+#define RUN_ACTIVE     0
+#define RUN_CONVERGED  1
+#define RUN_DROPPED    2
+
+
+/*----< restart_kmeans() >---------------------------------------------------*/
+/* return the cluster centers [numClusters][numCoords] of the best of        */
+/* numRuns runs; clustersInit holds the initial centers of run r in rows     */
+/* r * numClusters to (r + 1) * numClusters - 1. membership and              */
+/* loop_iterations are the ones of the best run                              */
+float** restart_kmeans(int     nthreads,     /* no. threads, 1 for sequential */
+                       int     maxIter,      /* max no. loops */
+                       float **objects,      /* in: [numObjs][numCoords] */
+                       int     numCoords,    /* no. features */
+                       int     numObjs,      /* no. objects */
+                       int     numClusters,  /* no. clusters */
+                       float **clustersInit, /* [numRuns * numClusters]
+                                                [numCoords] init values */
+                       int     numRuns,      /* no. runs */
+                       float   threshold,    /* % objects change membership */
+                       int    *membership,   /* out: [numObjs] */
+                       int    *loop_iterations)
+{
+    int      i, j, r, b, loop, best, numActive;
+    int      numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+    float  **clusters;       /* out: [numClusters][numCoords] */
+    float  **runClusters;    /* [numRuns * numClusters][numCoords] */
+    int     *runAssign;      /* [numRuns][numObjs] nearest center */
+    int     *runMember;      /* [numRuns][numObjs] counted cluster */
+    int     *runSize;        /* [numRuns][numClusters] running no. members */
+    double  *runSum;         /* [numRuns][numClusters][numCoords] sums */
+    double  *runCost;        /* [numRuns] cost of the last assignment */
+    int     *runLoops;       /* [numRuns] no. loops run */
+    int     *state;          /* [numRuns] RUN_ACTIVE, ... */
+    double  *partCost;       /* [nthreads][numRuns] cost of a loop */
+    float   *dist;           /* [nthreads][GEMM_BLOCK] */
+
+    malloc2D(runClusters, numRuns * numClusters, numCoords, float);
+    for (i=0; i<numRuns*numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            runClusters[i][j] = clustersInit[i][j];
+
+    runAssign = (int*)    malloc((size_t)numRuns * numObjs * sizeof(int));
+    assert(runAssign != NULL);
+    runMember = (int*)    malloc((size_t)numRuns * numObjs * sizeof(int));
+    assert(runMember != NULL);
+    runSize   = (int*)    calloc((size_t)numRuns * numClusters, sizeof(int));
+    assert(runSize != NULL);
+    runSum    = (double*) calloc((size_t)numRuns * numClusters * numCoords,
+                                 sizeof(double));
+    assert(runSum != NULL);
+    runCost   = (double*) malloc(numRuns * sizeof(double));
+    assert(runCost != NULL);
+    runLoops  = (int*)    calloc(numRuns, sizeof(int));
+    assert(runLoops != NULL);
+    state     = (int*)    calloc(numRuns, sizeof(int));
+    assert(state != NULL);
+    partCost  = (double*) malloc((size_t)nthreads * numRuns * sizeof(double));
+    assert(partCost != NULL);
+    dist      = (float*)  malloc((size_t)nthreads * GEMM_BLOCK * sizeof(float));
+    assert(dist != NULL);
+    for (i=0; i<numRuns*numObjs; i++) runMember[i] = -1;
+
+    kernels_init();
+
+    numActive = numRuns;
+    for (loop=0; numActive > 0; loop++) {
+        for (i=0; i<nthreads*numRuns; i++) partCost[i] = 0.0;
+
+        /* one pass over the objects for all active runs */
+        #pragma omp parallel for num_threads(nthreads) private(b,i,r) \
+                schedule(static)
+        for (b=0; b<numBlocks; b++) {
+            int     tid   = omp_get_thread_num();
+            int     start = b * GEMM_BLOCK;
+            int     n     = (numObjs - start < GEMM_BLOCK) ? numObjs - start
+                                                           : GEMM_BLOCK;
+            float  *d     = dist + (size_t)tid * GEMM_BLOCK;
+            for (r=0; r<numRuns; r++) {
+                double cost = 0.0;
+                if (state[r] != RUN_ACTIVE) continue;
+                find_nearest_clusters(n, numCoords, objects + start,
+                                      numClusters,
+                                      runClusters + (size_t)r * numClusters,
+                                      runAssign + (size_t)r * numObjs + start,
+                                      d);
+                for (i=0; i<n; i++) cost += d[i];
+                partCost[(size_t)tid * numRuns + r] += cost;
+            }
+        }
+
+        /* new centers and convergence test of each active run */
+        for (r=0; r<numRuns; r++) {
+            int changed;
+            if (state[r] != RUN_ACTIVE) continue;
+            runCost[r] = 0.0;
+            for (i=0; i<nthreads; i++)
+                runCost[r] += partCost[(size_t)i * numRuns + r];
+
+            changed = update_centers(nthreads, objects, numCoords, numObjs,
+                          numClusters, runAssign + (size_t)r * numObjs,
+                          runMember + (size_t)r * numObjs,
+                          runSize + (size_t)r * numClusters,
+                          runSum + (size_t)r * numClusters * numCoords,
+                          runClusters + (size_t)r * numClusters, NULL);
+            runLoops[r]++;
+            if (!((float)changed / numObjs > threshold && loop < maxIter)) {
+                state[r] = RUN_CONVERGED;
+                numActive--;
+            }
+        }
+
+        /* drop the runs clearly behind the best one */
+        best = -1;
+        for (r=0; r<numRuns; r++)
+            if (state[r] != RUN_DROPPED && (best < 0 ||
+                runCost[r] < runCost[best]))
+                best = r;
+        if (loop + 1 >= NINIT_WARMUP)
+            for (r=0; r<numRuns; r++)
+                if (state[r] == RUN_ACTIVE &&
+                    runCost[r] > (1.0 + NINIT_MARGIN) * runCost[best]) {
+                    state[r] = RUN_DROPPED;
+                    numActive--;
+                    if (_debug)
+                        printf("[n_init] loop %d: run %d dropped, cost %g "
+                               "against %g\n", loop, r, runCost[r],
+                               runCost[best]);
+                }
+
+        if (_debug)
+            printf("[n_init] loop %d: %d run(s) active, best cost %g (run %d)\n",
+                   loop, numActive, runCost[best], best);
+    }
+
+    /* the best run: lowest cost of its last assignment */
+    best = -1;
+    for (r=0; r<numRuns; r++)
+        if (state[r] == RUN_CONVERGED && (best < 0 ||
+            runCost[r] < runCost[best]))
+            best = r;
+    if (_debug)
+        printf("[n_init] run %d of %d kept, cost %g\n", best, numRuns,
+               runCost[best]);
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    memcpy(clusters[0], runClusters[(size_t)best * numClusters],
+           (size_t)numClusters * numCoords * sizeof(float));
+    memcpy(membership, runMember + (size_t)best * numObjs,
+           numObjs * sizeof(int));
+    *loop_iterations = runLoops[best];
+
+    free(runClusters[0]);
+    free(runClusters);
+    free(runAssign);
+    free(runMember);
+    free(runSize);
+    free(runSum);
+    free(runCost);
+    free(runLoops);
+    free(state);
+    free(partCost);
+    free(dist);
+
+    return clusters;
+}
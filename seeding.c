@@ -0,0 +1,414 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         seeding.c                                                 */
+/*   Description:  Initial cluster centers (imethod of the library, -c of    */
+/*                 the mains).                                               */
+/*                                                                           */
+/*                 k-means++ (D. Arthur and S.                               */
+/*                 Vassilvitskii, "k-means++: The Advantages of Careful      */
+/*                 Seeding", SODA 2007) picks each new center among the      */
+/*                 objects with a probability proportional to D^2, the       */
+/*                 squared distance to the nearest center chosen so far.     */
+/*                 D^2 is kept per object and only compared with the newest  */
+/*                 center, O(numObjs x k) distances in all. The objects are  */
+/*                 cut in blocks of GEMM_BLOCK: the threads update the D^2   */
+/*                 and the sum of a block at once, and the sampling walks    */
+/*                 the block sums then the objects of one block. The sums    */
+/*                 do not depend on the no. threads, nor does the result.    */
+/*                                                                           */
+/*                 k-means|| (B. Bahmani et al., "Scalable K-Means++", VLDB  */
+/*                 2012) needs KPAR_ROUNDS passes instead of k: each round   */
+/*                 samples every object independently with probability       */
+/*                 l x D^2 / cost, l = KPAR_OVERSAMPLE x k, and adds the     */
+/*                 samples to the candidates. The candidates, weighted by    */
+/*                 the no. objects nearest to them, are then reduced to k    */
+/*                 centers by a weighted k-means++. Each block of objects    */
+/*                 draws from its own generator, seeded from the round and   */
+/*                 the block no., so the samples do not depend on the no.    */
+/*                 threads either. mpi_kpar_init() runs the same steps with  */
+/*                 the objects spread over MPI processes.                    */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+
+/*----< seed_random() >------------------------------------------------------*/
+/* next number of a private xorshift64* generator, in [0, 1). The state is   */
+/* local to the caller, so the seeding draws nothing from rand() once it has */
+/* been initialized and can run next to other threads                        */
+double seed_random(unsigned long long *state)
+{
+    unsigned long long x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (double)((x * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+/*----< seed_state() >-------------------------------------------------------*/
+/* a generator state drawn from rand(), so that srand() still decides the    */
+/* seeding                                                                   */
+unsigned long long seed_state(void)
+{
+    unsigned long long s = ((unsigned long long)rand() << 32) ^ rand();
+
+    return s ? s : 0x9E3779B97F4A7C15ULL;   /* xorshift never leaves 0 */
+}
+
+/*----< seed_stream() >------------------------------------------------------*/
+/* state of the generator of one block of objects in one round of           */
+/* k-means||, mixed from the seed of the run (splitmix64)                    */
+static
+unsigned long long seed_stream(unsigned long long seed,
+                               int                round,
+                               int                stream,  /* e.g. MPI rank */
+                               int                block)
+{
+    unsigned long long z = seed + 0x9E3779B97F4A7C15ULL *
+                           (((unsigned long long)round  << 48) ^
+                            ((unsigned long long)stream << 32) ^
+                             (unsigned long long)block);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+/*----< seed_sample() >------------------------------------------------------*/
+/* index of an object drawn with probability dist[i] / sum(dist), given the  */
+/* sums of the blocks of GEMM_BLOCK objects. -1 if all distances are 0       */
+static
+int seed_sample(int     numObjs,
+                float  *dist,        /* [numObjs] D^2 of each object */
+                double *blockSum,    /* [numBlocks] sum of dist per block */
+                double  u)           /* uniform in [0, 1) */
+{
+    int    b, i, end, last = -1;
+    int    numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+    double total = 0.0, r;
+
+    for (b=0; b<numBlocks; b++) total += blockSum[b];
+    if (total <= 0.0) return -1;
+
+    r = u * total;
+    for (b=0; b<numBlocks-1 && r >= blockSum[b]; b++)
+        r -= blockSum[b];
+
+    end = (b*GEMM_BLOCK + GEMM_BLOCK < numObjs) ? b*GEMM_BLOCK + GEMM_BLOCK
+                                                : numObjs;
+    for (i=b*GEMM_BLOCK; i<end; i++) {
+        if (dist[i] > 0.0) last = i;
+        if ((r -= dist[i]) < 0.0) return i;
+    }
+    /* rounding left r just above the block sum: last object of weight > 0 */
+    return last;
+}
+
+/*----< seed_update() >------------------------------------------------------*/
+/* lower dist[] to the distance to center when nearer and recompute the      */
+/* block sums, dist[] is initialized when first is set                       */
+static
+void seed_update(int     nthreads,
+                 float **objects,     /* [numObjs][numCoords] */
+                 int     numCoords,
+                 int     numObjs,
+                 float  *center,      /* [numCoords] new center */
+                 int     first,       /* 1: dist[] not initialized yet */
+                 float  *dist,        /* in/out: [numObjs] */
+                 double *blockSum)    /* out: [numBlocks] */
+{
+    int b, numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+
+    #pragma omp parallel for num_threads(nthreads) private(b) schedule(static)
+    for (b=0; b<numBlocks; b++) {
+        int    i, start = b * GEMM_BLOCK;
+        int    end = (start + GEMM_BLOCK < numObjs) ? start + GEMM_BLOCK
+                                                    : numObjs;
+        double sum = 0.0;
+        for (i=start; i<end; i++) {
+            float d = euclid_dist_2(numCoords, objects[i], center);
+            if (first || d < dist[i]) dist[i] = d;
+            sum += dist[i];
+        }
+        blockSum[b] = sum;
+    }
+}
+
+/*----< kpp_init() >---------------------------------------------------------*/
+/* choose numClusters initial centers among the objects with k-means++       */
+void kpp_init(int     nthreads,     /* no. threads, 1 for sequential */
+              float **objects,      /* in: [numObjs][numCoords] */
+              int     numCoords,    /* no. coordinates */
+              int     numObjs,      /* no. objects */
+              int     numClusters,  /* no. clusters */
+              float **clusters)     /* out: [numClusters][numCoords] */
+{
+    int                 c, i;
+    int                 numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+    float              *dist;       /* [numObjs] D^2 to the nearest center */
+    double             *blockSum;   /* [numBlocks] */
+    unsigned long long  state = seed_state();
+
+    dist     = (float*)  malloc(numObjs * sizeof(float));
+    assert(dist != NULL);
+    blockSum = (double*) malloc(numBlocks * sizeof(double));
+    assert(blockSum != NULL);
+
+    kernels_init();
+
+    i = (int)(seed_random(&state) * numObjs);
+    memcpy(clusters[0], objects[i], numCoords * sizeof(float));
+    seed_update(nthreads, objects, numCoords, numObjs, clusters[0], 1, dist,
+                blockSum);
+
+    for (c=1; c<numClusters; c++) {
+        i = seed_sample(numObjs, dist, blockSum, seed_random(&state));
+        if (i < 0)   /* fewer distinct objects than clusters */
+            i = (int)(seed_random(&state) * numObjs);
+        memcpy(clusters[c], objects[i], numCoords * sizeof(float));
+        seed_update(nthreads, objects, numCoords, numObjs, clusters[c], 0,
+                    dist, blockSum);
+        if (_debug && (c + 1) % 100 == 0)
+            printf("[k-means++] %d centers\n", c + 1);
+    }
+
+    free(dist);
+    free(blockSum);
+}
+
+/*----< kpar_update() >------------------------------------------------------*/
+/* compare every object with the numNew candidates cand[first..] and keep    */
+/* in dist[], near[] the squared distance and index of the nearest           */
+/* candidate so far (INFINITY and -1 before the first call). Return the      */
+/* cost, the sum of dist[], added block by block in order                    */
+double kpar_update(int     nthreads,
+                   float **objects,   /* [numObjs][numCoords] */
+                   int     numCoords,
+                   int     numObjs,
+                   float **cand,      /* [first+numNew][numCoords] */
+                   int     first,
+                   int     numNew,
+                   float  *dist,      /* in/out: [numObjs] */
+                   int    *near)      /* in/out: [numObjs] */
+{
+    int     b, numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+    double *blockSum, cost = 0.0;
+
+    blockSum = (double*) malloc((numBlocks > 0 ? numBlocks : 1) *
+                                sizeof(double));
+    assert(blockSum != NULL);
+
+    #pragma omp parallel num_threads(nthreads) private(b)
+    {
+        int   *index = (int*)   malloc(GEMM_BLOCK * sizeof(int));
+        float *d     = (float*) malloc(GEMM_BLOCK * sizeof(float));
+        assert(index != NULL && d != NULL);
+
+        #pragma omp for schedule(static)
+        for (b=0; b<numBlocks; b++) {
+            int    i, start = b * GEMM_BLOCK;
+            int    end = (start + GEMM_BLOCK < numObjs) ? start + GEMM_BLOCK
+                                                        : numObjs;
+            double sum = 0.0;
+            if (numNew > 0)
+                find_nearest_clusters(end - start, numCoords, objects + start,
+                                      numNew, cand + first, index, d);
+            for (i=start; i<end; i++) {
+                if (numNew > 0 && d[i - start] < dist[i]) {
+                    dist[i] = d[i - start];
+                    near[i] = first + index[i - start];
+                }
+                sum += dist[i];
+            }
+            blockSum[b] = sum;
+        }
+        free(index);
+        free(d);
+    }
+
+    for (b=0; b<numBlocks; b++) cost += blockSum[b];
+    free(blockSum);
+    return cost;
+}
+
+/*----< kpar_sample() >------------------------------------------------------*/
+/* one k-means|| round: set pick[i] when object i is drawn, with probability */
+/* min(1, ell x dist[i] / cost). Return the no. objects drawn                */
+int kpar_sample(int                 nthreads,
+                int                 numObjs,
+                float              *dist,    /* [numObjs] */
+                double              cost,    /* total over all objects */
+                double              ell,     /* expected no. samples */
+                unsigned long long  seed,    /* seed of the run */
+                int                 round,
+                int                 stream,  /* 0, or the MPI rank */
+                unsigned char      *pick)    /* out: [numObjs] */
+{
+    int b, count = 0, numBlocks = (numObjs + GEMM_BLOCK - 1) / GEMM_BLOCK;
+
+    #pragma omp parallel for num_threads(nthreads) private(b) \
+            schedule(static) reduction(+:count)
+    for (b=0; b<numBlocks; b++) {
+        int                i, start = b * GEMM_BLOCK;
+        int                end = (start + GEMM_BLOCK < numObjs)
+                                 ? start + GEMM_BLOCK : numObjs;
+        unsigned long long state = seed_stream(seed, round, stream, b);
+        for (i=start; i<end; i++) {
+            pick[i] = (seed_random(&state) * cost < ell * dist[i]);
+            count  += pick[i];
+        }
+    }
+    return count;
+}
+
+/*----< kpar_grow() >--------------------------------------------------------*/
+/* room for maxCand candidates in cand, made by malloc2D(). Return the new   */
+/* rows, the candidates kept                                                 */
+float** kpar_grow(float **cand,
+                  int     numCoords,
+                  int     maxCand)
+{
+    int    i;
+    float *data;
+
+    data = (float*)  realloc(cand[0], (size_t)maxCand * numCoords *
+                                      sizeof(float));
+    assert(data != NULL);
+    cand = (float**) realloc(cand, maxCand * sizeof(float*));
+    assert(cand != NULL);
+    for (i=0; i<maxCand; i++)
+        cand[i] = data + (size_t)i * numCoords;
+    return cand;
+}
+
+/*----< kpp_weighted() >-----------------------------------------------------*/
+/* k-means++ over numCand weighted points: a point is drawn with probability */
+/* proportional to weight x D^2 (to weight alone for the first center)       */
+void kpp_weighted(int                 nthreads,
+                  float             **cand,      /* [numCand][numCoords] */
+                  double             *weight,    /* [numCand] */
+                  int                 numCand,
+                  int                 numCoords,
+                  int                 numClusters,
+                  unsigned long long *state,     /* in/out: generator */
+                  float             **clusters)  /* out: [numClusters][numCoords] */
+{
+    int     c, i;
+    float  *d2;       /* [numCand] squared distance to the nearest center */
+    double  total, r;
+
+    d2 = (float*) malloc(numCand * sizeof(float));
+    assert(d2 != NULL);
+    for (i=0; i<numCand; i++) d2[i] = INFINITY;
+
+    for (c=0; c<numClusters; c++) {
+        /* draw a point: weight x D^2, weight only for the first center */
+        total = 0.0;
+        for (i=0; i<numCand; i++)
+            total += (c == 0) ? weight[i] : weight[i] * d2[i];
+        r = seed_random(state) * total;
+        for (i=0; i<numCand-1; i++) {
+            r -= (c == 0) ? weight[i] : weight[i] * d2[i];
+            if (r < 0.0) break;
+        }
+        if (total <= 0.0)   /* fewer distinct candidates than clusters */
+            i = (int)(seed_random(state) * numCand);
+        memcpy(clusters[c], cand[i], numCoords * sizeof(float));
+
+        #pragma omp parallel for num_threads(nthreads) private(i) \
+                schedule(static)
+        for (i=0; i<numCand; i++) {
+            float d = euclid_dist_2(numCoords, cand[i], clusters[c]);
+            if (d < d2[i]) d2[i] = d;
+        }
+    }
+    free(d2);
+}
+
+/*----< kpar_init() >--------------------------------------------------------*/
+/* choose numClusters initial centers among the objects with k-means||       */
+void kpar_init(int     nthreads,     /* no. threads, 1 for sequential */
+               float **objects,      /* in: [numObjs][numCoords] */
+               int     numCoords,    /* no. coordinates */
+               int     numObjs,      /* no. objects */
+               int     numClusters,  /* no. clusters */
+               float **clusters)     /* out: [numClusters][numCoords] */
+{
+    int                 i, r, numCand, numNew, maxCand;
+    double              cost, ell = (double)KPAR_OVERSAMPLE * numClusters;
+    float              *dist;     /* [numObjs] D^2 to the nearest candidate */
+    int                *near;     /* [numObjs] nearest candidate */
+    unsigned char      *pick;     /* [numObjs] drawn in this round */
+    float             **cand;     /* [maxCand][numCoords] candidates */
+    double             *weight;   /* [numCand] no. objects nearest */
+    unsigned long long  state = seed_state();
+    unsigned long long  seed  = state;
+
+    dist = (float*)         malloc(numObjs * sizeof(float));
+    assert(dist != NULL);
+    near = (int*)           malloc(numObjs * sizeof(int));
+    assert(near != NULL);
+    pick = (unsigned char*) malloc(numObjs);
+    assert(pick != NULL);
+    for (i=0; i<numObjs; i++) {
+        dist[i] = INFINITY;
+        near[i] = -1;
+    }
+
+    /* a candidate can be drawn once at most: numObjs bounds them all */
+    maxCand  = 1 + KPAR_ROUNDS * (int)(2 * ell);
+    if (maxCand > numObjs) maxCand = numObjs;
+    malloc2D(cand, maxCand, numCoords, float);
+
+    kernels_init();
+
+    /* first candidate: one object drawn uniformly */
+    i = (int)(seed_random(&state) * numObjs);
+    memcpy(cand[0], objects[i], numCoords * sizeof(float));
+    numCand = 1;
+    cost = kpar_update(nthreads, objects, numCoords, numObjs, cand, 0, 1,
+                       dist, near);
+
+    for (r=0; r<KPAR_ROUNDS && cost > 0.0; r++) {
+        numNew = kpar_sample(nthreads, numObjs, dist, cost, ell, seed, r, 0,
+                             pick);
+        if (numCand + numNew > maxCand) {   /* unlikely many samples */
+            maxCand = numCand + numNew;
+            cand    = kpar_grow(cand, numCoords, maxCand);
+        }
+        for (i=0, numNew=0; i<numObjs; i++)
+            if (pick[i])
+                memcpy(cand[numCand + numNew++], objects[i],
+                       numCoords * sizeof(float));
+        cost = kpar_update(nthreads, objects, numCoords, numObjs, cand, numCand,
+                           numNew, dist, near);
+        numCand += numNew;
+        if (_debug)
+            printf("[k-means||] round %d: %d candidates, cost %g\n", r + 1,
+                   numCand, cost);
+    }
+
+    /* weight of a candidate: no. objects nearest to it */
+    weight = (double*) calloc(numCand, sizeof(double));
+    assert(weight != NULL);
+    for (i=0; i<numObjs; i++) weight[near[i]] += 1.0;
+
+    kpp_weighted(nthreads, cand, weight, numCand, numCoords, numClusters,
+                 &state, clusters);
+
+    free(dist);
+    free(near);
+    free(pick);
+    free(cand[0]);
+    free(cand);
+    free(weight);
+}
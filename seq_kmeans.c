@@ -46,52 +46,10 @@
 #include "kmeans.h"
 
 
-/*----< euclid_dist_2() >----------------------------------------------------*/
-/* square of Euclid distance between two multi-dimensional points            */
-__inline static
-float euclid_dist_2(int    numdims,  /* no. dimensions */
-                    float *coord1,   /* [numdims] */
-                    float *coord2)   /* [numdims] */
-{
-    int i;
-    float ans=0.0;
-
-    for (i=0; i<numdims; i++)
-        ans += (coord1[i]-coord2[i]) * (coord1[i]-coord2[i]);
-
-    return(ans);
-}
-
-/*----< find_nearest_cluster() >---------------------------------------------*/
-__inline static
-int find_nearest_cluster(int     numClusters, /* no. clusters */
-                         int     numCoords,   /* no. coordinates */
-						 float  *distance,    /* to save distance for stats */
-                         float  *object,      /* [numCoords] */
-                         float **clusters)    /* [numClusters][numCoords] */
-{
-    int   index, i;
-    float dist, min_dist;
-
-    /* find the cluster id that has min distance to object */
-    index    = 0;
-    min_dist = euclid_dist_2(numCoords, object, clusters[0]);
-
-    for (i=1; i<numClusters; i++) {
-        dist = euclid_dist_2(numCoords, object, clusters[i]);
-        /* no need square root */
-        if (dist < min_dist) { /* find the min and its array index */
-            min_dist = dist;
-            index    = i;
-        }
-    }
-    *distance = min_dist;
-    return(index);
-}
-
 /*----< seq_kmeans() >-------------------------------------------------------*/
 /* return an array of cluster centers of size [numClusters][numCoords]       */
-float** seq_kmeans(float **objects,      /* in: [numObjs][numCoords] */
+float** seq_kmeans(int     method,       /* KM_LLOYD, KM_GEMM, ... */
+                   float **objects,      /* in: [numObjs][numCoords] */
                    int     numCoords,    /* no. features */
                    int     numObjs,      /* no. objects */
                    int     numClusters,  /* no. clusters */
@@ -105,7 +63,35 @@ float** seq_kmeans(float **objects,      /* in: [numObjs][numCoords] */
                                 new cluster */
     float    delta;          /* % of objects change their clusters */
     float  **clusters;       /* out: [numClusters][numCoords] */
-    float  **newClusters;    /* [numClusters][numCoords] */
+    double **newClusters;    /* [numClusters][numCoords] running sums */
+
+    /* no object is counted in a cluster sum yet */
+    for (i=0; i<numObjs; i++) membership[i] = -1;
+
+    /* pick the distance kernels */
+    kernels_init();
+
+    /* bound-based methods run their own loop */
+    if (method == KM_ELKAN)
+        return elkan_kmeans(1, MAX_ITER, objects, numCoords, numObjs,
+                            numClusters, clustersInit, threshold, membership,
+                            loop_iterations);
+    if (method == KM_HAMERLY)
+        return hamerly_kmeans(1, MAX_ITER, objects, numCoords, numObjs,
+                              numClusters, clustersInit, threshold, membership,
+                              loop_iterations);
+    if (method == KM_YINYANG)
+        return yinyang_kmeans(1, MAX_ITER, objects, numCoords, numObjs,
+                              numClusters, clustersInit, threshold, membership,
+                              loop_iterations);
+    if (method == KM_KDTREE)
+        return kdtree_kmeans(1, MAX_ITER, objects, numCoords, numObjs,
+                             numClusters, clustersInit, threshold, membership,
+                             loop_iterations);
+    if (method == KM_MINIBATCH)
+        return minibatch_kmeans(1, objects, 0, numCoords, numObjs, numClusters,
+                                clustersInit, MINIBATCH_SIZE, MINIBATCH_ITER,
+                                1, membership, loop_iterations);
 
     /* allocate a 2D space for returning variable clusters[] (coordinates
        of cluster centers) */
@@ -125,9 +111,9 @@ float** seq_kmeans(float **objects,      /* in: [numObjs][numCoords] */
     newClusterSize = (int*) calloc(numClusters, sizeof(int));
     assert(newClusterSize != NULL);
 
-    newClusters    = (float**) malloc(numClusters *            sizeof(float*));
+    newClusters    = (double**) malloc(numClusters *            sizeof(double*));
     assert(newClusters != NULL);
-    newClusters[0] = (float*)  calloc(numClusters * numCoords, sizeof(float));
+    newClusters[0] = (double*)  calloc(numClusters * numCoords, sizeof(double));
     assert(newClusters[0] != NULL);
     for (i=1; i<numClusters; i++)
         newClusters[i] = newClusters[i-1] + numCoords;
@@ -135,34 +121,70 @@ float** seq_kmeans(float **objects,      /* in: [numObjs][numCoords] */
 	/* initialize dist */
 	float* dist = (float*) malloc(numObjs * sizeof(float));
 	float totalDistance = 0.0;
+
+    /* blocked assignment: object norms are computed once for all loops */
+    float *objNorms = NULL;  /* [numObjs] */
+    float *packed   = NULL;  /* centers packed by gemm_pack() */
+    int   *nearest  = NULL;  /* [GEMM_BLOCK] */
+    if (method == KM_GEMM) {
+        objNorms = (float*) malloc(numObjs * sizeof(float));
+        assert(objNorms != NULL);
+        packed   = (float*) malloc(gemm_packed_size(numClusters, numCoords) *
+                                   sizeof(float));
+        assert(packed != NULL);
+        gemm_norms(numObjs, numCoords, objects, objNorms);
+    }
+    nearest = (int*) malloc(GEMM_BLOCK * sizeof(int));
+    assert(nearest != NULL);
 	
     do {
         delta = 0.0;
+        if (method == KM_GEMM)
+            gemm_pack(numClusters, numCoords, clusters, packed);
+
         for (i=0; i<numObjs; i++) {
-            /* find the array index of nestest cluster center */
-            index = find_nearest_cluster(numClusters, numCoords, &dist[i],
-										 objects[i], clusters);
+            /* find the array index of nestest cluster center, a block of
+               objects at a time */
+            if (i % GEMM_BLOCK == 0) {
+                int len = (numObjs - i < GEMM_BLOCK) ? numObjs - i : GEMM_BLOCK;
+                if (method == KM_GEMM)
+                    gemm_nearest(len, numCoords, objects + i, objNorms + i,
+                                 numClusters, packed, nearest, &dist[i]);
+                else
+                    find_nearest_clusters(len, numCoords, objects + i,
+                                          numClusters, clusters, nearest,
+                                          &dist[i]);
+            }
+            index = nearest[i % GEMM_BLOCK];
 
             /* if membership changes, increase delta by 1 */
-            if (membership[i] != index) delta += 1.0;
-
-            /* assign the membership to object i */
-            membership[i] = index;
-
-            /* update new cluster centers : sum of objects located within */
+            if (membership[i] == index) continue;
+            delta += 1.0;
+
+            /* update new cluster centers : move object i from the sum of
+               its old cluster to the sum of the new one */
+            if (membership[i] >= 0) {
+                newClusterSize[membership[i]]--;
+                for (j=0; j<numCoords; j++)
+                    newClusters[membership[i]][j] -= objects[i][j];
+            }
             newClusterSize[index]++;
             for (j=0; j<numCoords; j++)
                 newClusters[index][j] += objects[i][j];
+
+            /* assign the membership to object i */
+            membership[i] = index;
         }
 
-        /* average the sum and replace old cluster centers with newClusters */
+        /* average the sums and replace old cluster centers with them; the
+           sums are kept for the next loop */
         for (i=0; i<numClusters; i++) {
             for (j=0; j<numCoords; j++) {
                 if (newClusterSize[i] > 0)
                     clusters[i][j] = newClusters[i][j] / newClusterSize[i];
-                newClusters[i][j] = 0.0;   /* set back to 0 */
+                else
+                    newClusters[i][j] = 0.0;   /* drop rounding residue */
             }
-            newClusterSize[i] = 0;   /* set back to 0 */
         }
         
         /* compute total distance and display results*/
@@ -181,6 +203,9 @@ float** seq_kmeans(float **objects,      /* in: [numObjs][numCoords] */
     free(newClusters);
     free(newClusterSize);
 	free(dist);
+    free(objNorms);
+    free(packed);
+    free(nearest);
 	
     return clusters;
 }
@@ -54,15 +54,34 @@ int      _debug;
 static void usage(char *argv0, float threshold) {
     char *help =
         "Usage: %s [switches] -i filename -n num_clusters\n"
-        "       -i filename    : file containing data to be clustered\n"
+        "       -i filename    : file containing data to be clustered,\n"
+        "                        - for the standard input\n"
         "       -b             : input file is in binary format (default no)\n"
+        "       -O             : output files in binary format (default no)\n"
         "       -n num_clusters: number of clusters (K must > 1)\n"
         "       -t threshold   : threshold value (default %.4f)\n"
+        "       -m method      : assignment method (default 0)\n"
+        "                        0: lloyd, 1: blocked gemm (large k and d)\n"
+        "                        2: elkan (same result, fewer distances)\n"
+        "                        3: hamerly (as 2, low memory, low d)\n"
+        "                        4: yinyang, group filter only (as 2, large k)\n"
+        "                        5: kd-tree filtering (d <= 16)\n"
+        "                        6: mini-batch, streams the file (see -B -I -r)\n"
+        "       -B batchSize   : objects per mini-batch (default %d)\n"
+        "       -I numBatches  : no. mini-batches (default %d)\n"
+        "       -r             : random mini-batches, binary files (default no)\n"
+        "       -c imethod     : initial centers (default 0)\n"
+        "                        0: random, 1: k-means++, 2: k-means||\n"
+        "       -R numRuns     : runs from different initial centers, the\n"
+        "                        best one is kept (default 1)\n"
 		"       -s splitNumber : split the data into s block (default 1)\n"
+		"       -M             : map the binary file instead of reading it (default no)\n"
+		"       -Q type        : store the objects as 1: fp16, 2: bf16, 3: int8,\n"
+		"                        Lloyd only (default 0: float)\n"
 		"       -g             : display clustered data graph (default no)\n"
         "       -o             : output timing results (default no)\n"
         "       -d             : enable debug mode\n";
-    fprintf(stderr, help, argv0, threshold);
+    fprintf(stderr, help, argv0, threshold, MINIBATCH_SIZE, MINIBATCH_ITER);
     exit(-1);
 }
 
@@ -71,17 +90,29 @@ int main(int argc, char **argv) {
            int     opt;
     extern char   *optarg;
     extern int     optind;
-           int     i, j;
-           int     isBinaryFile, is_output_timing;
+           int     i, j, n;
+           int     isBinaryFile, isOutFileBinary, is_output_timing;
 		   int     graph;
+		   int     method, imethod;
+		   int     batchSize, numBatches, randomBatches;
+		   int     r, numRuns;
+		   int     map;
+		   dataset* (*read_block)(int, char*, int, int);
+		   prefetch *pf = NULL;   /* reads the blocks of the split ahead */
+		   int     stream;        /* the input is a pipe, read once */
+		   int     quant;         /* QUANT_NONE, QUANT_FP16, ... */
+		   qdataset *qdata = NULL; /* current block of objects with -Q */
+		   int     numSeedObjs;   /* objects of data the centers come from */
 
            int     numClusters, numCoords, numObjs;
            int    *membership;    /* [numObjs] */
            char   *filename;
-           float **objects;
-           float **clusters;      /* [numClusters][numCoords] cluster center */
+           char   *outname;       /* filename, "stdin" for "-" */
+           dataset *data;         /* current block of objects */
+           float **objects;       /* data->rows */
+           float **clusters = NULL; /* [numClusters][numCoords] cluster center */
            float   threshold;
-           double  timing, io_timing, clustering_timing;
+           double  timing = 0.0, io_timing = 0.0, clustering_timing = 0.0;
            int     loop_iterations;
 		   
 		   int     splitNumber;
@@ -93,21 +124,44 @@ int main(int argc, char **argv) {
     /* some default values */
     _debug           = 0;
 	graph			 = 0;
+	method			 = KM_LLOYD;
+	imethod			 = KM_INIT_RANDOM;
+	batchSize		 = MINIBATCH_SIZE;
+	numBatches		 = MINIBATCH_ITER;
+	randomBatches	 = 0;
+	numRuns			 = 1;
+	map				 = 0;
     threshold        = 0.001;
 	splitNumber		 = 1;
+	quant			 = QUANT_NONE;
     numClusters      = 0;
     isBinaryFile     = 0;
+    isOutFileBinary  = 0;
     is_output_timing = 0;
     filename         = NULL;
 
-    while ( (opt=getopt(argc,argv,"p:i:l:n:s:t:abdgo"))!= EOF) {
+    while ( (opt=getopt(argc,argv,"c:p:i:l:m:n:s:t:B:I:R:Q:abdgorMO"))!= EOF) {
         switch (opt) {
             case 'i': filename=optarg;
                       break;
             case 'b': isBinaryFile = 1;
                       break;
+            case 'O': isOutFileBinary = 1;
+                      break;
             case 't': threshold = atof(optarg);
                       break;
+			case 'm': method = atoi(optarg);
+					  break;
+			case 'c': imethod = atoi(optarg);
+					  break;
+			case 'B': batchSize = atoi(optarg);
+					  break;
+			case 'I': numBatches = atoi(optarg);
+					  break;
+			case 'r': randomBatches = 1;
+					  break;
+			case 'R': numRuns = atoi(optarg);
+					  break;
 			case 's': splitNumber = atoi(optarg);
 					  break;
             case 'n': numClusters = atoi(optarg);
@@ -118,6 +172,10 @@ int main(int argc, char **argv) {
                       break;
 			case 'g': graph = 1;
 					  break;
+			case 'M': map = 1;
+					  break;
+			case 'Q': quant = atoi(optarg);
+					  break;
             case '?': usage(argv[0], threshold);
                       break;
             default: usage(argv[0], threshold);
@@ -125,12 +183,32 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (filename == 0 || numClusters <= 1) usage(argv[0], threshold);
+    if (filename == 0 || numClusters <= 1 || batchSize < 1 || numBatches < 1 ||
+        numRuns < 1 || quant < QUANT_NONE || quant > QUANT_INT8)
+        usage(argv[0], threshold);
+    if (quant && (method != KM_LLOYD || numRuns > 1)) {
+        printf("[seq kmean] reduced precision makes single Lloyd runs\n");
+        method  = KM_LLOYD;
+        numRuns = 1;
+    }
 
     if (is_output_timing) io_timing = wtime();
 
+	/* binary files can be mapped: no copy, the pages are read when used */
+	read_block = map ? file_map_block : file_read_block;
+
     /* read number of points from file -------------------------------------*/
-    file_read_head(isBinaryFile, filename, &numObjs, &numCoords);
+    if (!file_read_head(isBinaryFile, filename, &numObjs, &numCoords))
+        exit(1);
+    outname = strcmp(filename, "-") ? filename : "stdin";
+
+	/* a binary pipe is read once: mini-batches make a single pass over it
+	   and the graph cannot read it again */
+	stream = file_read_stream(isBinaryFile);
+	if (stream && graph) {
+		printf("[seq kmean] no graph of a streamed input\n");
+		graph = 0;
+	}
 
     /* membership: the cluster id for each data object */
     membership = (int*) malloc(numObjs * sizeof(int));
@@ -141,9 +219,13 @@ int main(int argc, char **argv) {
 	
 	/* initialize some other algorithm variables */
 	int numObjsIteration = numObjs / splitNumber;
-	malloc2D(objects, numObjsIteration, numCoords, float);
-    assert(objects != NULL);
-	malloc2D(clustersInit, numClusters, numCoords, float);
+	if (method == KM_MINIBATCH)   /* the first batch, for the initial centers */
+		numObjsIteration = (batchSize < numObjs) ? batchSize : numObjs;
+	if (method == KM_MINIBATCH && numRuns > 1) {
+		printf("[seq kmean] mini-batches make a single run\n");
+		numRuns = 1;
+	}
+	malloc2D(clustersInit, numRuns * numClusters, numCoords, float);
     assert(clustersInit != NULL);
 	membershipIteration = (int*) malloc(numObjsIteration * sizeof(int));
     assert(membershipIteration != NULL);
@@ -155,52 +237,126 @@ int main(int argc, char **argv) {
         clustering_timing = timing;
     }
     
-    /* initialize the cluster vector with random value ----------------------*/
-	objects = file_read_block(isBinaryFile, filename, numObjsIteration, numCoords);
-	for (i=0; i<numClusters; i++)
-        for (j=0; j<numCoords; j++)
-            clustersInit[i][j] = objects[rand()%numObjsIteration][rand()%numCoords];
+	/* initialize the cluster vector: random, k-means++ or k-means|| --------*/
+	numSeedObjs = numObjsIteration;
+	if (method == KM_MINIBATCH)
+		data = read_block(isBinaryFile, filename, numObjsIteration, numCoords);
+	else if (quant) {
+		/* the block is stored reduced; the centers come from its first
+		   QUANT_SEED objects, expanded back to floats */
+		qdata = quant_read_block(isBinaryFile, numObjsIteration, numCoords,
+				quant);
+		if (qdata == NULL) exit(1);
+		if (numSeedObjs > QUANT_SEED) numSeedObjs = QUANT_SEED;
+		data  = dataset_alloc(numSeedObjs, numCoords);
+		quant_load(qdata, 0, numSeedObjs, data->rows);
+	}
+	else {
+		/* the next block is read while this one is clustered */
+		pf   = prefetch_start(isBinaryFile, filename, numObjs, numCoords,
+				numObjsIteration, PREFETCH_BUFFERS, dataset_alloc, map);
+		data = prefetch_next(pf);
+	}
+	objects = data->rows;
+	/* one set of numClusters centers per run, one after the other */
+	for (r=0; r<numRuns; r++) {
+		if (imethod == KM_INIT_KPP)
+			kpp_init(1, objects, numCoords, numSeedObjs, numClusters,
+					 clustersInit + r * numClusters);
+		else if (imethod == KM_INIT_KPAR)
+			kpar_init(1, objects, numCoords, numSeedObjs, numClusters,
+					  clustersInit + r * numClusters);
+		else
+			for (i=r*numClusters; i<(r+1)*numClusters; i++)
+				for (j=0; j<numCoords; j++)
+					clustersInit[i][j] = objects[rand()%numSeedObjs][rand()%numCoords];
+	}
 	
-	/* data splitting to accelerate the process and minimize memory usage ---*/
-	iteration = 0;
-	while ( (iteration * numObjsIteration) < (numObjs - numObjsIteration) ) {
-		printf ("[seq kmean] data block %i - number of objects %i\n", 
-				iteration + 1, numObjsIteration);
+	/* mini-batches: the engine streams the file itself, only one batch of
+	   objects is in memory at a time --------------------------------------*/
+	if (method == KM_MINIBATCH && stream) {
+		printf ("[seq kmean] mini-batches of %i objects, one pass\n",
+				numObjsIteration);
+		clusters = minibatch_stream(1, data, isBinaryFile, numCoords,
+				numObjs, numClusters, clustersInit, numObjsIteration,
+				membership, &loop_iterations);
+	}
+	else if (method == KM_MINIBATCH) {
+		printf ("[seq kmean] %i mini-batches of %i objects\n", numBatches,
+				batchSize);
+		clusters = minibatch_kmeans(1, NULL, isBinaryFile, numCoords,
+				numObjs, numClusters, clustersInit, batchSize, numBatches,
+				randomBatches, membership, &loop_iterations);
+	}
+	else if (quant) {
+		/* the blocks of the split are read and stored reduced in turn */
+		for (iteration=0, i=0; i<numObjs; i+=n, iteration++) {
+			n = (i < numObjs - numObjsIteration) ? numObjsIteration
+			                                     : numObjs - i;
+			printf ("\n[seq kmean] data block %i - number of objects %i\n",
+					iteration + 1, n);
+			if (iteration != 0) {
+				quant_free(qdata);
+				qdata = quant_read_block(isBinaryFile, n, numCoords, quant);
+				if (qdata == NULL) exit(1);
+			}
+			clusters = quant_kmeans(1, qdata, numClusters,
+					clustersInit, threshold, membership + i, &loop_iterations);
+			if (i + n < numObjs) clustersInit = clusters;
+		}
+	}
+	else {
+		/* data splitting to accelerate the process and minimize memory usage ---*/
+		iteration = 0;
+		while ( (iteration * numObjsIteration) < (numObjs - numObjsIteration) ) {
+			printf ("[seq kmean] data block %i - number of objects %i\n", 
+					iteration + 1, numObjsIteration);
 		
-		// read data to clusterize
-		if (iteration != 0)
-			objects = file_read_block(isBinaryFile, filename, numObjsIteration, numCoords);
-		if (objects == NULL)
-			exit(1);
-		//memcpy(&objects[0][0], &objects[iteration * numObjsIteration][0],
-				//numObjsIteration * numCoords * sizeof(float));
+			// read data to clusterize
+			if (iteration != 0) {
+				data    = prefetch_next(pf);
+				objects = data->rows;
+			}
+			//memcpy(&objects[0][0], &objects[iteration * numObjsIteration][0],
+					//numObjsIteration * numCoords * sizeof(float));
 		
 	
-		// do clusterisation
-		clusters = seq_kmeans(objects, numCoords, numObjsIteration, numClusters,
-				clustersInit, threshold, membershipIteration, &loop_iterations);
+			// do clusterisation, all runs on the first block
+			if (iteration == 0 && numRuns > 1)
+				clusters = restart_kmeans(1, MAX_ITER, objects, numCoords,
+						numObjsIteration, numClusters, clustersInit, numRuns,
+						threshold, membershipIteration, &loop_iterations);
+			else
+				clusters = seq_kmeans(method, objects, numCoords, numObjsIteration, numClusters,
+						clustersInit, threshold, membershipIteration, &loop_iterations);
 		
-		// save the results
-		memcpy(&membership[iteration * numObjsIteration], &membershipIteration[0],
-				numObjsIteration * sizeof(int));
-		clustersInit = clusters;
+			// save the results
+			memcpy(&membership[iteration * numObjsIteration], &membershipIteration[0],
+					numObjsIteration * sizeof(int));
+			clustersInit = clusters;
 		
-		iteration++;
-	};
+			iteration++;
+		};
 	
-	/* last iteration -----------------------------------------------------*/
-	lastObjsIteration = numObjs - numObjsIteration * iteration;
-	printf ("[seq kmean] data block %i - number of objects %i\n", 
-				iteration + 1, lastObjsIteration);
-	if (iteration != 0)
-		objects = file_read_block(isBinaryFile, filename, lastObjsIteration, numCoords);
-	if (objects == NULL)
-		exit(1);
+		/* last iteration -----------------------------------------------------*/
+		lastObjsIteration = numObjs - numObjsIteration * iteration;
+		printf ("[seq kmean] data block %i - number of objects %i\n", 
+					iteration + 1, lastObjsIteration);
+		if (iteration != 0) {
+			data    = prefetch_next(pf);
+			objects = data->rows;
+		}
 
-	clusters = seq_kmeans(objects, numCoords, lastObjsIteration, numClusters,
-			clustersInit, threshold, membershipIteration, &loop_iterations);
-	memcpy(&membership[iteration * numObjsIteration], &membershipIteration[0],
-			lastObjsIteration * sizeof(int));
+		if (iteration == 0 && numRuns > 1)
+			clusters = restart_kmeans(1, MAX_ITER, objects, numCoords,
+					lastObjsIteration, numClusters, clustersInit, numRuns,
+					threshold, membershipIteration, &loop_iterations);
+		else
+			clusters = seq_kmeans(method, objects, numCoords, lastObjsIteration, numClusters,
+					clustersInit, threshold, membershipIteration, &loop_iterations);
+		memcpy(&membership[iteration * numObjsIteration], &membershipIteration[0],
+				lastObjsIteration * sizeof(int));
+	}
 	
 	
 	/* restart io timer ----------------------------------------------------*/
@@ -210,15 +366,18 @@ int main(int argc, char **argv) {
     }
 
 	/* free memory part 1 --------------------------------------------------*/
+	if (pf != NULL)
+		prefetch_stop(pf);   /* frees data with the other blocks */
+	else
+		dataset_free(data);
+	quant_free(qdata);
 	file_read_close(isBinaryFile);
-	free(objects[0]);
-	free(objects);
 	free(clustersInit[0]);
 	free(clustersInit);
 	free(membershipIteration);
 
     /* output: the coordinates of the cluster centres ----------------------*/
-    file_write(filename, numClusters, numObjs, numCoords, clusters,
+    file_write(isOutFileBinary, outname, numClusters, numObjs, numCoords, clusters,
                membership);
 
 	/*- wait for key to continue -------------------------------------------*/
@@ -248,26 +407,21 @@ int main(int argc, char **argv) {
 	/* display results if needed --------------------------------------------*/
 	if (graph) {
 		file_read_head(isBinaryFile, filename, &numObjs, &numCoords);
-		objects = file_read_block(isBinaryFile, filename, numObjs, numCoords);
+		data = read_block(isBinaryFile, filename, numObjs, numCoords);
 		file_read_close(isBinaryFile);
-		float* xObj = (float*)malloc(numObjs * sizeof(float));
-		float* yObj = (float*)malloc(numObjs * sizeof(float));
+		/* the first two coordinates, contiguous in the coordinate-major view */
+		float* xObj = dataset_soa(data);
+		float* yObj = xObj + numObjs;
 		float* xClu = (float*)malloc(numClusters * sizeof(float));
 		float* yClu = (float*)malloc(numClusters * sizeof(float));
 		for (i=0; i<numClusters; i++) {
 			xClu[i] = clusters[i][0];
 			yClu[i] = clusters[i][1];
 		}
-		for(i=0; i<numObjs; i++) {
-			xObj[i] = objects[i][0];
-			yObj[i] = objects[i][1];
-		}
 		pdf_kmean(xObj, yObj, numObjs, xClu, yClu, numClusters, membership);
-		free(xObj);
-		free(yObj);
 		free(xClu);
 		free(yClu);
-		free(objects);
+		dataset_free(data);
 	}
 	
 	/* free memory part 2 */
@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# Converts a data set with convert_main into chunked files (by row and by
+# coordinate, raw and compressed, with several chunk sizes) and checks that
+# seq_main and omp_main give the same memberships and centers on each of
+# them as on the plain binary file, read from disk, from the standard input
+# and from a FIFO. The first chunk of 500 objects holds random coordinates
+# that do not compress and must be stored raw; the other chunks compress.
+#
+# Then checks that damaged files are refused with an error, not a crash nor
+# a result: a truncated chunked file, raw and compressed, a compressed chunk
+# whose first bytes are zeroed (lz_decompress() must reject it), a chunked
+# file streamed and a plain binary file cut short on the standard input.
+#
+# The plain binary file is cut out of a one-chunk row file, the same
+# [numObjs][numCoords] floats after the two header integers.
+#
+# usage: tests/chunked.sh [directory with seq_main, omp_main, convert_main]
+
+bin=$(cd ${1:-.} && pwd)
+tmp=${TMPDIR:-/tmp}/kmeans_chunked.$$
+mkdir -p $tmp || exit 1
+trap 'rm -rf $tmp' 0
+
+# 3000 objects of 4 coordinates: the first 500 of random sign and
+# magnitude (1e-18 to 1e18), whose bytes hardly repeat, then multiples of
+# 1/8 around 4 centers
+awk 'BEGIN { srand(5);
+             for (i=0; i<3000; i++) {
+                 printf "%d", i
+                 for (j=0; j<4; j++) {
+                     if (i < 500) {
+                         x = exp((rand() * 36 - 18) * log(10))
+                         if (rand() < 0.5) x = -x
+                     }
+                     else {
+                         x = (i % 4) * 10 + ((i + j) % 3) * 2 + rand() * 4
+                         x = int(x * 8) / 8
+                     }
+                     printf " %.7g", x
+                 }
+                 printf "\n"
+             } }' > $tmp/a.txt
+
+fail=0
+check() {   # check name status: report a step that failed
+    if [ $2 != 0 ]; then
+        echo "FAIL: $1"
+        fail=1
+    fi
+}
+offset() {  # offset file chunk: byte offset of the chunk, from the table
+    od -An -t d8 -j $((40 + 8 * $2)) -N 8 $1 | tr -d ' '
+}
+convert() { # convert name options
+    $bin/convert_main -i $tmp/a.txt -w $tmp/$1 $2 < /dev/null > /dev/null 2>&1
+    check "convert_main $2" $?
+}
+
+convert one.kmc "-c 100000"
+o=$(offset $tmp/one.kmc 0)
+{ dd if=$tmp/one.kmc bs=8 skip=1 count=1 2> /dev/null
+  tail -c +$((o + 1)) $tmp/one.kmc; } > $tmp/a.bin
+
+convert rows.kmc  "-c 500"
+convert cols.kmc  "-c 500 -C"
+convert lz.kmc    "-c 500 -z"
+convert lzc.kmc   "-c 500 -z -C"
+convert small.kmc "-c 7 -z"
+
+# the first chunk of lz.kmc is stored at its raw size, the second is smaller
+raw=$((500 * 4 * 4))
+o0=$(offset $tmp/lz.kmc 0)
+o1=$(offset $tmp/lz.kmc 1)
+o2=$(offset $tmp/lz.kmc 2)
+[ $((o1 - o0)) = $raw ] && [ $((o2 - o1)) -lt $raw ]
+check "lz.kmc: one raw and one compressed chunk" $?
+
+for main in seq_main omp_main; do
+    $bin/$main -b -n 4 -i $tmp/a.bin < /dev/null > /dev/null 2>&1
+    check "$main a.bin" $?
+    for f in one rows cols lz lzc small; do
+        $bin/$main -b -n 4 -i $tmp/$f.kmc < /dev/null > /dev/null 2>&1
+        cmp -s $tmp/a.bin.membership $tmp/$f.kmc.membership &&
+        cmp -s $tmp/a.bin.cluster_centres $tmp/$f.kmc.cluster_centres
+        check "$main $f.kmc" $?
+    done
+
+    (cd $tmp && $bin/$main -b -n 4 -i - < a.bin > /dev/null 2>&1)
+    cmp -s $tmp/a.bin.membership $tmp/stdin.membership &&
+    cmp -s $tmp/a.bin.cluster_centres $tmp/stdin.cluster_centres
+    check "$main -i - (standard input)" $?
+
+    rm -f $tmp/fifo; mkfifo $tmp/fifo
+    cat $tmp/a.bin > $tmp/fifo &
+    $bin/$main -b -n 4 -i $tmp/fifo < /dev/null > /dev/null 2>&1
+    kill $! 2> /dev/null; wait
+    cmp -s $tmp/a.bin.membership $tmp/fifo.membership &&
+    cmp -s $tmp/a.bin.cluster_centres $tmp/fifo.cluster_centres
+    check "$main FIFO" $?
+done
+
+# damaged files: an exit status of 1 to 127 and a message on stderr
+head -c 20000 $tmp/rows.kmc > $tmp/cut.kmc
+head -c 20000 $tmp/lz.kmc   > $tmp/cutlz.kmc
+cp $tmp/lz.kmc $tmp/bad.kmc
+dd if=/dev/zero of=$tmp/bad.kmc bs=1 seek=$o1 count=64 conv=notrunc 2> /dev/null
+head -c 20000 $tmp/a.bin    > $tmp/cut.bin
+refused() { # refused status: the last run failed cleanly
+    [ $1 -gt 0 ] && [ $1 -lt 128 ] && grep -q error $tmp/err
+}
+for main in seq_main omp_main; do
+    for f in cut.kmc cutlz.kmc bad.kmc; do
+        for opt in "" "-s 2"; do
+            $bin/$main -b -n 4 $opt -i $tmp/$f < /dev/null > /dev/null \
+                2> $tmp/err
+            refused $?
+            check "$main $opt $f is not refused" $?
+        done
+    done
+    $bin/$main -b -n 4 -i - < $tmp/lz.kmc > /dev/null 2> $tmp/err
+    refused $?
+    check "$main -i - < lz.kmc is not refused" $?
+    $bin/$main -b -n 4 -i - < $tmp/cut.bin > /dev/null 2> $tmp/err
+    refused $?
+    check "$main -i - < cut.bin is not refused" $?
+done
+
+[ $fail = 0 ] && echo "chunked: all passed"
+exit $fail
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Runs the exact methods of seq_main and omp_main (-m 2 Elkan, 3 Hamerly,
+# 4 Yinyang, 5 kd-tree) on small fixed data sets and checks them against
+# Lloyd's algorithm (-m 0) from the same initial centers: the memberships
+# must be the same and every center coordinate within 1e-4 (relative) of
+# Lloyd's. The data are uniform, not clustered, so that many objects sit
+# near a boundary and the bounds are put to work.
+#
+# usage: tests/engines.sh [directory with seq_main and omp_main]
+
+bin=${1:-.}
+tmp=${TMPDIR:-/tmp}/kmeans_engines.$$
+mkdir -p $tmp || exit 1
+trap 'rm -rf $tmp' 0
+
+# uniform objects: id and d coordinates in [0, 10)
+gen() {
+    awk -v n=$1 -v d=$2 -v seed=$3 'BEGIN { srand(seed);
+        for (i=0; i<n; i++) {
+            printf "%d", i
+            for (j=0; j<d; j++) printf " %.4f", rand() * 10
+            printf "\n"
+        } }'
+}
+gen 2000 3 11 > $tmp/d3.txt
+gen 2000 5 13 > $tmp/d5.txt
+
+fail=0
+for main in seq_main omp_main; do
+    for run in "d3.txt 4" "d3.txt 20" "d5.txt 7" "d5.txt 20"; do
+        set -- $run
+        $bin/$main -m 0 -n $2 -i $tmp/$1 < /dev/null > $tmp/out 2>&1
+        mv $tmp/$1.membership     $tmp/ref.membership
+        mv $tmp/$1.cluster_centres $tmp/ref.cluster_centres
+        for m in 2 3 4 5; do
+            rm -f $tmp/$1.membership $tmp/$1.cluster_centres
+            $bin/$main -m $m -n $2 -i $tmp/$1 < /dev/null > $tmp/out 2>&1
+            if ! cmp -s $tmp/ref.membership $tmp/$1.membership ||
+               ! awk 'NR == FNR { for (j=2; j<=NF; j++) ref[FNR, j] = $j
+                                  rows = FNR; next }
+                      { n++
+                        for (j=2; j<=NF; j++) {
+                            e = $j - ref[FNR, j]; if (e < 0) e = -e
+                            a = ref[FNR, j];      if (a < 0) a = -a
+                            if (e > 1e-4 * (a > 1 ? a : 1)) bad = 1
+                        } }
+                      END { exit bad || n != rows }' \
+                     $tmp/ref.cluster_centres $tmp/$1.cluster_centres \
+                     2> /dev/null; then
+                echo "FAIL: $main -m $m -n $2 $1"
+                fail=1
+            fi
+        done
+    done
+done
+[ $fail = 0 ] && echo "engines: all passed"
+exit $fail
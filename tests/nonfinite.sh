@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Runs seq_main and omp_main on a data set with a non-finite coordinate
+# under every kernel level (KMEANS_ISA) and checks that every object is
+# assigned to one of the clusters. An inf coordinate makes the distances to
+# its center inf or NaN, which the vector kernels must not turn into an
+# index past the last cluster.
+#
+# usage: tests/nonfinite.sh [directory with seq_main and omp_main]
+
+bin=${1:-.}
+tmp=${TMPDIR:-/tmp}/kmeans_nonfinite.$$
+mkdir -p $tmp || exit 1
+trap 'rm -rf $tmp' 0
+
+awk 'BEGIN { srand(7);
+             for (i=0; i<500; i++)
+                 if (i == 250) print i, "inf", rand(), rand();
+                 else          print i, rand(), rand(), rand() }' > $tmp/inf.txt
+
+fail=0
+for main in seq_main omp_main; do
+    for isa in scalar sse avx2 avx512; do
+        for n in 3 16; do
+            rm -f $tmp/inf.txt.membership
+            KMEANS_ISA=$isa $bin/$main -n $n -i $tmp/inf.txt \
+                < /dev/null > $tmp/out 2>&1
+            if ! awk -v n=$n 'NF != 2 || $2 < 0 || $2 >= n { bad = 1 }
+                              END { exit bad || NR != 500 }' \
+                     $tmp/inf.txt.membership 2> /dev/null; then
+                echo "FAIL: $main KMEANS_ISA=$isa -n $n"
+                fail=1
+            fi
+        done
+    done
+done
+[ $fail = 0 ] && echo "nonfinite: all passed"
+exit $fail
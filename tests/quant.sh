@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Runs seq_main and omp_main with the objects stored in reduced precision
+# (-Q 1 fp16, 2 bf16, 3 int8), in one block and in 3 (-s 3), on well
+# separated clusters and checks that the memberships agree with the float
+# run: after matching each cluster of the -Q run with the float cluster
+# holding most of its objects, at least 99% of the objects must be in the
+# matched cluster. The objects spread +-5 around centers from 40 to 950
+# in each coordinate, so the int8 steps of about 3.6 are not small next to
+# the spread. Also checks that fp16 refuses a coordinate beyond its range.
+#
+# usage: tests/quant.sh [directory with seq_main and omp_main]
+
+bin=${1:-.}
+tmp=${TMPDIR:-/tmp}/kmeans_quant.$$
+mkdir -p $tmp || exit 1
+trap 'rm -rf $tmp' 0
+
+# 6000 objects of 8 coordinates in 8 clusters whose centers differ by 130
+# or more in every coordinate; k-means++ (-c 1) seeds one center in each
+awk 'BEGIN { srand(9);
+             for (i=0; i<8; i++)
+                 for (j=0; j<8; j++) c[i, j] = 40 + 130 * ((i * 5 + j * 3) % 8)
+             for (i=0; i<6000; i++) {
+                 k = int(rand() * 8)
+                 printf "%d", i
+                 for (j=0; j<8; j++) printf " %.4f", c[k, j] + rand() * 10 - 5
+                 printf "\n"
+             } }' > $tmp/q.txt
+
+fail=0
+for main in seq_main omp_main; do
+    for split in "" "-s 3"; do
+        $bin/$main -n 8 -c 1 $split -i $tmp/q.txt < /dev/null > $tmp/out 2>&1
+        mv $tmp/q.txt.membership $tmp/ref.membership
+        for q in 1 2 3; do
+            rm -f $tmp/q.txt.membership
+            $bin/$main -n 8 -c 1 $split -Q $q -i $tmp/q.txt < /dev/null \
+                > $tmp/out 2>&1
+            if ! awk 'NR == FNR { ref[$1] = $2; next }
+                      ($1 in ref) { n++; pair[$2, ref[$1]]++
+                                    if (pair[$2, ref[$1]] > best[$2])
+                                        best[$2] = pair[$2, ref[$1]] }
+                      END { for (c in best) agree += best[c]
+                            exit n != 6000 || agree < 0.99 * n }' \
+                     $tmp/ref.membership $tmp/q.txt.membership \
+                     2> /dev/null; then
+                echo "FAIL: $main $split -Q $q"
+                fail=1
+            fi
+        done
+    done
+done
+
+# beyond the fp16 range: an error, not inf coordinates
+echo "6000 70000 0 0 0 0 0 0 0" >> $tmp/q.txt
+for main in seq_main omp_main; do
+    $bin/$main -n 8 -Q 1 -i $tmp/q.txt < /dev/null > /dev/null 2> $tmp/err
+    if [ $? = 0 ] || ! grep -q error $tmp/err; then
+        echo "FAIL: $main -Q 1 with a coordinate of 70000"
+        fail=1
+    fi
+done
+
+[ $fail = 0 ] && echo "quant: all passed"
+exit $fail
@@ -0,0 +1,308 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   File:         yinyang_kmeans.c                                          */
+/*   Description:  Lloyd's iteration accelerated with grouped lower bounds   */
+/*                 (Y. Ding et al., "Yinyang K-Means: A Drop-In Replacement  */
+/*                 of the Classic K-Means with Consistent Speedup", ICML     */
+/*                 2015). The centers are clustered once into about k/10     */
+/*                 groups and every object keeps an upper bound on the       */
+/*                 distance to its own center and one lower bound per group. */
+/*                 A whole group is skipped when its bound exceeds the upper */
+/*                 bound (group filter); otherwise the upper bound is first  */
+/*                 tightened and the group distances are computed by one     */
+/*                 cluster_distances() call (centroid level). The paper's    */
+/*                 per-center local filter was dropped: its looser bounds    */
+/*                 made later loops scan more groups and the per-center      */
+/*                 branches cost more than the distances they saved. The     */
+/*                 clustering is the same as the one of plain Lloyd's        */
+/*                 iteration, up to objects exactly equidistant to two       */
+/*                 centers.                                                  */
+/*                                                                           */
+/*                 Memory: numObjs * k/10 floats, which sits between         */
+/*                 elkan_kmeans() and hamerly_kmeans() and keeps working     */
+/*                 bounds for k in the thousands.                            */
+/*                                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <omp.h>
+#include "kmeans.h"
+
+#define GROUP_SIZE   10   /* average no. centers per group */
+#define GROUP_ITER    5   /* Lloyd loops used to group the centers */
+
+
+/*----< group_centers() >----------------------------------------------------*/
+/* split the centers into numGroups groups by a few Lloyd loops on the       */
+/* centers themselves, seeded with evenly spaced centers. On return the      */
+/* members of group g are members[groupStart[g] .. groupStart[g+1]-1]        */
+static
+void group_centers(int     numCoords,
+                   int     numClusters,
+                   float **clusters,    /* [numClusters][numCoords] */
+                   int     numGroups,
+                   int    *groupOf,     /* out: [numClusters] */
+                   int    *groupStart,  /* out: [numGroups+1] */
+                   int    *members)     /* out: [numClusters] */
+{
+    int     i, j, g, loop;
+    float **gcenters;
+    int    *size;
+
+    malloc2D(gcenters, numGroups, numCoords, float);
+    size = (int*) malloc(numGroups * sizeof(int));
+    assert(size != NULL);
+
+    for (g=0; g<numGroups; g++)
+        for (j=0; j<numCoords; j++)
+            gcenters[g][j] = clusters[(size_t)g * numClusters / numGroups][j];
+
+    for (loop=0; loop<GROUP_ITER; loop++) {
+        for (i=0; i<numClusters; i++) {
+            float dist;
+            groupOf[i] = find_nearest_cluster(numGroups, numCoords, &dist,
+                                              clusters[i], gcenters);
+        }
+        for (g=0; g<numGroups; g++) size[g] = 0;
+        for (i=0; i<numClusters; i++) size[groupOf[i]]++;
+        for (g=0; g<numGroups; g++)
+            if (size[g] > 0)
+                for (j=0; j<numCoords; j++) gcenters[g][j] = 0.0;
+        for (i=0; i<numClusters; i++)
+            for (j=0; j<numCoords; j++)
+                gcenters[groupOf[i]][j] += clusters[i][j];
+        for (g=0; g<numGroups; g++)
+            if (size[g] > 0)
+                for (j=0; j<numCoords; j++) gcenters[g][j] /= size[g];
+    }
+
+    /* counting sort of the centers by group */
+    groupStart[0] = 0;
+    for (g=0; g<numGroups; g++) groupStart[g+1] = groupStart[g] + size[g];
+    for (g=0; g<numGroups; g++) size[g] = groupStart[g];
+    for (i=0; i<numClusters; i++) members[size[groupOf[i]]++] = i;
+
+    free(gcenters[0]);
+    free(gcenters);
+    free(size);
+}
+
+/*----< yinyang_kmeans() >---------------------------------------------------*/
+/* return an array of cluster centers of size [numClusters][numCoords]       */
+float** yinyang_kmeans(int     nthreads,     /* no. threads, 1 for sequential */
+                       int     maxIter,      /* max no. loops */
+                       float **objects,      /* in: [numObjs][numCoords] */
+                       int     numCoords,    /* no. features */
+                       int     numObjs,      /* no. objects */
+                       int     numClusters,  /* no. clusters */
+                       float **clustersInit, /* init value for cluster */
+                       float   threshold,    /* % objects change membership */
+                       int    *membership,   /* in/out: [numObjs] */
+                       int    *loop_iterations)
+{
+    int      i, j, g, loop=0;
+    int      numGroups;
+    float    delta;          /* % of objects change their clusters */
+    double   numDist;        /* no. distances computed, for debug */
+    float  **clusters;       /* out: [numClusters][numCoords] */
+    int     *assign;         /* [numObjs] current center of each object */
+    float   *upper;          /* [numObjs] upper bound to own center */
+    float   *lower;          /* [numObjs][numGroups] lower bound per group */
+    float   *shift;          /* [numClusters] distance moved by each center */
+    int     *size;           /* [numClusters] running no. members */
+    double  *sum;            /* [numClusters][numCoords] running member sums */
+    float   *groupShift;     /* [numGroups] largest move within each group */
+    int     *groupOf;        /* [numClusters] group of each center */
+    int     *groupStart;     /* [numGroups+1] first member of each group */
+    int     *members;        /* [numClusters] centers sorted by group */
+    float  **groupClusters;  /* [numClusters] center rows sorted by group */
+    float   *scratch;        /* [nthreads][numClusters] distance rows */
+
+    numGroups = numClusters / GROUP_SIZE;
+    if (numGroups < 1) numGroups = 1;
+
+    malloc2D(clusters, numClusters, numCoords, float);
+    for (i=0; i<numClusters; i++)
+        for (j=0; j<numCoords; j++)
+            clusters[i][j] = clustersInit[i][j];
+
+    assign     = (int*)   malloc(numObjs * sizeof(int));
+    assert(assign != NULL);
+    upper      = (float*) malloc(numObjs * sizeof(float));
+    assert(upper != NULL);
+    lower      = (float*) malloc((size_t)numObjs * numGroups * sizeof(float));
+    assert(lower != NULL);
+    shift      = (float*) malloc(numClusters * sizeof(float));
+    assert(shift != NULL);
+    size       = (int*)    calloc(numClusters, sizeof(int));
+    assert(size != NULL);
+    sum        = (double*) calloc((size_t)numClusters * numCoords, sizeof(double));
+    assert(sum != NULL);
+    groupShift = (float*) malloc(numGroups * sizeof(float));
+    assert(groupShift != NULL);
+    groupOf    = (int*)   malloc(numClusters * sizeof(int));
+    assert(groupOf != NULL);
+    groupStart = (int*)   malloc((numGroups + 1) * sizeof(int));
+    assert(groupStart != NULL);
+    members    = (int*)   malloc(numClusters * sizeof(int));
+    assert(members != NULL);
+    groupClusters = (float**) malloc(numClusters * sizeof(float*));
+    assert(groupClusters != NULL);
+    scratch    = (float*) malloc((size_t)nthreads * numClusters * sizeof(float));
+    assert(scratch != NULL);
+
+    kernels_init();
+
+    group_centers(numCoords, numClusters, clusters, numGroups, groupOf,
+                  groupStart, members);
+    for (j=0; j<numClusters; j++)
+        groupClusters[j] = clusters[members[j]];
+
+    /* first loop: all distances, exactly as Lloyd */
+    numDist = (double)numObjs * numClusters;
+    #pragma omp parallel for num_threads(nthreads) private(i,j,g) \
+            schedule(static)
+    for (i=0; i<numObjs; i++) {
+        float *d = scratch + (size_t)omp_get_thread_num() * numClusters;
+        float *l = lower + (size_t)i * numGroups;
+        float  min;
+        int    index = 0;
+
+        cluster_distances(numClusters, numCoords, objects[i], clusters, d);
+        min = d[0];
+        for (j=1; j<numClusters; j++)
+            if (d[j] < min) {
+                min   = d[j];
+                index = j;
+            }
+        assign[i] = index;
+        upper[i]  = sqrtf(min);
+
+        /* the own center is left out of its group bound */
+        d[index] = INFINITY;
+        for (g=0; g<numGroups; g++) {
+            int m;
+            min = INFINITY;
+            for (m=groupStart[g]; m<groupStart[g+1]; m++)
+                if (d[members[m]] < min) min = d[members[m]];
+            l[g] = sqrtf(min);
+        }
+    }
+
+    do {
+        delta = 0.0;
+
+        if (loop > 0) {
+            double loopDist = 0.0;
+
+            /* assignment filtered by the bounds */
+            #pragma omp parallel for num_threads(nthreads) private(i,j,g) \
+                    schedule(dynamic, 256) reduction(+:loopDist)
+            for (i=0; i<numObjs; i++) {
+                float *d  = scratch + (size_t)omp_get_thread_num() * numClusters;
+                float *l  = lower + (size_t)i * numGroups;
+                int    a0 = assign[i];
+                int    a  = a0;
+                float  d0, u, u2;
+                float  globalLower = l[0];
+
+                for (g=1; g<numGroups; g++)
+                    if (l[g] < globalLower) globalLower = l[g];
+                if (upper[i] <= globalLower) continue;
+
+                /* tighten the upper bound and try again */
+                d0 = u2 = euclid_dist_2(numCoords, objects[i], clusters[a0]);
+                u  = sqrtf(u2);
+                loopDist += 1.0;
+                if (u <= globalLower) {
+                    upper[i] = u;
+                    continue;
+                }
+
+                for (g=0; g<numGroups; g++) {
+                    int   c, n = groupStart[g+1] - groupStart[g];
+                    int  *ids = members + groupStart[g];
+                    float minIn = INFINITY;
+
+                    /* group filter */
+                    if (u <= l[g]) continue;
+
+                    /* all distances of the group in one kernel call */
+                    cluster_distances(n, numCoords, objects[i],
+                                      groupClusters + groupStart[g], d);
+                    loopDist += n;
+
+                    for (c=0; c<n; c++) {
+                        j = ids[c];
+                        if (j == a) continue;
+                        if (j == a0) d[c] = d0;   /* already known */
+                        if (d[c] < u2 || (d[c] == u2 && j < a)) {
+                            /* the previous center becomes an other center */
+                            if (groupOf[a] == g) {
+                                if (u2 < minIn) minIn = u2;
+                            }
+                            else if (u < l[groupOf[a]])
+                                l[groupOf[a]] = u;
+                            a  = j;
+                            u2 = d[c];
+                            u  = sqrtf(u2);
+                        }
+                        else if (d[c] < minIn)
+                            minIn = d[c];
+                    }
+                    l[g] = sqrtf(minIn);
+                }
+                assign[i] = a;
+                upper[i]  = u;
+            }
+            numDist += loopDist;
+        }
+
+        /* move the objects that changed cluster (delta) from one running
+           sum to the other: new centers and how far they moved */
+        delta = update_centers(nthreads, objects, numCoords, numObjs,
+                               numClusters, assign, membership, size, sum,
+                               clusters, shift);
+
+        /* relax the bounds: each group bound by the largest move within it */
+        for (g=0; g<numGroups; g++) groupShift[g] = 0.0;
+        for (j=0; j<numClusters; j++)
+            if (shift[j] > groupShift[groupOf[j]])
+                groupShift[groupOf[j]] = shift[j];
+
+        #pragma omp parallel for num_threads(nthreads) private(i,g) \
+                schedule(static)
+        for (i=0; i<numObjs; i++) {
+            float *l = lower + (size_t)i * numGroups;
+            for (g=0; g<numGroups; g++)
+                l[g] -= groupShift[g];
+            upper[i] += shift[assign[i]];
+        }
+
+        delta /= numObjs;
+        if (_debug)
+            printf("delta = %.3f distances = %.0f (%.1f%% of lloyd)\n", delta,
+                   numDist, 100.0 * numDist /
+                   ((double)(loop + 1) * numObjs * numClusters));
+
+    } while (delta > threshold && loop++ < maxIter);
+
+    *loop_iterations = loop + 1;
+
+    free(assign);
+    free(upper);
+    free(lower);
+    free(shift);
+    free(size);
+    free(sum);
+    free(groupShift);
+    free(groupOf);
+    free(groupStart);
+    free(members);
+    free(groupClusters);
+    free(scratch);
+
+    return clusters;
+}